@@ -5,41 +5,152 @@ char startdir[PATH_MAX]; // this stores the directory in which the command is ru
 void help() {
     
     printf("asm8085 v" VERSION " (build " BUILD ")\n\n");
-    printf("usage: asm8085 -h | [-o output] [-l file] source\n");
+    printf("usage: asm8085 -h | --server <socket> | [-v] [-O] [-c|-S|-r|-R] [--rst[=file]] [-M|-MD] [-MF file] [-MP] [-C dir] [-o output] [-l file] [-t file] [-P file] source\n");
     printf("\t-h       \tShow help\n");
+    printf("\t-c       \tWrite a relocatable object (for ld8085) instead of a binary\n");
+    printf("\t-v       \tReport peak memory use, the sections left out, the bytes pooled, the stack depth\n");
+    printf("\t         \t(and, with -R, what ran)\n");
+    printf("\t-S       \tStream: use less memory by assembling twice (no listing)\n");
+    printf("\t-r       \tRelease: use less memory by freeing lines once they are final (no listing)\n");
+    printf("\t-O       \tOptimize: rewrite slow instruction sequences into faster ones\n");
+    printf("\t-R, --run\tRun the code once the binary is written, and exit with the value left in A\n");
+    printf("\t-P <file>, --profile <file>\n");
+    printf("\t         \tRun the code as -R does, and write where it spent its time to file\n");
+    printf("\t--rst[=<file>]\tCall the most called routines with 'rst' (in the vectors reserved by\n");
+    printf("\t         \t'rstslots'), counting the calls by running the code, or reading\n");
+    printf("\t         \t'name count' lines from file\n");
     printf("\t-o <file>\tSet output file\n");
     printf("\t-l <file>\tWrite listing\n");
+    printf("\t-t <file>\tWrite trace-event JSON (for chrome://tracing or Perfetto)\n");
+    printf("\t-M       \tOnly write Makefile dependencies (to stdout, or the -MF file)\n");
+    printf("\t-MD      \tAlso write Makefile dependencies (to output.d, or the -MF file)\n");
+    printf("\t-MF <file>\tSet dependency file\n");
+    printf("\t-MP      \tAdd an empty rule for each dependency\n");
+    printf("\t-C <dir> \tCache output in dir, and reuse it if no source file has changed\n");
+    printf("\n");
+    printf("asm8085 --server <socket> stays up, and assembles the jobs sent to the socket, keeping\n");
+    printf("the source files it reads parsed. If ASM8085_SERVER is set to the socket, asm8085 sends\n");
+    printf("its job there (and assembles it itself if no server is running).\n");
     
     exit(0);
 }
 
-// Replace extension by '.bin'
-char *make_bin_file(const char *fname) {
+// Replace extension by the given one ('.bin' or '.obj')
+char *make_out_file(const char *fname, const char *ext) {
     char *bin, *dot, *slash; 
     bin = copy_string(fname);
-    bin = realloc(bin, strlen(bin)+5); // make sure there is room
+    bin = realloc(bin, strlen(bin)+strlen(ext)+1); // make sure there is room
 
     // Find last slash and dot
     slash = strrchr(bin, '/');
     dot = strrchr(bin, '.');
     
     if (dot == NULL || slash > dot) {
-        // No dot, or slash after dot: append ".bin" 
-        strcat(bin, ".bin");
+        // No dot, or slash after dot: append the extension
+        strcat(bin, ext);
     } else {
-        // Dot, replace extension by ".bin"
-        strcpy(dot, ".bin");
+        // Dot, replace extension
+        strcpy(dot, ext);
     }
     
     return bin;
 }
 
-int main(int argc, char **argv) {
-    int c;
-    char *inp=NULL, *outp=NULL, *list=NULL; 
+// Open a file for writing ('-' is stdout), exit if it cannot be opened
+FILE *open_for_writing(const char *fname) {
+    FILE *f;
+    if (!strcmp(fname, "-")) return stdout;
+    if ((f = fopen(fname, "w")) == NULL) {
+        fprintf(stderr, "cannot open %s for writing: %s\n", fname, strerror(errno));
+        exit(1);
+    }
+    return f;
+}
+
+// Report the peak memory use, if the user wanted to know
+int verbose = FALSE;
+void report_memory() {
+    struct rusage usage;
+    if (!verbose) return;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) {
+        fprintf(stderr, "asm8085: cannot get memory use: %s\n", strerror(errno));
+    } else {
+        fprintf(stderr, "asm8085: peak memory use: %ld KB\n", usage.ru_maxrss);
+    }
+}
+
+// Write the dependencies to depf (or, if it is NULL, to stdout for -M or output.d for -MD)
+void write_deps(char *depf, int deps_only, const char *outp, int phony) {
+    FILE *depsf;
+    
+    if (depf == NULL) depf = deps_only ? "-" : make_out_file(outp, ".d");
+    
+    if (!strcmp(depf, "-")) {
+        depsf = stdout;
+    } else if ((depsf = fopen(depf, "w")) == NULL) {
+        fprintf(stderr, "cannot open %s for writing: %s\n", depf, strerror(errno));
+        exit(1);
+    }
+    
+    if (!deps_write(depsf, outp, startdir, phony)) {
+        fprintf(stderr, "write error: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (depsf != stdout) fclose(depsf);
+}
+
+// Run the assembled code in the simulator, starting at its first byte, and exit with the
+// value the program leaves in A once it halts. The console is on stdin and stdout.
+// If profile is not NULL, a profile of the run is written there.
+void run_binary(struct asmstate *state, const struct line *lines, const char *profile) {
+    const struct line *line;
+    struct sim *s;
+    FILE *proff;
+    int status;
+    
+    // The code runs on the CPU selected where it starts
+    for (line = lines; line != NULL && line->n_bytes == 0; line = line->next_line);
+    
+    s = init_sim(line != NULL ? line->cpu : state->cpu);
+    s->pc = make_image(lines, s->mem);
+    if (profile != NULL) init_profile(s);
+    sim_run(s, 0);
+    fflush(stdout);
+    
+    if (profile != NULL) {
+        proff = open_for_writing(profile);
+        write_profile(proff, lines, s);
+        if (proff != stdout) fclose(proff);
+    }
+    
+    if (verbose) {
+        fprintf(stderr, "asm8085: ran %llu instructions, %llu T-states\n",
+            (unsigned long long) s->instructions, (unsigned long long) s->states);
+    }
+    
+    status = s->r[RA];
+    free_sim(s);
+    exit(status);
+}
+
+// Assemble as the command line says, and return the exit status
+int asm8085(int argc, char **argv) {
+    int c, object = FALSE, stream = FALSE, release = FALSE, deps_only = FALSE, deps_md = FALSE, deps_phony = FALSE, use_cache = FALSE, run = FALSE, optimize = FALSE;
+    int rst = FALSE;
+    char *inp=NULL, *outp=NULL, *list=NULL, *trace=NULL, *depf=NULL, *cachedir=NULL, *profile=NULL, *rstfile=NULL; 
+    char key[CACHE_KEY_SIZE], options[128];
     unsigned char *mem;
-    FILE *outf, *listf; 
+    struct asmstate *state = NULL;
+    struct line *lines = NULL;
+    struct varspace *counts = NULL;
+    FILE *outf = NULL, *listf; 
     size_t outsize;
+    static const struct option long_options[] = {
+        { "run", no_argument, NULL, 'R' },
+        { "profile", required_argument, NULL, 'P' },
+        { "rst", optional_argument, NULL, OPT_RST },
+        { NULL, 0, NULL, 0 }
+    };
     
     // Allocate 64K for binary output
     if ((mem = malloc(65536)) == NULL) {
@@ -54,10 +165,10 @@ int main(int argc, char **argv) {
     }
     
     // Handle arguments
-    while((c = getopt(argc, argv, "ho:l:")) != -1) {
+    while((c = getopt_long(argc, argv, "hvcSrROM::C:o:l:t:P:", long_options, NULL)) != -1) {
         switch(c) {
             case '?':
-                if (optopt == 'o' || optopt == 'l') {
+                if (optopt == 'o' || optopt == 'l' || optopt == 't' || optopt == 'C' || optopt == 'P') {
                     fprintf(stderr, "-%c requires an argument.\n", optopt);
                 } else {
                     fprintf(stderr, "Unknown option: -%c\n", optopt);
@@ -66,8 +177,33 @@ int main(int argc, char **argv) {
                 exit(1);
             
             case 'h': help(); break;
+            case 'c': object = TRUE; break;
+            case 'S': stream = TRUE; break;
+            case 'r': release = TRUE; break;
+            case 'R': run = TRUE; break;
+            case 'O': optimize = TRUE; break;
+            case 'P': run = TRUE; profile = optarg; break;
+            case 'v': verbose = TRUE; break;
             case 'o': outp = optarg; break;
             case 'l': list = optarg; break;
+            case 't': trace = optarg; break;
+            case 'C': cachedir = optarg; break;
+            case OPT_RST: rst = TRUE; rstfile = optarg; break;
+            case 'M':
+                // -M, -MD, -MP, -MF file (or -MFfile)
+                if (optarg == NULL) deps_only = TRUE;
+                else if (!strcmp(optarg, "D")) deps_md = TRUE;
+                else if (!strcmp(optarg, "P")) deps_phony = TRUE;
+                else if (optarg[0] == 'F' && optarg[1]) depf = optarg+1;
+                else if (optarg[0] == 'F' && optind < argc) depf = argv[optind++];
+                else if (optarg[0] == 'F') {
+                    fprintf(stderr, "-MF requires an argument.\n");
+                    exit(1);
+                } else {
+                    fprintf(stderr, "Unknown option: -M%s\n", optarg);
+                    exit(1);
+                }
+                break;
         }
     }
     
@@ -78,16 +214,109 @@ int main(int argc, char **argv) {
     
     inp = argv[optind];
     
-    // If no output file is given, change the input extension into '.bin'
-    if (outp == NULL) outp = make_bin_file(inp);
+    // Streaming and releasing do not keep the lines around, and objects, listings and profiles need them
+    if ((stream || release) && (object || list != NULL || profile != NULL)) {
+        fprintf(stderr, "asm8085: -%c cannot be combined with -c, -l or -P\n", stream ? 'S' : 'r');
+        exit(1);
+    }
     
-    // Try to assemble the file. 
-    struct asmstate *state = init_asmstate();
+    // The second streaming pass has to see the same code as the first, which -O would change
+    if (stream && optimize) {
+        fprintf(stderr, "asm8085: -S cannot be combined with -O\n");
+        exit(1);
+    }
+    
+    // Running needs the binary, and the lines to find out where it starts
+    if (run && (stream || object || deps_only)) {
+        fprintf(stderr, "asm8085: -R cannot be combined with -S, -c or -M\n");
+        exit(1);
+    }
+    
+    // The code is assembled whole, twice, to count the calls and then to use the vectors
+    if (rst && (stream || object || deps_only)) {
+        fprintf(stderr, "asm8085: --rst cannot be combined with -S, -c or -M\n");
+        exit(1);
+    }
+    
+    // The rule names the output as its target (and -MD names its file after it), so there
+    // has to be an output file
+    if (outp != NULL && !strcmp(outp, "-") && (deps_only || deps_md || depf != NULL)) {
+        fprintf(stderr, "asm8085: -M, -MD and -MF need an output file, not stdout\n");
+        exit(1);
+    }
+    
+    // Read the call counts before anything changes the working directory
+    if (rstfile != NULL) {
+        counts = alloc_varspace();
+        if (!read_call_counts(rstfile, counts)) exit(1);
+    }
     
-    struct line *lines = assemble(state, inp);
-    if (lines == NULL) exit(1);
+    atexit(report_memory);
     
-    if (!complete(state, lines)) exit(2);
+    // If no output file is given, change the input extension into '.bin' (or '.obj')
+    if (outp == NULL) outp = make_out_file(inp, object ? ".obj" : ".bin");
+    
+    // Start the trace if the user wanted one
+    if (trace != NULL && !trace_open(trace)) {
+        fprintf(stderr, "cannot open %s for writing: %s\n", trace, strerror(errno));
+        exit(1);
+    }
+    atexit(trace_close); // so that the trace is finished even if assembly fails
+    
+    // Work out the cache key, if there is a cache (the output must go to real files)
+    if (cachedir != NULL && !deps_only && !run && !rst && strcmp(outp, "-") && (list == NULL || strcmp(list, "-"))) {
+        snprintf(options, sizeof(options), "asm8085 " VERSION " (" BUILD ") object=%d stream=%d optimize=%d", object, stream, optimize);
+        use_cache = cache_key(inp, options, key);
+    }
+    
+    // Record the files that are read if the user wants dependencies (the cache needs them too)
+    if (use_cache || deps_only || deps_md || depf != NULL) deps_start();
+    
+    // If nothing has changed since the output was cached, just use that
+    if (use_cache && cache_fetch(cachedir, key, outp, list)) {
+        if (deps_md || depf != NULL) write_deps(depf, FALSE, outp, deps_phony);
+        return 0;
+    }
+    
+    // Try to assemble the file. 
+    if (stream && !deps_only) {
+        // When streaming, the binary is written as it is assembled
+        outf = open_for_writing(outp);
+        if (!assemble_stream(inp, outf, &outsize)) {
+            if (outf != stdout) {
+                fclose(outf);
+                remove(outp);
+            }
+            exit(2);
+        }
+    } else {
+        state = init_asmstate();
+        state->object = object;
+        state->release = release;
+        state->optimize = optimize;
+        
+        lines = rst ? assemble_rst(state, inp, counts) : assemble(state, inp);
+        if (lines == NULL) exit(1);
+        if (counts != NULL) free_varspace(counts);
+        
+        if (rst) {
+            if (state->rst_slots == 0) fprintf(stderr, "asm8085: warning: --rst: no vectors reserved with 'rstslots'\n");
+            else report_rst(stderr, state->rst, state->cpu);
+        }
+        
+        if (optimize) {
+            fprintf(stderr, "asm8085: -O saved %ld bytes and %ld T-states\n", state->saved_bytes, state->saved_states);
+        }
+        
+        if (verbose) {
+            report_sections(stderr, state->sections);
+            report_pool(stderr, state->pool);
+        }
+        
+        if (!complete(state, lines)) exit(2);
+        
+        if (verbose && !object) report_stack(stderr, lines);
+    }
     
     // Restore the old working directory
     if (chdir(startdir) == -1) {
@@ -95,35 +324,60 @@ int main(int argc, char **argv) {
         exit(1);
     }
     
-    // Write the binary file
-    if (!strcmp(outp, "-")) {
-        outf = stdout;  // allow output to STDOUT
-    } else if ((outf = fopen(outp, "w")) == NULL) {
-        fprintf(stderr, "cannot open %s for writing: %s\n", outp, strerror(errno));
-        exit(1);
+    // Write the dependencies if the user wanted them
+    if (deps_only || deps_md || depf != NULL) {
+        write_deps(depf, deps_only, outp, deps_phony);
+        
+        // With -M, nothing else is written
+        if (deps_only) return 0;
     }
     
-    outsize = make_binary(lines, mem);
-    if (fwrite(mem, 1, outsize, outf) != outsize) {
-        fprintf(stderr, "write error: %s\n", strerror(errno));
-        exit(1);
+    // Write the binary file (when streaming, this has already been done)
+    if (!stream) {
+        outf = open_for_writing(outp); // allow output to STDOUT
+        
+        if (object) {
+            // Write an object, leaving names from other modules to the linker
+            if (!write_object(outf, state, lines, inp)) exit(2);
+        } else {
+            outsize = make_binary(lines, mem);
+            if (fwrite(mem, 1, outsize, outf) != outsize) {
+                fprintf(stderr, "write error: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
     }
     
     if (outf != stdout) fclose(outf);
     
     // Write the listing if the user wanted one
     if (list != NULL) {
-        if (!strcmp(list, "-")) {
-            listf = stdout; // allow listing output to stdout
-        } else if ((listf = fopen(list, "w")) == NULL) {
-            fprintf(stderr, "cannot open %s for writing: %s\n", list, strerror(errno));
-            exit(1);
-        }
-        
+        listf = open_for_writing(list); // allow listing output to stdout
         write_listing(listf, state, lines);
         if (listf != stdout) fclose(listf);
     }
     
+    // Keep the output for next time
+    if (use_cache && !cache_store(cachedir, key, outp, list)) {
+        fprintf(stderr, "warning: could not store output in cache: %s\n", cachedir);
+    }
+    
+    if (run) run_binary(state, lines, profile);
+    
     return 0;
     
+}
+
+int main(int argc, char **argv) {
+    const char *server = getenv("ASM8085_SERVER");
+    int status;
+    
+    // asm8085 --server <socket>: stay up, and do the jobs sent to the socket
+    if (argc == 3 && !strcmp(argv[1], "--server")) return run_server(argv[2], asm8085) ? 0 : 1;
+    if (argc == 2 && !strncmp(argv[1], "--server=", 9)) return run_server(argv[1] + 9, asm8085) ? 0 : 1;
+    
+    // If a server is running, let it do the job; otherwise, do it here
+    if (server != NULL && *server && (status = run_client(server, argc, argv)) >= 0) return status;
+    
+    return asm8085(argc, argv);
 }
\ No newline at end of file
@@ -4,17 +4,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/resource.h>
 
 
 #include "util.h"
 #include "assembler.h"
 #include "bin_output.h"
 #include "listing.h"
+#include "object.h"
+#include "cache.h"
+#include "sim.h"
+#include "profile.h"
+#include "server.h"
 
 #define VERSION "0.1"
 #define BUILD __DATE__ " " __TIME__
 
+#define OPT_RST 256 // --rst has no short option
+
 #endif
\ No newline at end of file
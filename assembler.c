@@ -8,6 +8,7 @@ char sanity_checks(const struct line *line) {
     
     int macdepth = 0;
     int repdepth = 0;
+    int secdepth = 0;
     int i;
     char *l;
     const struct line *prevline;
@@ -46,6 +47,15 @@ char sanity_checks(const struct line *line) {
                 repdepth--;
                 if (repdepth < 0) { error_on_line(line, "endr without repeat"); error = TRUE; }
             }
+            // Sections do not nest
+            else if (i == DIR_section) {
+                if (secdepth > 0) { error_on_line(line, "section inside section"); error = TRUE; }
+                secdepth++;
+            }
+            else if (i == DIR_endsection) {
+                secdepth--;
+                if (secdepth < 0) { error_on_line(line, "endsection without section"); error = TRUE; secdepth = 0; }
+            }
         } else if (line->label != NULL) {
             // Label names OK?
             l = line->label;
@@ -73,6 +83,8 @@ char sanity_checks(const struct line *line) {
     if (macdepth > 0) { error_on_line(prevline, "missing endm"); error = TRUE; }
     // are there any unterminated repeats?
     if (repdepth > 0) { error_on_line(prevline, "missing endr"); error = TRUE; }
+    // are there any unterminated sections?
+    if (secdepth > 0) { error_on_line(prevline, "missing endsection"); error = TRUE; }
     
     return error;
 }
@@ -87,13 +99,35 @@ struct asmstate *init_asmstate() {
     state->macros = NULL;
     state->knowns = alloc_varspace();
     state->unknowns = alloc_varspace();
+    state->externs = alloc_varspace();
+    state->publics = alloc_varspace();
     state->prev_line = NULL;
     state->orgstack = NULL;
     
     state->n_includes = 0;
     state->n_macro_exp = 0;
     
+    state->optimize = FALSE;
+    state->saved_bytes = 0;
+    state->saved_states = 0;
+    
+    state->sections = init_sections();
+    
+    state->rst = NULL;
+    state->rst_slots = 0;
+    
+    state->pool = init_pool();
+    
     state->cpu = 8085; /* default processor is 8085 of course */
+    state->object = FALSE;
+    
+    state->release = FALSE;
+    state->streaming = FALSE;
+    state->finals = NULL;
+    state->stream_out = NULL;
+    state->stream_size = 0;
+    
+    state->failed_asserts = 0;
 
     return state;
 }
@@ -114,7 +148,13 @@ void free_asmstate(struct asmstate *state) {
         free_maclist(state->macros);
         free_varspace(state->knowns);
         free_varspace(state->unknowns);
+        free_varspace(state->externs);
+        free_varspace(state->publics);
+        if (state->finals) free_varspace(state->finals);
         free_orgstack(state->orgstack);
+        free_sections(state->sections);
+        free_rst_plan(state->rst);
+        free_pool(state->pool);
         free(state);
     }
 }
@@ -144,6 +184,7 @@ int pop_org(struct asmstate *state, struct line *end) {
     // Restore original position plus the size of the relocated lines
     int n_bytes = end->location - s->start->location;
     end->location = s->loc + n_bytes;
+    free(s);
     
     return TRUE;
 }
@@ -157,6 +198,7 @@ void resolve_all(struct asmstate *state) {
     struct parsed_expr *expr;
     intptr_t answer;
     
+    trace_begin("pass", "resolve_all", NULL, NULL, 0);
     do {
         resolved = FALSE;
         va = state->unknowns->variables;
@@ -191,15 +233,32 @@ void resolve_all(struct asmstate *state) {
             }
         }
     } while(resolved);
+    trace_end();
 }
 
 
 
+static int retire_line(struct asmstate *state, struct line *line);
+
+// Assembly has moved past a line
+static int line_done(struct asmstate *state, struct line *line) {
+    if (state->streaming) return retire_line(state, line);
+    
+    // Its text is not needed anymore if its bytes are final, unless it is an 'equ' 
+    // that may still have to be resolved
+    if (state->release && !line->needs_process
+    && !(line->instr.type == DIRECTIVE && line->instr.instr == DIR_equ)) {
+        free_line_text(line);
+    }
+    
+    return TRUE;
+}
+
 // Assemble lines
 struct line *asm_lines(struct asmstate *state, struct line *lines) {
     intptr_t foo;
     char bar;
-    struct line *macro, *macro_end;
+    struct line *macro, *macro_end, *exp_line;
     
     state->prev_line = parse_line_part(TRUE, "", NULL, "", &bar); // Dummy line with location set to 0
     state->cur_line = lines;
@@ -212,7 +271,35 @@ struct line *asm_lines(struct asmstate *state, struct line *lines) {
     }
     
     while (state->cur_line != NULL) {
+        trace_reached(state->cur_line);
+        
+        // When streaming, the next part of the file is read once assembly reaches it
+        if (state->cur_line->reader != NULL) {
+            if (!read_more(state->cur_line) || sanity_checks(state->cur_line->next_line)) {
+                error_in_file(state->cur_line, "assembly aborted.");
+                goto error;
+            }
+        }
+        
+        // Lines are only parsed fully once assembly reaches them
+        if (!finish_line(state->cur_line)) {
+            error_in_file(state->cur_line, "assembly aborted.");
+            goto error;
+        }
+        
         state->cur_line->cpu = state->cpu; /* set current cpu mode for this line */
+        
+        // With --rst, calls to the routines that were given a vector become an 'rst'
+        if (state->rst != NULL && !rst_call(state, state->cur_line)) {
+            error_in_file(state->cur_line, "assembly aborted.");
+            goto error;
+        }
+        
+        // With -O, slow code is rewritten before it is assembled
+        if (state->optimize && !peephole(state, state->cur_line)) {
+            error_in_file(state->cur_line, "assembly aborted.");
+            goto error;
+        }
         state->cur_line->location = state->prev_line->location + state->prev_line->n_bytes;
             
         if (state->cur_line->location > 0xFFFF) {
@@ -224,20 +311,23 @@ struct line *asm_lines(struct asmstate *state, struct line *lines) {
         set_base(state->knowns, state->cur_line->info.lastlabel);
         set_base(state->unknowns, state->cur_line->info.lastlabel);
         
-        // If the current line has a label and is not a macro or EQU definition, then it is
-        // defined as its current location. In any case, names may not conflict.
+        // If the current line has a label and is not a macro, EQU or pooldb definition, then
+        // it is defined as its current location. In any case, names may not conflict.
         if (state->cur_line->label != NULL) {
             // Do we already have this name? If so, this is an error.
             if (get_var(state->knowns, state->cur_line->label, &foo)
-            ||  get_var(state->unknowns, state->cur_line->label, &foo)) {
+            ||  get_var(state->unknowns, state->cur_line->label, &foo)
+            ||  get_var(state->externs, state->cur_line->label, &foo)) {
                 error_on_line(state->cur_line, "label is already defined elsewhere: %s", state->cur_line->label);
                 goto error;
             }
             
-            // If this line is not a macro or EQU definition, we now know its value.
+            // If this line is not a macro, EQU or pooldb definition, we now know its value.
+            // (A pooldb label points into the pool, so 'pool' defines it.)
             const struct line *l = state->cur_line; 
             if (l->instr.type != MACRO &&
-                !(l->instr.type == DIRECTIVE && l->instr.instr == DIR_equ)) {
+                !(l->instr.type == DIRECTIVE && l->instr.instr == DIR_equ) &&
+                !(l->instr.type == DIRECTIVE && l->instr.instr == DIR_pooldb)) {
                     set_var(state->knowns, l->label, l->location);
             }
         }
@@ -273,11 +363,22 @@ struct line *asm_lines(struct asmstate *state, struct line *lines) {
                     goto error;
                 }
                 
+                // The invocation is gone after this, so record what it uses now
+                section_line(state->sections, state->cur_line);
+                
                 macro = expand_macro(state->cur_line, state->macros, &macro_end);
                 if (macro == NULL) goto error;
                 
+                // Remember which expansion the lines came from (a nested one will renumber its own)
+                for (exp_line = macro; exp_line != NULL; exp_line = exp_line->next_line) {
+                    exp_line->expansion = state->n_macro_exp;
+                    if (exp_line == macro_end) break;
+                }
+                
                 macro_end->next_line = state->cur_line->next_line;
                 state->prev_line->next_line = macro;
+                // When streaming, nothing will look at the invocation again
+                if (state->streaming) free_line(state->cur_line, FALSE);
                 state->cur_line = state->prev_line;
                 break;
             
@@ -303,18 +404,49 @@ struct line *asm_lines(struct asmstate *state, struct line *lines) {
                     state->cur_line->raw_text);
         }
         
-        // Next line
+        // Keep track of which names each section uses
+        if (state->prev_line != state->cur_line) section_line(state->sections, state->cur_line);
+        
+        // Next line (the previous line is now done with)
+        if (state->prev_line != state->cur_line && !line_done(state, state->prev_line)) goto error;
         state->prev_line = state->cur_line;
         state->cur_line = state->prev_line->next_line;
         
     }    
     
+    if (!line_done(state, state->prev_line)) goto error;
+    
     return lines;
 error:
     return NULL;
     
 }
 
+// Forget everything that was assembled, but keep the options, the sections to leave out
+// and the rst vectors
+static void restart_asmstate(struct asmstate *state) {
+    struct asmstate *fresh = init_asmstate(), old = *state;
+    int n;
+    
+    fresh->object = state->object;
+    fresh->release = state->release;
+    fresh->streaming = state->streaming;
+    fresh->optimize = state->optimize;
+    
+    free_sections(fresh->sections);
+    fresh->sections = state->sections;
+    reset_sections(fresh->sections);
+    
+    fresh->rst = state->rst;
+    for (n = 0; fresh->rst != NULL && n < 8; n++) fresh->rst->sites[n] = 0;
+    
+    *state = *fresh;
+    *fresh = old;
+    fresh->sections = NULL;
+    fresh->rst = NULL;
+    free_asmstate(fresh);
+}
+
 // Assemble a file
 struct line *assemble(struct asmstate *state, const char *filename) {
     
@@ -330,16 +462,35 @@ struct line *assemble(struct asmstate *state, const char *filename) {
     
     /* Read and parse the file */
     fcopy = copy_string(filename);
-    struct line *lines = read_file(basename(fcopy));
+    struct line *lines = state->streaming ? read_file_part(basename(fcopy), STREAM_PART_SIZE) 
+                                          : read_file(basename(fcopy));
     if (lines == NULL) fprintf(stderr, "%s: failed to read file\n", filename);
     
     free(fcopy);
     
     lines = asm_lines(state, lines); 
+    trace_reached(NULL);
     if (lines == NULL) goto error; 
     
+    // Strings cannot be left in a pool that is never stored
+    if (state->pool->n > 0) {
+        fprintf(stderr, "%s: line %d: pooldb without a pool after it\n", state->pool->filename, state->pool->lineno);
+        if (!state->streaming) free_line(lines, TRUE);
+        goto error;
+    }
+    
     popd();
     resolve_all(state);
+    
+    // If some sections are not used, assemble the file again without them. (Not in the 
+    // second streaming pass, which has already written its output; it leaves out the same 
+    // sections as the first.)
+    if (state->finals == NULL && drop_unused_sections(state->sections, state->publics)) {
+        if (!state->streaming) free_line(lines, TRUE);
+        restart_asmstate(state);
+        return assemble(state, filename);
+    }
+    
     return lines;
     
 error:
@@ -347,10 +498,40 @@ error:
     return NULL;
 }
 
+// See if all the undefined names in an expression are imported from other modules,
+// either directly or through 'equ's that depend on them.
+static int only_externs(struct asmstate *state, const struct parsed_expr *expr, int depth) {
+    intptr_t temp = 0;
+    struct varspace vs = temp_rename(state->knowns, expr->basename);
+    struct varspace uvs = temp_rename(state->unknowns, expr->basename);
+    const struct token_stack_node *ts;
+    
+    if (depth > RES_STACK_SIZE) return FALSE; // circular definition
+    
+    for (ts = expr->start; ts != NULL; ts = ts->next) {
+        if (ts->token->type != NAME || !strcmp(ts->token->text, "$")) continue;
+        if (get_var(&vs, ts->token->text, &temp)) continue;
+        if (get_var(state->externs, ts->token->text, &temp)) continue;
+        if (get_var(&uvs, ts->token->text, &temp)
+        &&  only_externs(state, ((struct line *) temp)->argmts->data.expr, depth+1)) continue;
+        return FALSE;
+    }
+    
+    return TRUE;
+}
+
 // Evaluate an expression given a state. Return the result, or give errors.
 int eval_state(struct argmt *argmt, struct asmstate *state, const struct line *line, intptr_t *result) {
     intptr_t temp = 0;
-    struct varspace vs = temp_rename(state->knowns, argmt->data.expr->basename);
+    // In the second streaming pass, all the names are already known from the first
+    struct varspace vs = temp_rename(state->finals ? state->finals : state->knowns, argmt->data.expr->basename);
+    
+    // In an object, names imported from other modules are filled in by the linker
+    if (state->object && contains_undefined_names(argmt->data.expr, &vs) 
+    &&  only_externs(state, argmt->data.expr, 0)) {
+        *result = 0;
+        return TRUE;
+    }
     
     *result = eval_expr(argmt->data.expr, &vs, &line->info, line->location);
     if (!contains_undefined_names(argmt->data.expr, &vs)) {
@@ -384,152 +565,365 @@ int eval_state(struct argmt *argmt, struct asmstate *state, const struct line *l
     return FALSE;
 }
 
-// Evaluate all remaining expressions, and fill in the results
-int complete(struct asmstate *state, struct line *lines) {
-    struct line *line;
+// If an argument is a constant that fits in 'width' bytes, store it right away.
+int store_constant(const struct argmt *argmt, unsigned char *pos, int width) {
+    int value;
+    if (argmt->type != EXPRESSION || !expr_constant(argmt->data.expr, &value)) return FALSE;
+    
+    if (width == 1) {
+        if (value < -128 || value > 255) return FALSE;
+        *pos = (unsigned char) value;
+    } else {
+        if (value < -32768 || value > 65535) return FALSE;
+        *pos++ = (unsigned char) (value & 0xFF);
+        *pos = (unsigned char) (value >> 8);
+    }
+    return TRUE;
+}
+
+// The assembly being completed, and its lines (if they are all still there), so cycles()
+// and stackdepth() can look at the code
+static struct asmstate *completing = NULL;
+static const struct line *completing_lines = NULL;
+static struct stack_graph *completing_stack = NULL; // made once stackdepth() is used
+
+// An error in cycles() or stackdepth() fails the assembly, like a failed assertion does
+static int code_error(const struct lineinfo *info, const char *fn, const char *msg, ...) {
+    va_list args;
+    fprintf(stderr, "%s: line %d: %s(): ", info->filename, info->lineno, fn);
+    va_start(args, msg);
+    vfprintf(stderr, msg, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    if (completing != NULL) completing->failed_asserts++;
+    return FALSE;
+}
+
+// Can cycles() be used?
+int cycles_available() {
+    return completing_lines != NULL;
+}
+
+// Count the T-states of the code between two addresses
+int region_cycles(int from, int to, char worst, const struct lineinfo *info, intptr_t *result) {
+    const struct line *line;
+    const struct cycles *c;
+    
+    if (completing_lines == NULL) {
+        return code_error(info, "cycles", "can only be used once all code is assembled (e.g. in 'assert'), "
+                                  "and not when streaming", from, to);
+    }
+    
+    // Find where the code starts
+    for (line = completing_lines; line != NULL; line = line->next_line) {
+        if (line->n_bytes > 0 && line->location == from) break;
+    }
+    if (line == NULL) return code_error(info, "cycles", "there is no code at %04X", from);
+    
+    // Add up the instructions until the end is reached
+    *result = 0;
+    if (from == to) return TRUE;
+    for (; line != NULL; line = line->next_line) {
+        if (line->location == to && line->n_bytes > 0) return TRUE;
+        if (line->instr.type != OPCODE || line->n_bytes == 0) continue;
+        
+        c = get_cycles(line->bytes[0], line->cpu);
+        if (worst) *result += c->taken > c->states ? c->taken : c->states;
+        else *result += c->taken < c->states ? c->taken : c->states;
+    }
+    
+    return code_error(info, "cycles", "the code at %04X is not followed by code at %04X", from, to);
+}
+
+// Work out the stack depth of a routine
+int routine_stack_depth(int addr, const struct lineinfo *info, intptr_t *result) {
+    char msg[STACK_MSG_SIZE];
+    int depth;
+    
+    if (completing_lines == NULL) {
+        return code_error(info, "stackdepth", "can only be used once all code is assembled (e.g. in 'assert'), "
+                                              "and not when streaming");
+    }
+    
+    if (completing_stack == NULL) completing_stack = init_stack_graph(completing_lines);
+    if (!stack_depth(completing_stack, addr, &depth, msg)) {
+        return code_error(info, "stackdepth", "routine at %04Xh: %s", addr, msg);
+    }
+    
+    *result = depth;
+    return TRUE;
+}
+
+// Evaluate the expressions on one line, and fill in the results.
+// A failed assertion is counted, but does not stop assembly, this way all assertions are tried.
+static int complete_line(struct asmstate *state, struct line *line) {
     struct argmt *argmt;
     unsigned char *pos;
-    int assertok = TRUE; // set to FALSE if assertion fails, this way all assertions are tried
     intptr_t result = 0;
     size_t size;
 
-    resolve_all(state);
-
-    // process each line in turn 
-    for (line = lines; line != NULL; line=line->next_line) {
-        // Skip lines that don't need processing
-        if (! line->needs_process) continue;
-        line->needs_process = FALSE;
+    line->needs_process = FALSE;
+    
+    switch(line->instr.type) {
+        case NONE:
+        case MACRO:
+            FATAL_ERROR("needs_process is set on empty or macro line");
+            break;
         
-        switch(line->instr.type) {
-            case NONE:
-            case MACRO:
-                FATAL_ERROR("needs_process is set on empty or macro line");
-                break;
-            
-            case DIRECTIVE:
-                argmt = line->argmts;
-                pos = line->bytes;
-                switch(line->instr.instr) {
-                    case DIR_db:
-                        // Define bytes
-                        for (; argmt != NULL; argmt = argmt->next_argmt) {
-                            switch(argmt->type) {
-                                case EXPRESSION:
-                                    // Evaluate the expressoin
-                                    if (!eval_state(argmt, state, line, &result)) {
-                                        //fprintf(stderr, "(e)cannot eval: %s\n", argmt->raw_text);
-                                        return FALSE; // could not evaluate
-                                    }
-                                    // Give a warning (but don't fail) if the argument doesn't fit
-                                    if (result < -128 || result > 255) {
-                                        error_on_line(line, "warning: result does not fit in byte, will be truncated");
-                                        error_on_line(line, "  %s == %02x", argmt->raw_text, result & 255);
-                                    }
-                                    // Truncate to byte and store
-                                    *pos++ = (unsigned char) result;
-                                    break;
-                                    
-                                case STRING:
-                                    // A string is just copied.
-                                    size = strlen(argmt->data.string);
-                                    memcpy(pos, argmt->data.string, size);
-                                    pos += size;
-                                    break;
-                                    
-                                default:
-                                    FATAL_ERROR("db: wrong argument type %d (%s)",argmt->type,argmt->raw_text);
-                            }
+        case DIRECTIVE:
+            argmt = line->argmts;
+            pos = line->bytes;
+            switch(line->instr.instr) {
+                case DIR_db:
+                    // Define bytes
+                    for (; argmt != NULL; argmt = argmt->next_argmt) {
+                        switch(argmt->type) {
+                            case EXPRESSION:
+                                // Evaluate the expressoin
+                                if (!eval_state(argmt, state, line, &result)) {
+                                    //fprintf(stderr, "(e)cannot eval: %s\n", argmt->raw_text);
+                                    return FALSE; // could not evaluate
+                                }
+                                // Give a warning (but don't fail) if the argument doesn't fit
+                                if (result < -128 || result > 255) {
+                                    error_on_line(line, "warning: result does not fit in byte, will be truncated");
+                                    error_on_line(line, "  %s == %02x", argmt->raw_text, result & 255);
+                                }
+                                // Truncate to byte and store
+                                *pos++ = (unsigned char) result;
+                                break;
+                                
+                            case STRING:
+                                // A string is just copied.
+                                size = strlen(argmt->data.string);
+                                memcpy(pos, argmt->data.string, size);
+                                pos += size;
+                                break;
+                                
+                            default:
+                                FATAL_ERROR("db: wrong argument type %d (%s)",argmt->type,argmt->raw_text);
                         }
-                        break;
-                   case DIR_dw:
-                        // Define words
-                        for (; argmt != NULL; argmt = argmt->next_argmt) {
-                            if (argmt->type != EXPRESSION) {
-                                FATAL_ERROR("dw: wrong argument type %d",argmt->type);
-                            }
-                            
-                            // Evaluate the argument
-                            if (!eval_state(argmt, state, line, &result)) {
-                                //fprintf(stderr, "(d)cannot eval: %s\n", argmt->raw_text);
-                                return FALSE;
-                            }
-                            
-                            // Warn if value doesn't fit in 2 bytes
-                            if (result < -32768 || result > 65535) {
-                                error_on_line(line, "warning: result does not fit in word, will be truncated");
-                                error_on_line(line, "  %s == %04x", argmt->raw_text, result & 65535);
-                            }
-                            
-                            *pos++ = (unsigned char) (result & 0xFF); // Low byte first
-                            *pos++ = (unsigned char) (result >> 8); // High byte second 
+                    }
+                    break;
+               case DIR_dw:
+                    // Define words
+                    for (; argmt != NULL; argmt = argmt->next_argmt) {
+                        if (argmt->type != EXPRESSION) {
+                            FATAL_ERROR("dw: wrong argument type %d",argmt->type);
                         }
-                        break;
-                    
-                    case DIR_assert:
-                        // Assertion
-                        if (!eval_state(argmt, state, line, &result)) return FALSE;
                         
-                        if (!result) {
-                            // Assertion failed
-                            char *msg;
-                            // Is there a message?
-                            if (argmt->next_argmt) msg = argmt->next_argmt->data.string; // yes
-                            else msg = argmt->raw_text; // no, use the expression
-                            error_on_line(line, "assertion failed: %s", msg);
-                            assertok = FALSE;
+                        // Evaluate the argument
+                        if (!eval_state(argmt, state, line, &result)) {
+                            //fprintf(stderr, "(d)cannot eval: %s\n", argmt->raw_text);
+                            return FALSE;
                         }
-                        break;
-                    
-                    default:
-                        FATAL_ERROR("invalid directive %d", line->instr.instr);
-                }
-                break;
-            
-            case OPCODE:
-                // Make sure this opcode actually does take an operand
-                if (line->n_bytes != 2 && line->n_bytes != 3) {
-                    FATAL_ERROR("n_bytes == %d", line->n_bytes);
-                }
-                
-                // An immediate value is always the last argument
-                argmt = line->argmts;
-                while (argmt->next_argmt != NULL) argmt=argmt->next_argmt;
+                        
+                        // Warn if value doesn't fit in 2 bytes
+                        if (result < -32768 || result > 65535) {
+                            error_on_line(line, "warning: result does not fit in word, will be truncated");
+                            error_on_line(line, "  %s == %04x", argmt->raw_text, result & 65535);
+                        }
+                        
+                        *pos++ = (unsigned char) (result & 0xFF); // Low byte first
+                        *pos++ = (unsigned char) (result >> 8); // High byte second 
+                    }
+                    break;
                 
-                // The argument must be an expression
-                if (argmt->type != EXPRESSION) FATAL_ERROR("invalid argument type");
+                case DIR_assert:
+                    // Assertion (in an object, this is left to the linker, unless it needs the code)
+                    if (state->object && !contains_functions(argmt->data.expr)) break;
+                    if (!eval_state(argmt, state, line, &result)) return FALSE;
+                    
+                    if (!result) {
+                        // Assertion failed
+                        char *msg;
+                        // Is there a message?
+                        if (argmt->next_argmt) msg = argmt->next_argmt->data.string; // yes
+                        else msg = argmt->raw_text; // no, use the expression
+                        error_on_line(line, "assertion failed: %s", msg);
+                        state->failed_asserts++;
+                    }
+                    break;
                 
-                // Evaluate the expression 
-                if (!eval_state(argmt, state, line, &result)) {
-                    //fprintf(stderr, "(o)cannot eval: %s\n", argmt->raw_text);
-                    return FALSE;
+                default:
+                    FATAL_ERROR("invalid directive %d", line->instr.instr);
+            }
+            break;
+        
+        case OPCODE:
+            // Make sure this opcode actually does take an operand
+            if (line->n_bytes != 2 && line->n_bytes != 3) {
+                FATAL_ERROR("n_bytes == %d", line->n_bytes);
+            }
+            
+            // An immediate value is always the last argument
+            argmt = line->argmts;
+            while (argmt->next_argmt != NULL) argmt=argmt->next_argmt;
+            
+            // The argument must be an expression
+            if (argmt->type != EXPRESSION) FATAL_ERROR("invalid argument type");
+            
+            // Evaluate the expression 
+            if (!eval_state(argmt, state, line, &result)) {
+                //fprintf(stderr, "(o)cannot eval: %s\n", argmt->raw_text);
+                return FALSE;
+            }
+            
+            pos = line->bytes + 1; // First byte is opcode
+            if (line->n_bytes == 2) {
+                // Immediate value is one byte long
+                if (result < -128 || result > 255) {
+                    error_on_line(line, "warning: result does not fit in byte, will be truncated");
+                    error_on_line(line, "  %s == %02x", argmt->raw_text, result & 255);
                 }
-                
-                pos = line->bytes + 1; // First byte is opcode
-                if (line->n_bytes == 2) {
-                    // Immediate value is one byte long
-                    if (result < -128 || result > 255) {
-                        error_on_line(line, "warning: result does not fit in byte, will be truncated");
-                        error_on_line(line, "  %s == %02x", argmt->raw_text, result & 255);
-                    }
-                    *pos = (unsigned char) result;
-                } else {
-                    // Immediate value is two bytes long
-                    if (result < -32768 || result > 65535) {
-                        error_on_line(line, "warning: result does not fit in byte, will be truncated");
-                        error_on_line(line, "  %s == %04x", argmt->raw_text, result & 65535);
-                    }
-                    *pos++ = (unsigned char) (result & 0xFF);
-                    *pos = (unsigned char) (result >> 8);
+                *pos = (unsigned char) result;
+            } else {
+                // Immediate value is two bytes long
+                if (result < -32768 || result > 65535) {
+                    error_on_line(line, "warning: result does not fit in byte, will be truncated");
+                    error_on_line(line, "  %s == %04x", argmt->raw_text, result & 65535);
                 }
-                
+                *pos++ = (unsigned char) (result & 0xFF);
+                *pos = (unsigned char) (result >> 8);
+            }
+            
+            break;
+            
+        default:
+            FATAL_ERROR("invalid instruction type %d", line->instr.type);
+    }
+    
+    return TRUE;
+}
+
+// Does a line have to wait until the code has been filled in? It does if it uses cycles()
+// or stackdepth(), or a name that is not known yet (such as an 'equ' that uses them).
+static int waits_for_code(struct asmstate *state, const struct line *line) {
+    const struct argmt *argmt;
+    struct varspace vs;
+    
+    for (argmt = line->argmts; argmt != NULL; argmt = argmt->next_argmt) {
+        if (!argmt->parsed || argmt->type != EXPRESSION) continue;
+        vs = temp_rename(state->knowns, argmt->data.expr->basename);
+        if (contains_undefined_names(argmt->data.expr, &vs)) return TRUE;
+    }
+    return FALSE;
+}
+
+// Evaluate all remaining expressions, and fill in the results
+static int complete_lines(struct asmstate *state, struct line *lines) {
+    struct line *line;
+    int ok = TRUE, pass;
+
+    completing = state;
+    resolve_all(state);
+
+    // process each line in turn, leaving the lines that look at the code until all of
+    // it has been filled in. Only then can cycles() and stackdepth() be used, and the
+    // 'equ's that use them be resolved.
+    for (pass = 0; ok && pass < 2; pass++) {
+        if (pass == 1) {
+            completing_lines = lines;
+            resolve_all(state);
+        }
+        
+        for (line = lines; line != NULL; line=line->next_line) {
+            // Skip lines that don't need processing
+            if (! line->needs_process) continue;
+            if (pass == 0 && waits_for_code(state, line)) continue;
+            if (! complete_line(state, line)) {
+                ok = FALSE;
                 break;
-                
-            default:
-                FATAL_ERROR("invalid instruction type %d", line->instr.type);
+            }
+            
+            // Now this line's bytes are final too
+            if (state->release) free_line_text(line);
         }
     }
     
-    if(!assertok) fprintf(stderr, "complete() returning false\n");
-    return assertok;
+    if (completing_stack != NULL) free_stack_graph(completing_stack);
+    completing = NULL;
+    completing_lines = NULL;
+    completing_stack = NULL;
+    if (!ok) return FALSE;
+    
+    if (state->failed_asserts) fprintf(stderr, "complete() returning false\n");
+    return !state->failed_asserts;
+}
+
+// Evaluate all remaining expressions, and fill in the results
+int complete(struct asmstate *state, struct line *lines) {
+    trace_begin("pass", "complete", NULL, NULL, 0);
+    int ok = complete_lines(state, lines);
+    trace_end();
+    return ok;
+}
+
+
+// Streaming: a line has been assembled, and assembly will not come back to it.
+// In the second pass, fill it in and write it out. Then it can be freed.
+static int retire_line(struct asmstate *state, struct line *line) {
+    if (state->finals != NULL) {
+        completing = state;
+        int ok = !line->needs_process || complete_line(state, line);
+        completing = NULL;
+        if (!ok) return FALSE;
+        
+        if (line->n_bytes > 0) {
+            if (state->stream_size + line->n_bytes > (1<<16)) {
+                error_on_line(line, "output would be larger than 64K");
+                return FALSE;
+            }
+            if (fwrite(line->bytes, 1, line->n_bytes, state->stream_out) != (size_t) line->n_bytes) {
+                error_on_line(line, "write error: %s", strerror(errno));
+                return FALSE;
+            }
+            state->stream_size += line->n_bytes;
+        }
+    }
+    
+    // 'equ' lines may still be waiting to be resolved, and 'pushorg' lines are on the org stack
+    if (line->instr.type == DIRECTIVE 
+    && (line->instr.instr == DIR_equ || line->instr.instr == DIR_pushorg)) return TRUE;
+    
+    free_line(line, FALSE);
+    return TRUE;
+}
+
+// Assemble a file in two passes, without keeping all the lines in memory
+int assemble_stream(const char *filename, FILE *outf, size_t *size) {
+    struct asmstate *first, *second;
+    int ok = FALSE;
+    
+    // The first pass works out all the names
+    first = init_asmstate();
+    first->streaming = TRUE;
+    trace_begin("pass", "stream: names", NULL, NULL, 0);
+    ok = assemble(first, filename) != NULL;
+    trace_end();
+    
+    if (!ok) {
+        free_asmstate(first);
+        return FALSE;
+    }
+    
+    // The second pass assembles the same lines again, and writes them out using those names
+    second = init_asmstate();
+    second->streaming = TRUE;
+    second->finals = first->knowns;
+    second->stream_out = outf;
+    first->knowns = alloc_varspace();
+    free_sections(second->sections);
+    second->sections = first->sections;
+    reset_sections(second->sections);
+    first->sections = init_sections();
+    free_asmstate(first);
+    
+    trace_begin("pass", "stream: output", NULL, NULL, 0);
+    ok = assemble(second, filename) != NULL && !second->failed_asserts;
+    trace_end();
+    
+    *size = second->stream_size;
+    free_asmstate(second);
+    return ok;
 }
@@ -12,11 +12,17 @@
 #include "expression.h"
 #include "parser.h"
 #include "macro.h"
+#include "trace.h"
+#include "deps.h"
+#include "sections.h"
+#include "stackdepth.h"
+#include "pool.h"
 
 #define MAX_INCLUDES 1024
 #define MAX_MACRO_EXP 65536
 #define RES_STACK_SIZE 8192
 #define MAX_PATHLINE_SIZE (PATH_MAX + 128) 
+#define STREAM_PART_SIZE 1024 // when streaming, read files this many lines at a time
 
 #define INCLUDE_PRE "\tpushd\t\"%s\"\t; --- Including: %s"
 #define INCLUDE_POST "\tpopd\t\t; --- End of include: %s"
@@ -28,6 +34,8 @@ struct asmstate {
     struct maclist *macros;  // Holds the macros
     struct varspace *knowns; // Holds the known values, as values
     struct varspace *unknowns; // Holds the unknown values, pointers to lines where they are defined
+    struct varspace *externs; // Holds the names imported from other modules
+    struct varspace *publics; // Holds the names exported to other modules, pointers to lines declaring them
     
     struct line *prev_line; // Holds a pointer to the previous line seen
     struct line *cur_line; // Holds a pointer to the current line 
@@ -38,6 +46,26 @@ struct asmstate {
     int n_includes; // count how many includes we've had
     
     int cpu; // 8080 or 8085, this selects loads.
+    
+    char object; // set if assembling a relocatable object instead of a binary
+    
+    char release; // set if the text and arguments of lines are freed once their bytes are final
+    char streaming; // set if lines are freed as soon as they have been assembled
+    struct varspace *finals; // second streaming pass: all names, as known after the first
+    FILE *stream_out; // second streaming pass: where the bytes are written
+    size_t stream_size; // second streaming pass: how many bytes have been written
+    
+    int failed_asserts; // count how many assertions have failed
+    
+    char optimize; // set if the peephole rules are applied to the code (-O)
+    long saved_bytes, saved_states; // what they have saved
+    
+    struct sections *sections; // 'section' blocks, and the names that keep them in the program
+    
+    struct rst_plan *rst; // --rst: the routines given an rst vector, or NULL
+    int rst_slots; // the rst vectors reserved by 'rstslots' (a bit for each)
+    
+    struct pool *pool; // the 'pooldb' strings waiting for a 'pool', and what pools have saved
 };
 
 // org stack item
@@ -57,15 +85,40 @@ void free_asmstate(struct asmstate *state);
 // Do some sanity checks 
 char sanity_checks(const struct line *line);
 
+// Resolve all resolvable variables
+void resolve_all(struct asmstate *state);
+
 // Assemble lines
 struct line *asm_lines(struct asmstate *state, struct line *lines);
 
 // Assemble a file
 struct line *assemble(struct asmstate *state, const char *filename);
 
+// If an argument is a constant that fits in 'width' bytes, store it at pos (low byte first)
+// and return TRUE. Otherwise it is left for complete(), which also gives any warnings.
+int store_constant(const struct argmt *argmt, unsigned char *pos, int width);
+
+// Has all the code been filled in, so that cycles() and stackdepth() can be evaluated?
+int cycles_available();
+
+// Count the T-states of the code from address 'from' up to address 'to', taking the slowest
+// (if worst is set) or the fastest time of each instruction. This only works in complete(),
+// once all the code is there; otherwise, or if there is no such code, an error is given and
+// FALSE is returned. In complete(), this also fails the assembly.
+int region_cycles(int from, int to, char worst, const struct lineinfo *info, intptr_t *result);
+
+// Work out how many bytes the routine at 'addr' pushes on the stack at most (see stack_depth()).
+// Like region_cycles(), this only works in complete(), and fails the assembly otherwise.
+int routine_stack_depth(int addr, const struct lineinfo *info, intptr_t *result);
+
 // Evaluate all remaining expressions, and fill in the results
 int complete(struct asmstate *state, struct line *lines);
 
+// Assemble a file in two passes, without keeping all the lines in memory. The first pass
+// only works out the names; the second writes each line to outf as soon as it is done.
+// Returns FALSE on error.
+int assemble_stream(const char *filename, FILE *outf, size_t *size);
+
 // Pop from the org stack.
 int pop_org(struct asmstate *state, struct line *end);
 
@@ -74,6 +127,8 @@ void push_org(struct asmstate *state, struct line *start, int newloc);
 
 #include "directives.h"
 #include "opcodes.h"
+#include "peephole.h"
+#include "rst.h"
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,398 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+// Benchmark harness: generates synthetic sources, times each assembly phase,
+// and compares the times against a stored baseline. The times are scaled by how
+// fast a fixed calibration loop runs, compared to when the baseline was made.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+
+#include "../assembler.h"
+#include "../bin_output.h"
+#include "../dirstack.h"
+#include "../parser.h"
+#include "../util.h"
+
+#define MEMSZ 0x10000
+#define MAX_WORKLOADS 16
+#define MAX_BASELINE 256
+#define NOISE_MS 5.0 // differences below this are never reported as regressions
+#define MAX_LINE 512
+#define CALIBRATION_LOOPS 1000000
+
+// Phases that are timed. 'full_parse' is not part of assembly: it parses every line of the
+// main file completely (as finish_line() would), from memory, to give the parser's throughput.
+enum phase { PH_PARSE, PH_ASM, PH_RESOLVE, PH_COMPLETE, PH_BINARY, PH_FULL_PARSE, N_PHASES };
+static const char *phase_names[N_PHASES] = { "parse", "asm_lines", "resolve", "complete", "binary", "full_parse" };
+
+// A workload generates a source file (and possibly include files) in the work directory,
+// given a scale factor, and returns the amount of source lines it wrote.
+struct workload {
+    const char *name;
+    int (*generate)(FILE *f, const char *dir, int scale);
+};
+
+// Baseline entry
+struct baseline_entry {
+    char workload[64];
+    char phase[64];
+    double ms;
+};
+
+/* Workload generators */
+
+// N lines of straight-line code, with a label every 16 lines
+int gen_straight(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    static const char *code[] = {
+        "\tmov\ta,b", "\tmvi\tc,12h", "\tlxi\th,1234h", "\tinx\th", "\tadd\tm",
+        "\tana\ta", "\tcpi\t'A'", "\tjnz\tl%d", "\tpush\tpsw", "\tpop\tpsw",
+        "\tdad\td", "\txchg", "\tsta\t8000h", "\tcall\tl%d", "\tora\te", "\tdcr\tb"
+    };
+    int i, n = 1000 * scale;
+    for (i = 0; i < n; i++) {
+        if (i % 16 == 0) fprintf(f, "l%d:\n", i / 16);
+        fprintf(f, code[i % 16], i / 16);
+        fputc('\n', f);
+    }
+    return n + n / 16;
+}
+
+// Deep chain of EQUs, most of them defined in order, some defined in reverse
+int gen_equ_chain(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    int i, n = 200 * scale, r = 20 * scale;
+    fprintf(f, "e0\tequ\t1\n");
+    for (i = 1; i < n; i++) fprintf(f, "e%d\tequ\te%d + 1\n", i, i - 1);
+    for (i = 0; i < r; i++) fprintf(f, "r%d\tequ\tr%d + 1\n", i, i + 1);
+    fprintf(f, "r%d\tequ\te%d\n", r, n - 1);
+    fprintf(f, "\tdw\te%d, r0\n", n - 1);
+    return n + r + 2;
+}
+
+// Thousands of local labels under a few global labels
+int gen_local_labels(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    int i, n = 500 * scale, lines = 0;
+    for (i = 0; i < n; i++) {
+        if (i % 100 == 0) { fprintf(f, "glob%d:\n", i / 100); lines++; }
+        fprintf(f, ".l%d:\tdcr\tc\n\tjnz\t.l%d\n", i, i);
+        lines += 2;
+    }
+    return lines;
+}
+
+// Macro definitions with several arguments, expanded many times
+int gen_macros(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    int i, n = 100 * scale;
+    fprintf(f, "ldadd\tmacro\tdst, src, val\n");
+    fprintf(f, "\tmov\ta,#src\n\tadi\t#val\n\tmov\t#dst,a\n\tjnc\t@skip\n\tinr\t#dst\n@skip:\n");
+    fprintf(f, "\tendm\n");
+    fprintf(f, "copy16\tmacro\tfrom, to\n");
+    fprintf(f, "\tlhld\t#from\n\tshld\t#to\n\tendm\n");
+    for (i = 0; i < n; i++) {
+        fprintf(f, "\tldadd\tb, c, %d\n", i & 0xFF);
+        fprintf(f, "\tcopy16\t%d, %d\n", 0x8000 + 2 * i, 0x9000 + 2 * i);
+    }
+    return 9 + 2 * n;
+}
+
+// Big repeat tables
+int gen_repeat(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    fprintf(f, "\trepeat\t%d\n\tdb\tlow $, high $\n\tendr\n", 500 * scale);
+    fprintf(f, "\trepeat\t%d\n\trepeat\t4\n\tnop\n\tendr\n\tendr\n", 100 * scale);
+    return 8;
+}
+
+// Wide db lists
+int gen_wide_db(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    int i, j, n = 20 * scale;
+    for (i = 0; i < n; i++) {
+        fprintf(f, "\tdb\t");
+        for (j = 0; j < 64; j++) fprintf(f, "%s%d", j ? "," : "", (i + j) & 0xFF);
+        fprintf(f, "\n");
+    }
+    return n;
+}
+
+// One file including many others
+int gen_includes(FILE *f, const char *dir, int scale) {
+    char fname[PATH_MAX];
+    int i, j, n = 10 * scale, lines = 0;
+    for (i = 0; i < n; i++) {
+        snprintf(fname, PATH_MAX, "%s/inc%d.asm", dir, i);
+        FILE *inc = fopen(fname, "w");
+        if (inc == NULL) FATAL_ERROR("cannot write %s: %s", fname, strerror(errno));
+        fprintf(inc, "inc%d:\n", i);
+        for (j = 0; j < 50; j++) fprintf(inc, "\tmvi\ta,%d\n\tcall\tinc%d\n", j, i);
+        fprintf(inc, "\tret\n");
+        fclose(inc);
+        fprintf(f, "\tinclude\t\"inc%d.asm\"\n", i);
+        lines += 103;
+    }
+    return lines;
+}
+
+// Commented lines with strings, brackets and '!'-separated instructions
+int gen_comments(FILE *f, __attribute__((unused)) const char *dir, int scale) {
+    int i, n = 500 * scale;
+    fprintf(f, "msg:\tdb\t\"Hello, world! (a string with a comma, and a ; in it)\", 13, 10, 0\n");
+    for (i = 0; i < n; i++) {
+        fprintf(f, "t%d:\tlxi\th,(msg+%d)*2\t; point HL at entry %d of the table (twice the offset)\n", i, i % 64, i);
+        fprintf(f, "\tmvi\ta,'!' ! mov b,a ! call t%d\t; load '!', copy it to B, and call back\n", i);
+    }
+    return 1 + 2 * n;
+}
+
+static const struct workload workloads[] = {
+    { "straight",     gen_straight },
+    { "equ_chain",    gen_equ_chain },
+    { "local_labels", gen_local_labels },
+    { "macros",       gen_macros },
+    { "repeat",       gen_repeat },
+    { "wide_db",      gen_wide_db },
+    { "includes",     gen_includes },
+    { "comments",     gen_comments },
+    { NULL, NULL }
+};
+
+/* Timing */
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Assemble a file once, storing the time taken by each phase. Returns FALSE on failure.
+int time_assembly(const char *fname, double *times) {
+    unsigned char *mem = malloc(MEMSZ);
+    char *fcopy = copy_string(fname);
+    struct asmstate *state = init_asmstate();
+    struct line *lines;
+    double t;
+    int ok = FALSE;
+
+    if (mem == NULL) FATAL_ERROR("memory allocation failure");
+
+    if (pushd(dirname(fcopy)) == -1) goto done;
+    free(fcopy);
+    fcopy = copy_string(fname);
+
+    t = now_ms();
+    lines = read_file(basename(fcopy));
+    times[PH_PARSE] = now_ms() - t;
+    if (lines == NULL) { popd(); goto done; }
+
+    t = now_ms();
+    lines = asm_lines(state, lines);
+    times[PH_ASM] = now_ms() - t;
+    popd();
+    if (lines == NULL) goto done;
+
+    t = now_ms();
+    resolve_all(state);
+    times[PH_RESOLVE] = now_ms() - t;
+
+    t = now_ms();
+    if (!complete(state, lines)) goto done;
+    times[PH_COMPLETE] = now_ms() - t;
+
+    t = now_ms();
+    make_binary(lines, mem);
+    times[PH_BINARY] = now_ms() - t;
+
+    ok = TRUE;
+    free_line(lines, TRUE);
+done:
+    free_asmstate(state);
+    free(fcopy);
+    free(mem);
+    return ok;
+}
+
+// Parse every line of a file completely, and store the time taken (not counting reading it)
+int time_full_parse(const char *fname, double *times) {
+    char buf[MAX_LINE], error = FALSE;
+    char **text = NULL;
+    int i, n = 0, size = 0;
+    struct line *begin = NULL, *prev = NULL;
+    double t;
+    FILE *f = fopen(fname, "r");
+
+    if (f == NULL) return FALSE;
+    while (fgets(buf, MAX_LINE, f) != NULL) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        if (n == size) {
+            size = size ? size * 2 : 1024;
+            if ((text = realloc(text, sizeof(char *) * size)) == NULL) FATAL_ERROR("memory allocation failure");
+        }
+        text[n++] = copy_string(buf);
+    }
+    fclose(f);
+
+    t = now_ms();
+    for (i = 0; i < n; i++) prev = parse_line(text[i], prev, fname, &error, &begin);
+    times[PH_FULL_PARSE] = now_ms() - t;
+
+    if (begin != NULL) free_line(begin, TRUE);
+    for (i = 0; i < n; i++) free(text[i]);
+    free(text);
+    return !error;
+}
+
+// A fixed amount of work that does not use the assembler: formatting, copying and hashing
+// short lines, much like reading source does. Returns the time it took.
+static volatile unsigned long calibration_sink;
+double time_calibration() {
+    char buf[64], *copy, *p;
+    unsigned long hash = 5381;
+    double t = now_ms();
+    int i;
+    
+    for (i = 0; i < CALIBRATION_LOOPS; i++) {
+        snprintf(buf, sizeof(buf), "l%d:\tmvi\ta,%d", i, i & 0xFF);
+        copy = copy_string(buf);
+        for (p = copy; *p; p++) hash = hash * 33 + *p;
+        free(copy);
+    }
+    
+    calibration_sink = hash;
+    return now_ms() - t;
+}
+
+/* Baseline */
+
+int read_baseline(const char *fname, struct baseline_entry *b) {
+    int n = 0;
+    FILE *f = fopen(fname, "r");
+    if (f == NULL) return 0;
+    while (n < MAX_BASELINE && fscanf(f, "%63s %63s %lf", b[n].workload, b[n].phase, &b[n].ms) == 3) n++;
+    fclose(f);
+    return n;
+}
+
+const struct baseline_entry *find_baseline(const struct baseline_entry *b, int n, const char *w, const char *p) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (!strcmp(b[i].workload, w) && !strcmp(b[i].phase, p)) return &b[i];
+    }
+    return NULL;
+}
+
+void usage() {
+    fprintf(stderr, "usage: bench [-n scale] [-r runs] [-t tolerance] [-f] [-w] [baseline]\n");
+    fprintf(stderr, "\t-n <scale>\tWorkload size (default 10)\n");
+    fprintf(stderr, "\t-r <runs> \tRuns per workload, fastest is kept (default 5)\n");
+    fprintf(stderr, "\t-t <ratio>\tReport a regression if slower than baseline * ratio (default 1.5)\n");
+    fprintf(stderr, "\t-f        \tExit with an error if there are regressions (default: only report them)\n");
+    fprintf(stderr, "\t-w        \tWrite the times to the baseline file instead of comparing\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int c, i, run, scale = 10, runs = 5, write = FALSE, fail = FALSE, n_lines, n_base = 0, regressions = 0;
+    double tolerance = 1.5, times[N_PHASES], best[N_PHASES], total, calibration = 0, factor = 1, t;
+    char dir[] = "/tmp/asm8085_bench_XXXXXX";
+    char fname[PATH_MAX];
+    const char *baseline = NULL;
+    const struct workload *w;
+    const struct baseline_entry *b;
+    static struct baseline_entry base[MAX_BASELINE];
+    FILE *out = NULL;
+
+    while ((c = getopt(argc, argv, "n:r:t:fw")) != -1) {
+        switch (c) {
+            case 'n': scale = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 't': tolerance = atof(optarg); break;
+            case 'f': fail = TRUE; break;
+            case 'w': write = TRUE; break;
+            default: usage();
+        }
+    }
+    if (optind < argc) baseline = argv[optind];
+    if (scale < 1 || runs < 1 || (write && baseline == NULL)) usage();
+
+    if (mkdtemp(dir) == NULL) FATAL_ERROR("cannot make directory: %s", strerror(errno));
+
+    if (baseline != NULL) {
+        if (write) {
+            if ((out = fopen(baseline, "w")) == NULL) FATAL_ERROR("cannot write %s: %s", baseline, strerror(errno));
+        } else {
+            n_base = read_baseline(baseline, base);
+        }
+    }
+
+    // Time the calibration loop, keeping the fastest time. The baseline's times are scaled
+    // by how much slower or faster it is here and now.
+    for (run = 0; run < runs; run++) {
+        t = time_calibration();
+        if (run == 0 || t < calibration) calibration = t;
+    }
+    if (out != NULL) fprintf(out, "calibration loop %.3f\n", calibration);
+    if ((b = find_baseline(base, n_base, "calibration", "loop")) != NULL && b->ms > 0) {
+        factor = calibration / b->ms;
+        printf("calibration: %.2f ms, baseline %.2f ms; baseline times are scaled by %.2f\n", 
+               calibration, b->ms, factor);
+    }
+
+    printf("%-14s %7s", "workload", "lines");
+    for (i = 0; i < N_PHASES; i++) printf(" %10s", phase_names[i]);
+    printf(" %10s %8s\n", "total (ms)", "ns/line");
+
+    for (w = workloads; w->name != NULL; w++) {
+        // Generate the source
+        snprintf(fname, PATH_MAX, "%s/%s.asm", dir, w->name);
+        FILE *f = fopen(fname, "w");
+        if (f == NULL) FATAL_ERROR("cannot write %s: %s", fname, strerror(errno));
+        n_lines = w->generate(f, dir, scale);
+        fclose(f);
+
+        // Time it, keeping the fastest time for each phase
+        for (run = 0; run < runs; run++) {
+            if (!time_assembly(fname, times)) FATAL_ERROR("workload %s failed to assemble", w->name);
+            if (!time_full_parse(fname, times)) FATAL_ERROR("workload %s failed to parse", w->name);
+            for (i = 0; i < N_PHASES; i++) {
+                if (run == 0 || times[i] < best[i]) best[i] = times[i];
+            }
+        }
+
+        total = 0;
+        printf("%-14s %7d", w->name, n_lines);
+        for (i = 0; i < N_PHASES; i++) {
+            printf(" %10.2f", best[i]);
+            if (i != PH_FULL_PARSE) total += best[i];
+        }
+        printf(" %10.2f %8.1f\n", total, best[PH_FULL_PARSE] * 1e6 / n_lines);
+
+        // Compare to, or store, the baseline
+        for (i = 0; i < N_PHASES; i++) {
+            if (out != NULL) {
+                fprintf(out, "%s %s %.3f\n", w->name, phase_names[i], best[i]);
+                continue;
+            }
+
+            b = find_baseline(base, n_base, w->name, phase_names[i]);
+            if (b != NULL && best[i] > b->ms * factor * tolerance && best[i] - b->ms * factor > NOISE_MS) {
+                fprintf(stderr, "regression: %s/%s: %.2f ms, baseline %.2f ms (scaled)\n",
+                        w->name, phase_names[i], best[i], b->ms * factor);
+                regressions++;
+            }
+        }
+
+        unlink(fname);
+    }
+
+    // Remove the generated include files and the work directory
+    for (i = 0; i < 10 * scale; i++) {
+        snprintf(fname, PATH_MAX, "%s/inc%d.asm", dir, i);
+        unlink(fname);
+    }
+    rmdir(dir);
+
+    if (out != NULL) fclose(out);
+    else if (baseline != NULL) printf("%d regression(s) against %s\n", regressions, baseline);
+
+    return fail && regressions != 0;
+}
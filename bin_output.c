@@ -20,3 +20,26 @@ size_t make_binary(const struct line *lines, unsigned char *buf) {
         
     return idx; 
 }
+
+// Given a list of assembled lines, place their bytes in a 64K memory image at the
+// addresses they were assembled for.
+int make_image(const struct line *lines, unsigned char *mem) {
+    const struct line *line;
+    int start = -1, n;
+    
+    for (line = lines; line != NULL; line=line->next_line) {
+        if (line->needs_process) FATAL_ERROR("unprocessed line was passed in");
+        if (line->n_bytes == 0) continue;
+        if (start == -1) start = line->location;
+        
+        // the bytes wrap around at the end of memory, as the CPU's addresses do
+        n = line->n_bytes;
+        if (line->location + n > (1<<16)) {
+            memcpy(mem, line->bytes + (1<<16) - line->location, line->location + n - (1<<16));
+            n = (1<<16) - line->location;
+        }
+        memcpy(mem+line->location, line->bytes, n);
+    }
+    
+    return start == -1 ? 0 : start;
+}
@@ -13,4 +13,8 @@
 // Returns the amount of bytes written. 
 size_t make_binary(const struct line *lines, unsigned char *buf);
 
+// Given a list of assembled lines, place their bytes in a 64K memory image at the
+// addresses they were assembled for. Returns the address of the first byte (0 if none).
+int make_image(const struct line *lines, unsigned char *mem);
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,165 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "cache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define CACHE_BUF_SIZE 65536
+
+// FNV-1a hash, continuing from the given hash
+static uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t len) {
+    while (len--) {
+        hash ^= *data++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Hash the contents of a file, continuing from the given hash
+static int hash_file(const char *path, uint64_t *hash) {
+    unsigned char *buf;
+    size_t n;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return FALSE;
+    
+    if ((buf = malloc(CACHE_BUF_SIZE)) == NULL) FATAL_ERROR("failed to allocate memory for hash buffer");
+    while ((n = fread(buf, 1, CACHE_BUF_SIZE, f)) > 0) *hash = fnv1a(*hash, buf, n);
+    
+    free(buf);
+    fclose(f);
+    return TRUE;
+}
+
+// Copy a file. The copy is made under a temporary name first, so that it is never
+// seen half-written.
+static int copy_file(const char *src, const char *dst) {
+    char tmp[PATH_MAX];
+    unsigned char *buf;
+    size_t n;
+    int ok = TRUE;
+    FILE *in, *out;
+    
+    if (snprintf(tmp, PATH_MAX, "%s.%d", dst, (int) getpid()) >= PATH_MAX) return FALSE;
+    if ((in = fopen(src, "r")) == NULL) return FALSE;
+    if ((out = fopen(tmp, "w")) == NULL) {
+        fclose(in);
+        return FALSE;
+    }
+    
+    if ((buf = malloc(CACHE_BUF_SIZE)) == NULL) FATAL_ERROR("failed to allocate memory for copy buffer");
+    while (ok && (n = fread(buf, 1, CACHE_BUF_SIZE, in)) > 0) ok = fwrite(buf, 1, n, out) == n;
+    ok = ok && !ferror(in);
+    
+    free(buf);
+    fclose(in);
+    if (fclose(out) != 0) ok = FALSE;
+    
+    if (ok && rename(tmp, dst) != 0) ok = FALSE;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+// Get the name of a file in a cache entry
+static int entry_file(char *buf, const char *dir, const char *key, const char *name) {
+    return snprintf(buf, PATH_MAX, "%s/%s%s%s", dir, key, name ? "/" : "", name ? name : "") < PATH_MAX;
+}
+
+int cache_key(const char *source, const char *options, char *key) {
+    char path[PATH_MAX];
+    uint64_t hash = fnv1a(FNV_OFFSET, (const unsigned char *) options, strlen(options) + 1);
+    
+    // The same source elsewhere may include different files, so where it is is part of the key,
+    // and so is the working directory that relative include paths are looked up from
+    if (realpath(source, path) == NULL) return FALSE;
+    hash = fnv1a(hash, (const unsigned char *) path, strlen(path) + 1);
+    if (getcwd(path, PATH_MAX) == NULL) return FALSE;
+    hash = fnv1a(hash, (const unsigned char *) path, strlen(path) + 1);
+    
+    if (!hash_file(source, &hash)) return FALSE;
+    snprintf(key, CACHE_KEY_SIZE, "%016llx", (unsigned long long) hash);
+    return TRUE;
+}
+
+int cache_fetch(const char *dir, const char *key, const char *outp, const char *listp) {
+    char path[PATH_MAX], line[PATH_MAX + 32];
+    unsigned long long want;
+    uint64_t hash;
+    int ok = TRUE, n;
+    FILE *f;
+    
+    // Read the manifest
+    if (!entry_file(path, dir, key, "manifest") || (f = fopen(path, "r")) == NULL) return FALSE;
+    if (fgets(line, sizeof(line), f) == NULL || strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC))) {
+        fclose(f);
+        return FALSE;
+    }
+    
+    // Every file the output was made from must still have the same contents
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        hash = FNV_OFFSET;
+        if (sscanf(line, "dep %llx %n", &want, &n) != 1) ok = FALSE;
+        else ok = hash_file(line + n, &hash) && hash == want;
+    }
+    
+    // The listing must be there if it is wanted
+    if (ok && listp != NULL && (!entry_file(path, dir, key, "listing") || access(path, R_OK) != 0)) ok = FALSE;
+    
+    // Copy the files out
+    if (ok) ok = entry_file(path, dir, key, "output") && copy_file(path, outp);
+    if (ok && listp != NULL) ok = entry_file(path, dir, key, "listing") && copy_file(path, listp);
+    
+    // Record the dependencies, as if the file had been assembled
+    if (ok) {
+        rewind(f);
+        if (fgets(line, sizeof(line), f) == NULL) ok = FALSE;
+        while (ok && fgets(line, sizeof(line), f) != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            if (sscanf(line, "dep %llx %n", &want, &n) == 1) deps_add(line + n);
+        }
+    }
+    
+    fclose(f);
+    return ok;
+}
+
+// Write one line of the manifest
+static void write_manifest_dep(const char *path, void *arg) {
+    FILE *f = arg;
+    uint64_t hash = FNV_OFFSET;
+    
+    // If a file cannot be read now, write a hash that makes the entry a miss
+    if (!hash_file(path, &hash)) hash = 0;
+    fprintf(f, "dep %016llx %s\n", (unsigned long long) hash, path);
+}
+
+int cache_store(const char *dir, const char *key, const char *outp, const char *listp) {
+    char path[PATH_MAX], tmp[PATH_MAX];
+    FILE *f;
+    
+    // Make the entry directory
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return FALSE;
+    if (!entry_file(path, dir, key, NULL) || (mkdir(path, 0777) != 0 && errno != EEXIST)) return FALSE;
+    
+    // Copy the output files into it
+    if (!entry_file(path, dir, key, "output") || !copy_file(outp, path)) return FALSE;
+    if (!entry_file(path, dir, key, "listing")) return FALSE;
+    if (listp != NULL) {
+        if (!copy_file(listp, path)) return FALSE;
+    } else {
+        unlink(path); // an old listing may no longer match the output
+    }
+    
+    // Write the manifest last, so that the entry is only used once it is complete
+    if (!entry_file(path, dir, key, "manifest")) return FALSE;
+    if (snprintf(tmp, PATH_MAX, "%s.%d", path, (int) getpid()) >= PATH_MAX) return FALSE;
+    if ((f = fopen(tmp, "w")) == NULL) return FALSE;
+    fprintf(f, CACHE_MAGIC "\n");
+    deps_foreach(write_manifest_dep, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return FALSE;
+    }
+    
+    return TRUE;
+}
@@ -0,0 +1,36 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * cache.h: keep assembled output in a cache directory, keyed on the
+ * contents of all the files that went into it
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "deps.h"
+
+#define CACHE_MAGIC "asm8085-cache 1"
+#define CACHE_KEY_SIZE 17 // 16 hex digits and the terminator
+
+// Work out the cache key for a source file, given a string describing the options
+// that change the output. The key also covers where the source is and the working
+// directory. Returns FALSE if the source cannot be read.
+int cache_key(const char *source, const char *options, char *key);
+
+// Look for the key in the cache. If the entry is there and none of the files it was
+// made from have changed, copy the output (and the listing, if listp is not NULL) out
+// of it, record its dependencies, and return TRUE.
+int cache_fetch(const char *dir, const char *key, const char *outp, const char *listp);
+
+// Store the output (and the listing, if listp is not NULL) in the cache, along with
+// the recorded dependencies. Returns FALSE on error.
+int cache_store(const char *dir, const char *key, const char *outp, const char *listp);
+
+#endif
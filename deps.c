@@ -0,0 +1,95 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "deps.h"
+
+struct dep_item {
+    char *path;
+    struct dep_item *next;
+};
+
+// Recorded files, in order
+static struct dep_item *deps_head = NULL, *deps_tail = NULL;
+static char deps_on = FALSE;
+
+void deps_start() {
+    deps_on = TRUE;
+}
+
+void deps_add(const char *filename) {
+    char path[PATH_MAX];
+    struct dep_item *d;
+    
+    if (!deps_on) return;
+    
+    // Get the full path; the directory stack may change before it is written
+    if (realpath(filename, path) == NULL) {
+        if (getcwd(path, PATH_MAX) == NULL) FATAL_ERROR("cannot get wd: %s", strerror(errno));
+        if (strlen(path) + strlen(filename) + 2 > PATH_MAX) return;
+        strcat(path, "/");
+        strcat(path, filename);
+    }
+    
+    // Every file is only listed once
+    for (d = deps_head; d != NULL; d = d->next) {
+        if (!strcmp(d->path, path)) return;
+    }
+    
+    if ((d = malloc(sizeof(struct dep_item))) == NULL) FATAL_ERROR("failed to allocate memory for dependency");
+    d->path = copy_string(path);
+    d->next = NULL;
+    if (deps_tail == NULL) deps_head = d;
+    else deps_tail->next = d;
+    deps_tail = d;
+}
+
+void deps_foreach(void (*fn)(const char *path, void *arg), void *arg) {
+    struct dep_item *d;
+    for (d = deps_head; d != NULL; d = d->next) fn(d->path, arg);
+}
+
+// Write a file name, relative to dir if possible, escaping characters that make treats specially
+static void write_dep_name(FILE *f, const char *path, const char *dir) {
+    size_t len = strlen(dir);
+    if (!strncmp(path, dir, len) && path[len] == '/') path += len + 1;
+    
+    for (; *path; path++) {
+        if (*path == ' ' || *path == '\t' || *path == '#') fputc('\\', f);
+        if (*path == '$') fputc('$', f);
+        fputc(*path, f);
+    }
+}
+
+int deps_write(FILE *f, const char *target, const char *dir, int phony) {
+    struct dep_item *d;
+    
+    write_dep_name(f, target, dir);
+    fputc(':', f);
+    for (d = deps_head; d != NULL; d = d->next) {
+        fprintf(f, " \\\n ");
+        write_dep_name(f, d->path, dir);
+    }
+    fputc('\n', f);
+    
+    // Empty rules, so make does not fail if a file is removed
+    if (phony) {
+        for (d = deps_head; d != NULL; d = d->next) {
+            fputc('\n', f);
+            write_dep_name(f, d->path, dir);
+            fprintf(f, ":\n");
+        }
+    }
+    
+    return !ferror(f);
+}
+
+void deps_free() {
+    struct dep_item *d;
+    while (deps_head != NULL) {
+        d = deps_head;
+        deps_head = d->next;
+        free(d->path);
+        free(d);
+    }
+    deps_tail = NULL;
+    deps_on = FALSE;
+}
@@ -0,0 +1,34 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * deps.h: keep track of the files read during assembly, and write them
+ * out as Makefile dependencies
+ */
+
+#ifndef __DEPS_H__
+#define __DEPS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Start recording the files that are read
+void deps_start();
+
+// Record that a file has been read. The name is relative to the current directory,
+// so it must be recorded before the directory stack changes.
+void deps_add(const char *filename);
+
+// Call a function for each recorded file (full path), in the order they were read
+void deps_foreach(void (*fn)(const char *path, void *arg), void *arg);
+
+// Write a Makefile rule for target. Paths inside dir are written relative to it.
+// If phony is set, an empty rule is added for each dependency.
+int deps_write(FILE *f, const char *target, const char *dir, int phony);
+
+// Stop recording, and forget all recorded files
+void deps_free();
+
+#endif
@@ -7,6 +7,20 @@ void no_asm_output(struct line *line) {
     line->needs_process = FALSE;
 }
 
+// When streaming, lines that have been cut out of the line list can be freed,
+// as assembly will never come back to them
+static void drop_lines(struct asmstate *state, struct line *first, const struct line *last) {
+    struct line *next;
+    if (!state->streaming) return;
+    
+    while (first != NULL) {
+        next = first->next_line;
+        if (first == last) next = NULL;
+        free_line(first, FALSE);
+        first = next;
+    }
+}
+
 // evaluate an expression, give error if it cannot be evaluated
 int eval_on_line(struct asmstate *state, const struct parsed_expr *expr, intptr_t *result, const char *errmsg) {
     if (contains_undefined_names(expr, state->knowns)) {
@@ -40,7 +54,8 @@ int dir_include(struct asmstate *state) {
 
     // Read the file
     char *fname = cur_line->argmts->data.string;
-    struct line *lines = read_file(fname);
+    trace_begin_until(next_line, "include", fname, cur_line, NULL, 0);
+    struct line *lines = state->streaming ? read_file_part(fname, STREAM_PART_SIZE) : read_file(fname);
     struct line *flastline = NULL;
     
     if (lines == NULL || sanity_checks(lines)) {
@@ -109,6 +124,7 @@ int dir_incbin(struct asmstate *state) {
         error_on_line(cur_line, "cannot open file: %s", fname);
         return FALSE;
     }
+    deps_add(fname);
     
     // Read the file
     unsigned char *mem = malloc(65536);
@@ -245,6 +261,18 @@ int dir_db(struct asmstate *state) {
         FATAL_ERROR("failed to allocate memory for db");
     }
     
+    // If all the arguments are constant, the bytes can be filled in now
+    unsigned char *pos = cur_line->bytes;
+    for (arg = cur_line->argmts; arg != NULL; arg = arg->next_argmt) {
+        if (arg->type == STRING) {
+            memcpy(pos, arg->data.string, strlen(arg->data.string));
+            pos += strlen(arg->data.string);
+        } else if (!store_constant(arg, pos++, 1)) {
+            return TRUE;
+        }
+    }
+    cur_line->needs_process = FALSE;
+    
     return TRUE;
 }
     
@@ -275,6 +303,13 @@ int dir_dw(struct asmstate *state) {
         FATAL_ERROR("failed to allocate memory for dw");
     }
     
+    // If all the arguments are constant, the words can be filled in now
+    unsigned char *pos = cur_line->bytes;
+    for (arg = cur_line->argmts; arg != NULL; arg = arg->next_argmt, pos += 2) {
+        if (!store_constant(arg, pos, 2)) return TRUE;
+    }
+    cur_line->needs_process = FALSE;
+    
     return TRUE;
 }
 
@@ -356,9 +391,13 @@ int dir_macro(struct asmstate *state) {
     macro = define_macro(macro_start, &endm);
     if (macro == NULL) return FALSE;
     
+    // The macro belongs to the section it is defined in
+    section_line(state->sections, macro_start);
+    
     // Cut the macro definition out of the line list
     state->cur_line = state->prev_line;
     state->cur_line->next_line = endm->next_line;
+    drop_lines(state, macro_start, endm);
     
     // Add the macro to the macro list
     state->macros = add_macro(macro, state->macros);
@@ -404,23 +443,28 @@ int handle_if(struct asmstate *state, int accept) {
     struct line *next_endif = find_endif(state->cur_line);
     if (next_endif == NULL) return FALSE;
     
+    struct line *endif = next_endif->next_line;
+    
     if (accept) {
         // The statement is true, so assembly should proceed as if the 'if' and
         // 'endif' just weren't there
         
+        // Remove the 'endif'
+        next_endif->next_line = endif->next_line;
+        
         // Remove the 'if'
         state->prev_line->next_line = state->cur_line->next_line;
+        drop_lines(state, state->cur_line, state->cur_line);
+        drop_lines(state, endif, endif);
         state->cur_line = state->prev_line;
         
-        // Remove the 'endif'
-        next_endif->next_line = next_endif->next_line->next_line;
-        
         return TRUE;
     } else {
         // The statement is false, so assembly should proceed as if the 'if' and
         // 'endif', and the whole block of code in between, wasn't there
         
-        state->prev_line->next_line = next_endif->next_line->next_line;
+        state->prev_line->next_line = endif->next_line;
+        drop_lines(state, state->cur_line, endif);
         state->cur_line = state->prev_line;
         return TRUE;
     }
@@ -691,15 +735,20 @@ int dir_repeat(struct asmstate *state) {
         return FALSE;
     }
     
+    trace_begin_until(endr->next_line, "repeat", "repeat", cur, "count", (int) repts);
+    
     if (repts == 0) {
         // repeating code 0 times means to delete the code
         state->prev_line->next_line = endr->next_line;
+        drop_lines(state, cur, endr);
         state->cur_line = state->prev_line;
     } else if (repts == 1) {
         // repeating code once means simply to delete the REPEAT and ENDR
-        state->prev_line->next_line = state->cur_line->next_line;
-        state->prev_line = state->cur_line;
         endr_prev->next_line = endr->next_line;
+        state->prev_line->next_line = state->cur_line->next_line;
+        drop_lines(state, cur, cur);
+        drop_lines(state, endr, endr);
+        state->cur_line = state->prev_line;
     } else {
         // twice or more: we need to make N copies of the source
         struct line *src_cur;
@@ -722,6 +771,7 @@ int dir_repeat(struct asmstate *state) {
         state->prev_line->next_line = copy_start;
         state->cur_line = state->prev_line;
         copy_cur->next_line = endr->next_line;
+        drop_lines(state, cur, endr);
     }
     
     return TRUE;
@@ -744,4 +794,236 @@ int dir_end(struct asmstate *state) {
 
     
     
-    
\ No newline at end of file
+    
+
+// Get the name given as an argument to 'public' or 'extern', or NULL if it is not a global name
+static const char *symbol_argmt(struct argmt *arg, const struct lineinfo *info) {
+    if (!parse_argmt(EXPRESSION, arg, info)) return NULL;
+    
+    const struct token_stack_node *n = arg->data.expr->start;
+    if (n == NULL || n->next != NULL || n->token->type != NAME) return NULL;
+    if (n->token->text[0] == '.' || !strcmp(n->token->text, "$")) return NULL;
+    
+    return n->token->text;
+}
+
+// 'public': export names to other modules
+int dir_public(struct asmstate *state) {
+    struct line *cur = state->cur_line;
+    struct argmt *arg;
+    const char *name;
+    no_asm_output(cur);
+    
+    if (cur->n_argmts < 1) {
+        error_on_line(cur, "public: needs at least one name");
+        return FALSE;
+    }
+    
+    for (arg = cur->argmts; arg != NULL; arg = arg->next_argmt) {
+        if ((name = symbol_argmt(arg, &cur->info)) == NULL) {
+            error_on_line(cur, "public: not a global name: %s", arg->raw_text);
+            return FALSE;
+        }
+        set_var(state->publics, name, (intptr_t) cur);
+    }
+    
+    return TRUE;
+}
+
+// 'extern': import names from other modules
+int dir_extern(struct asmstate *state) {
+    struct line *cur = state->cur_line;
+    struct argmt *arg;
+    const char *name;
+    intptr_t foo;
+    no_asm_output(cur);
+    
+    // Only the linker can supply these names
+    if (!state->object) {
+        error_on_line(cur, "extern: only allowed when assembling an object (-c)");
+        return FALSE;
+    }
+    
+    if (cur->n_argmts < 1) {
+        error_on_line(cur, "extern: needs at least one name");
+        return FALSE;
+    }
+    
+    for (arg = cur->argmts; arg != NULL; arg = arg->next_argmt) {
+        if ((name = symbol_argmt(arg, &cur->info)) == NULL) {
+            error_on_line(cur, "extern: not a global name: %s", arg->raw_text);
+            return FALSE;
+        }
+        if (get_var(state->knowns, name, &foo) || get_var(state->unknowns, name, &foo)) {
+            error_on_line(cur, "extern: name is defined in this module: %s", name);
+            return FALSE;
+        }
+        set_var(state->externs, name, 0);
+    }
+    
+    return TRUE;
+}
+
+// 'section': a part of the program that is left out if nothing outside it uses its labels
+int dir_section(struct asmstate *state) {
+    struct line *cur = state->cur_line, *end;
+    no_asm_output(cur);
+    
+    if (cur->n_argmts != 0) {
+        error_on_line(cur, "section: takes no arguments");
+        return FALSE;
+    }
+    
+    // A macro or an include could still put one section inside another
+    if (state->sections->cur >= 0) {
+        error_on_line(cur, "section inside section");
+        return FALSE;
+    }
+    
+    if (begin_section(state->sections, cur->location)) return TRUE;
+    
+    // The section is left out, so assembly proceeds as if it wasn't there
+    for (end = cur->next_line; end != NULL; end = end->next_line) {
+        if (end->instr.type == DIRECTIVE && end->instr.instr == DIR_endsection) break;
+    }
+    if (end == NULL) {
+        error_on_line(cur, "section without endsection");
+        return FALSE;
+    }
+    
+    if (cur->label != NULL) del_var(state->knowns, cur->label);
+    state->prev_line->next_line = end->next_line;
+    drop_lines(state, cur, end);
+    state->cur_line = state->prev_line;
+    return TRUE;
+}
+
+int dir_endsection(struct asmstate *state) {
+    struct line *cur = state->cur_line;
+    no_asm_output(cur);
+    
+    if (cur->n_argmts != 0) {
+        error_on_line(cur, "endsection: takes no arguments");
+        return FALSE;
+    }
+    
+    if (state->sections->cur < 0) {
+        error_on_line(cur, "endsection without section");
+        return FALSE;
+    }
+    
+    end_section(state->sections, cur->location);
+    return TRUE;
+}
+// 'rstslots [n]': reserve n rst vectors (by default, all the rest up to 40h) for --rst
+int dir_rstslots(struct asmstate *state) {
+    struct line *cur = state->cur_line, *next = cur->next_line, *prev = cur;
+    intptr_t n;
+    int first, i;
+    char *code, *text, *end, error = FALSE;
+    
+    if (cur->n_argmts > 1) {
+        error_on_line(cur, "rstslots: needs at most one argument");
+        return FALSE;
+    }
+    
+    if (cur->location % 8 != 0 || cur->location >= 0x40) {
+        error_on_line(cur, "rstslots: not at an rst vector (location = %04X)", cur->location);
+        return FALSE;
+    }
+    first = cur->location / 8;
+    n = 8 - first;
+    
+    if (cur->n_argmts == 1) {
+        if (!parse_argmt(EXPRESSION, cur->argmts, &cur->info)) return FALSE;
+        if (!eval_on_line(state, cur->argmts->data.expr, &n,
+                "rstslots: number of vectors must be fully defined")) return FALSE;
+        if (n < 1 || first + n > 8) {
+            error_on_line(cur, "rstslots: there are no %d vectors from %04X", (int) n, cur->location);
+            return FALSE;
+        }
+    }
+    
+    for (i = first; i < first + n; i++) state->rst_slots |= 1 << i;
+    
+    // Until the routines are known, the vectors are just empty space
+    if (state->rst == NULL) {
+        cur->n_bytes = 8 * n;
+        cur->bytes = calloc(cur->n_bytes, sizeof(char));
+        if (cur->bytes == NULL) FATAL_ERROR("failed to allocate memory for rstslots");
+        cur->needs_process = FALSE;
+        return TRUE;
+    }
+    
+    // Otherwise, the code for each vector goes after this line
+    no_asm_output(cur);
+    for (i = first; i < first + n; i++) {
+        code = rst_vector_code(state->rst, i);
+        for (text = code; *text; text = end + 1) {
+            end = strchr(text, '\n');
+            *end = '\0';
+            prev = parse_line_part(FALSE, text, prev, cur->info.filename, &error);
+            if (error) {
+                error_on_line(prev, "rstslots: cannot parse code for rst %d: %s", i, text);
+                free(code);
+                prev->next_line = next;
+                return FALSE;
+            }
+        }
+        free(code);
+    }
+    prev->next_line = next;
+    
+    return TRUE;
+}
+// 'pooldb': like 'db', but the bytes are stored in the next 'pool', only once
+int dir_pooldb(struct asmstate *state) {
+    struct line *cur = state->cur_line;
+    char *name = NULL;
+    
+    if (!dir_db(state)) return FALSE;
+    if (cur->needs_process) {
+        error_on_line(cur, "pooldb: values must be known here, and fit in a byte");
+        return FALSE;
+    }
+    
+    // The label will point into the pool, so it is only defined there
+    if (cur->label != NULL) name = add_base(state->knowns, cur->label);
+    
+    pool_add(state->pool, name, cur->bytes, cur->n_bytes, cur->info.filename, cur->info.lineno);
+    free(cur->bytes);
+    cur->bytes = NULL;
+    no_asm_output(cur);
+    return TRUE;
+}
+
+// 'pool': store the bytes of the 'pooldb's before it, and define their labels
+int dir_pool(struct asmstate *state) {
+    struct line *cur = state->cur_line;
+    struct pool *p = state->pool;
+    intptr_t foo;
+    int i;
+    
+    if (cur->n_argmts != 0) {
+        error_on_line(cur, "pool: takes no arguments");
+        return FALSE;
+    }
+    
+    cur->bytes = pool_layout(p, &cur->n_bytes);
+    cur->needs_process = FALSE;
+    
+    for (i = 0; i < p->n; i++) {
+        if (p->list[i].name == NULL) continue;
+        if (get_var(state->knowns, p->list[i].name, &foo)
+        ||  get_var(state->unknowns, p->list[i].name, &foo)
+        ||  get_var(state->externs, p->list[i].name, &foo)) {
+            error_on_line(cur, "pool: label is already defined elsewhere: %s", p->list[i].name);
+            pool_clear(p);
+            return FALSE;
+        }
+        set_var(state->knowns, p->list[i].name, cur->location + p->list[i].offset);
+    }
+    
+    pool_clear(p);
+    return TRUE;
+}
\ No newline at end of file
@@ -28,33 +28,47 @@ static const char *keywords[] = {
     NULL
 };
 
-struct base_fx_s {
-    char fx[2];
-    int base;
+static const char *functions[] = {
+    #define _FN(fn, argsn) #fn ,
+    #include "operators.h"
+    NULL
 };
 
-static const struct base_fx_s base_pfx[] = {
-//    {"0b", 2},
-    {"0o", 8},
-    {"0x", 16},
-    {"$", 16},
-    {"", 0}
+static const int function_valence[] = {
+    #define _FN(fn, argsn) argsn ,
+    #include "operators.h"
+    0
 };
 
-static const struct base_fx_s base_sfx[] = {
-    {"b", 2},
-    {"o", 8},
-    {"h", 16},
-    {"", 0}
+// Character classes, for the tokenizer
+#define CC_SPACE 1
+#define CC_DIGIT 2  // 0-9
+#define CC_HEX   4  // 0-9, A-F and a-f
+#define CC_ALPHA 8  // letters, '_' and '.' (what a name can start with)
+#define CC_PUNCT 16 // what operators are made of
+#define CC_NAME  (CC_DIGIT | CC_ALPHA)
+
+static const unsigned char char_class[256] = {
+    ['\t'] = CC_SPACE, ['\n'] = CC_SPACE, ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE, [' '] = CC_SPACE,
+    ['!' ... '-'] = CC_PUNCT, ['.'] = CC_ALPHA, ['/'] = CC_PUNCT,
+    ['0' ... '9'] = CC_DIGIT | CC_HEX,
+    [':' ... '@'] = CC_PUNCT,
+    ['A' ... 'F'] = CC_ALPHA | CC_HEX, ['G' ... 'Z'] = CC_ALPHA,
+    ['[' ... '^'] = CC_PUNCT, ['_'] = CC_ALPHA, ['`'] = CC_PUNCT,
+    ['a' ... 'f'] = CC_ALPHA | CC_HEX, ['g' ... 'z'] = CC_ALPHA,
+    ['{' ... '~'] = CC_PUNCT
 };
 
+#define CLASS(c) char_class[(unsigned char) (c)]
+
 // free tokens
 void free_tokens(struct token *tok) {
     struct token *next = tok;
     while (next != NULL) {
         tok = next;
         next = tok->next_token;
-        free(tok->text);
+        // only names have their own copy of the text
+        if (tok->type == NAME) free((char *) tok->text);
         free(tok);
     }
 }
@@ -69,11 +83,11 @@ struct token *alloc_token() {
 
 
 int is_name_character (int c) {
-    return c=='_' || c=='.' || isalnum(c);
+    return CLASS(c) & CC_NAME;
 }
 
 int is_op_character(int c) {
-    return c!='_' && c!=' ' && c!='.' && ispunct(c);
+    return CLASS(c) & CC_PUNCT;
 }
 
 
@@ -83,40 +97,41 @@ char *get_word(const char *c) {
     return copy_string_pred(c, pred, FALSE);
 }
 
+// get the length of the next "word", without copying it
+static size_t word_length(const char *c) {
+    int class = is_name_character(*c) ? CC_NAME : CC_PUNCT;
+    const char *end = c;
+    while (CLASS(*end) & class) end++;
+    return end - c;
+}
+
 // if the token at *ptr is a literal from the given list, return a token, otherwise NULL
 struct token *try_from_list(const char *const *list, const char *begin, const char **out_ptr, char allow_partial_match) {
+    size_t length, word;
     int i;
     
     // check for empty
     if (!*begin) return NULL;
     
-    // get next word
-    char *word = get_word(begin);
+    // get length of next word
+    word = word_length(begin);
         
     for (i=0; list[i]!=NULL; i++) {
-        char found = allow_partial_match ? has_case_insensitive_prefix(word, list[i]) : !strcasecmp(list[i], word);
-        if (found) {
-            // gotcha
-            
-            if (allow_partial_match) {
-                // trim the word so that it is just the matched prefix
-                int new_length = strlen(list[i])+1;
-                word[new_length-1] = '\0';
-                word = realloc(word, sizeof(char) * new_length);
-                if (word == NULL) FATAL_ERROR("realloc failed");
-            }
-            
-            struct token *t = alloc_token();
-            t->text = word;
-            // the value is set to the list index
-            t->value = i;
-            *out_ptr = begin + strlen(word);
-            return t;
-        }
+        length = strlen(list[i]);
+        
+        // either the word must start with the literal, or be the literal
+        if (allow_partial_match ? length > word : length != word) continue;
+        if (strncasecmp(list[i], begin, length)) continue;
+        
+        // gotcha
+        struct token *t = alloc_token();
+        t->text = list[i];
+        // the value is set to the list index
+        t->value = i;
+        *out_ptr = begin + length;
+        return t;
     }
     
-    // we failed, free the word copy we made.
-    free(word);
     return NULL;
 }
         
@@ -153,6 +168,13 @@ struct token *try_keyword(const char *begin, const char **out_ptr) {
     return t;
 }
 
+// try to parse a function name
+struct token *try_function(const char *begin, const char **out_ptr) {
+    struct token *t = try_from_list(functions, begin, out_ptr, FALSE);
+    if (t != NULL) t->type = FUNCTION;
+    return t;
+}
+
 // try to parse a name
 struct token *try_name(const char *begin, const char **out_ptr) {
     // empty line
@@ -161,7 +183,7 @@ struct token *try_name(const char *begin, const char **out_ptr) {
     char *name;
        
     // a name must start with an alphabetic character, '.' or '_'.
-    if (!is_name_character(*begin) || isdigit(*begin)) {
+    if (!(CLASS(*begin) & CC_ALPHA)) {
         // special case: '$' by itself is a metavariable referring to the current location
         if (begin[0] == '$' && !is_name_character(begin[1])) {
             name = copy_string("$");
@@ -171,39 +193,157 @@ struct token *try_name(const char *begin, const char **out_ptr) {
             return NULL;
         }
     } else {
-        // it is a normal name 
-        name = get_word(begin);
-        *out_ptr = begin + strlen(name);
+        // it is a normal name; this is the one kind of token that needs its own copy of the
+        // text, as the name is looked up long after the line is gone
+        *out_ptr = begin + word_length(begin);
+        name = copy_string_part(begin, *out_ptr);
     }
     
     t = alloc_token();
-    if (t == NULL) FATAL_ERROR("failed to allocate space for token");
     t->text = name;
     t->type = NAME;
     return t;
 }
 
-// bracket
+// bracket, or the comma between function arguments
 struct token *try_bracket(const char *begin, const char **out_ptr) {
     struct token *t = NULL;
     if (*begin == '(' || *begin == ')') {
-        char *s = calloc(2, sizeof(char));
-        if (s == NULL) FATAL_ERROR("failed to allocate space for token text");
         t = alloc_token();
-        if (t == NULL) FATAL_ERROR("failed to allocate space for token");
-        *s = *begin;
-        t->text = s;
-        t->type = (*s == '(') ? LBRACE : RBRACE;
-        t->value = *s;
+        t->text = (*begin == '(') ? "(" : ")";
+        t->type = (*begin == '(') ? LBRACE : RBRACE;
+        t->value = *begin;
+        *out_ptr = begin+1;
+    } else if (*begin == ',') {
+        t = alloc_token();
+        t->text = ",";
+        t->type = COMMA;
+        t->value = *begin;
         *out_ptr = begin+1;
     }
     return t;
 }
     
+// Backtick opcodes seen before, keyed on their normalised text (the value is the byte, or -1)
+static struct varspace *backtick_memo = NULL;
+
+// An empty set of names, for constant expressions
+static const struct varspace no_names;
+
+// Normalise the text of a quoted opcode: lower case outside of quotes, whitespace
+// collapsed into single spaces, and no spaces around commas or at either end
+static char *normalise_opcode(const char *begin, const char *end) {
+    char *norm = malloc(end - begin + 1), *p = norm, delim = 0;
+    if (norm == NULL) FATAL_ERROR("failed to allocate space for quoted opcode");
+    
+    for (; begin < end; begin++) {
+        if (delim) {
+            if (*begin == '\\' && begin + 1 < end) *p++ = *begin++;
+            else if (*begin == delim) delim = 0;
+            *p++ = *begin;
+        } else if (isspace(*begin)) {
+            if (p > norm && p[-1] != ' ' && p[-1] != ',') *p++ = ' ';
+        } else {
+            if (*begin == ',' && p > norm && p[-1] == ' ') p--;
+            if (*begin == '"' || *begin == '\'') delim = *begin;
+            *p++ = tolower(*begin);
+        }
+    }
+    
+    if (p > norm && p[-1] == ' ') p--;
+    *p = '\0';
+    return norm;
+}
+
+// See if text is a valid expression
+static int valid_expr(const char *text, const struct lineinfo *info) {
+    struct parsed_expr *expr = parse_expr(text, info);
+    free_parsed_expr(expr);
+    return expr != NULL;
+}
+
+// Evaluate a constant expression, -1 if it is not valid or not constant
+static int const_expr(const char *text, const struct lineinfo *info) {
+    int value = -1;
+    struct parsed_expr *expr = parse_expr(text, info);
+    if (expr != NULL && !contains_undefined_names(expr, &no_names)) {
+        value = eval_expr(expr, &no_names, info, 0);
+    }
+    free_parsed_expr(expr);
+    return value;
+}
+
+// Get the opcode byte for normalised opcode text from the opcode table, or -1 if invalid
+static int encode_opcode(const char *norm, const struct lineinfo *info) {
+    char *copy = copy_string(norm), *args[2], *p, delim = 0;
+    int n_args = 0, depth = 0, idx = 0, value = -1;
+    enum reg_e d, s;
+    
+    // Split off the mnemonic; only opcodes are allowed
+    if ((p = strchr(copy, ' ')) != NULL) *p++ = '\0';
+    enum opcode op = op_from_str(copy);
+    if ((int) op == -1) goto done;
+    const struct opcode_info *oi = get_opcode_info(op);
+    
+    // Split the arguments on commas that are not in brackets or quotes
+    if (p != NULL) {
+        args[n_args++] = p;
+        for (; *p; p++) {
+            if (delim) {
+                if (*p == '\\' && p[1]) p++;
+                else if (*p == delim) delim = 0;
+            } else if (*p == '"' || *p == '\'') delim = *p;
+            else if (*p == '(') depth++;
+            else if (*p == ')') depth--;
+            else if (*p == ',' && depth == 0) {
+                if (n_args == 2) goto done;
+                *p = '\0';
+                args[n_args++] = p + 1;
+            }
+        }
+    }
+    
+    // Check the arguments and find the index into the encoding
+    switch (oi->kind) {
+        case AK_NONE:
+            if (n_args != 0) goto done;
+            break;
+        case AK_IMM:
+            if (n_args != 1 || !valid_expr(args[0], info)) goto done;
+            break;
+        case AK_3CONST:
+            if (n_args != 1 || (idx = const_expr(args[0], info)) < 0 || idx > 7) goto done;
+            break;
+        case AK_R:
+            if (n_args != 1 || (idx = parse_reg(args[0])) == R_INV) goto done;
+            break;
+        case AK_RP:
+            if (n_args != 1 || (idx = parse_reg_pair(args[0])) == RP_INV) goto done;
+            break;
+        case AK_R8:
+            if (n_args != 2 || (idx = parse_reg(args[0])) == R_INV || !valid_expr(args[1], info)) goto done;
+            break;
+        case AK_RP16:
+            if (n_args != 2 || (idx = parse_reg_pair(args[0])) == RP_INV || !valid_expr(args[1], info)) goto done;
+            break;
+        case AK_DS:
+            if (n_args != 2 || (d = parse_reg(args[0])) == R_INV || (s = parse_reg(args[1])) == R_INV) goto done;
+            idx = d<<3 | s;
+            break;
+    }
+    
+    value = oi->enc[idx];
+    
+done:
+    free(copy);
+    return value;
+}
+
 // an opcode with arguments can be quoted in backticks: `mvi a,_` 
-// this returns the opcode byte
+// and will then be evaluated as its first byte
 struct token *try_backtick_opcode(const char *begin, const char **out_ptr) {
     struct token *t = NULL;
+    intptr_t value;
     
     if (*begin != '`') return NULL;
     // find corresponding backtick
@@ -211,46 +351,27 @@ struct token *try_backtick_opcode(const char *begin, const char **out_ptr) {
     const char *backtick = strchr(begin + 1, '`');
     if (backtick == NULL) return NULL;
     
-    // make the text for the 'token'
-    char *text = calloc(backtick-begin + 2, 1);
-    if (text == NULL) FATAL_ERROR("failed to allocate space for token text");
-    memcpy(text, begin, backtick-begin + 1);
-    
-    // make the 'line' that should be parsed
-    const char *start = begin + 1, *end = backtick;
-    size_t size = end - start;
-    char *p_line = calloc(size + 2, 1);
-    if (p_line == NULL) FATAL_ERROR("failed to allocate space for quoted line");
-    p_line[0] = ' '; // to make sure nothing is interpreted as a label
-    memcpy(p_line + 1, start, size);
-    
-    // parse the line
-    char error = FALSE;
-    struct line *line = parse_line_part(FALSE, p_line, NULL, text, &error);
-    if (line == NULL || error) goto free;
-    
-    // only opcodes are allowed
-    if (line->instr.type != OPCODE) goto free;
-    
-    struct asmstate *state = init_asmstate();
-    if (!asm_lines(state, line)) goto free;
+    // look up the opcode, or work it out from the opcode table if it has not been seen yet
+    char *norm = normalise_opcode(begin + 1, backtick);
+    if (backtick_memo == NULL) backtick_memo = alloc_varspace();
+    if (!get_var(backtick_memo, norm, &value)) {
+        // errors in the arguments are reported as being in the quoted opcode
+        char *text = copy_string_part(begin, backtick + 1);
+        struct lineinfo info = { text, NULL, 0 };
+        value = encode_opcode(norm, &info);
+        set_var(backtick_memo, norm, value);
+        free(text);
+    }
+    free(norm);
     
-    // this must have given us bytes
-    if (line->n_bytes < 1) goto free;
+    if (value == -1) return NULL;
     
-    // otherwise we now have the byte to return
+    // we now have the byte to return
     t = alloc_token();
-    t->text = text;
     t->type = NUMBER;
-    t->value = line->bytes[0];
+    t->value = (int) value;
     
     *out_ptr = backtick + 1;
-    
-free:
-    if (t == NULL) free(text);
-    free_line(line, FALSE);
-    free(p_line);
-    
     return t;
 }
     
@@ -265,24 +386,14 @@ struct token *try_char_const(const char *begin, const char **out_ptr) {
         // no escape code
         *out_ptr = &ptr[3];
         
-        // text of token 
-        char *s = calloc(4, sizeof(char));
-        memcpy(s, ptr, 3);
-        
         t = alloc_token();
-        t->text = s;
         t->type = NUMBER;
         t->value = ptr[1];
     } else if (ptr[1] == '\\' && ptr[3] == '\'') {
         // escape code
         *out_ptr = &ptr[4];
         
-        // text of token
-        char *s = calloc(5, sizeof(char));
-        memcpy(s, ptr, 4);
-        
         t = alloc_token();
-        t->text = s;
         t->type = NUMBER;
         switch(ptr[2]) {
             case 'a': t->value='\a'; break;
@@ -301,14 +412,20 @@ struct token *try_char_const(const char *begin, const char **out_ptr) {
 }
     
     
-// if the token at *ptr is a valid number, return a token, otherwise NULL
+// value of a (hexadecimal) digit
+static int digit_value(char c) {
+    return (CLASS(c) & CC_DIGIT) ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+// if the token at *ptr is a valid number, return a token, otherwise NULL.
+// The digits are read once; where there is no prefix, the base is only known once
+// the suffix is reached, so their values are kept until then.
 struct token *try_number(const char *begin, const char **out_ptr) {
-    int sign = 1, base = 10, i, out_num;
-    char base_given = FALSE, maybe_octal = FALSE;
-    char digits[] = "0123456789ABCDEF";
-    char number_text[MAX_NUM_LEN+1] = {'\0'};
+    int sign = 1, base = 16, i, n = 0;
+    unsigned int out_num;
+    char base_given = TRUE, maybe_octal = FALSE;
+    unsigned char digits[MAX_NUM_LEN];
     const char *ptr = begin;
-    const struct base_fx_s *b;
     
     // check for empty
     if (!*ptr) return NULL;
@@ -316,27 +433,19 @@ struct token *try_number(const char *begin, const char **out_ptr) {
     // check for negative number
     if (*ptr == '-') { sign = -1; ptr++; }
    
-    // check if a base is given (start with 0x, 0o, 0b or $)
-    b = base_pfx;
-    while (b->base != 0) {
-        size_t pfxlen = strlen(b->fx);
-        if (! strncasecmp(b->fx, ptr, pfxlen)) {
-            base = b->base;
-            ptr += pfxlen;
-            base_given = TRUE;
-            break;
-        } else {
-            b++;
-        }
-    }
-    
-    if (base_given) {
-        // Truncate the list of valid digits if a base was given
-        digits[base] = '\0';
+    // check if a base is given (start with 0x, 0o or $)
+    if (ptr[0] == '$') {
+        ptr += 1;
+    } else if (ptr[0] == '0' && (ptr[1] | 0x20) == 'x') {
+        ptr += 2;
+    } else if (ptr[0] == '0' && (ptr[1] | 0x20) == 'o') {
+        base = 8;
+        ptr += 2;
     } else {
         // If there was no prefix, the number itself must start with a (base-10) digit
         // to prevent clashes with names (e.g. 'ABCDH' could be the label 'abcdh' or the number '0xABCD' otherwise)
-        if (! (*ptr >= '0' && *ptr <= '9')) return NULL;
+        if (!(CLASS(*ptr) & CC_DIGIT)) return NULL;
+        base_given = FALSE;
         
         // If the number starts with 0 and is followed by an octal digit, that means it may be octal.
         if (*ptr == '0' && ptr[1] >= '0' && ptr[1] <= '7') {
@@ -345,60 +454,43 @@ struct token *try_number(const char *begin, const char **out_ptr) {
         }
     }
     
-    // Collect all the necessary digits
-    for (i=0; i<MAX_NUM_LEN && ptr[i] && strchr(digits, toupper(ptr[i])); i++) {
-        number_text[i] = toupper(ptr[i]);
+    // Collect all the digits (any hexadecimal digit, if the base is not known yet)
+    while (n < MAX_NUM_LEN && (CLASS(*ptr) & CC_HEX) && digit_value(*ptr) < base) {
+        digits[n++] = digit_value(*ptr++);
     }
     
-    // If there were no digits, this is not a valid number. 
-    if (i == 0) return NULL; 
+    // If there were no digits, or the length was exceeded, this is not a valid number. 
+    if (n == 0 || n == MAX_NUM_LEN) return NULL;
     
-    // If the length was exceeded, this was not a valid token.
-    if (i == MAX_NUM_LEN) return NULL;
-    
-    ptr += i;
-
     // If we didn't have a base yet, check for a base suffix
     if (! base_given) {
         // Hacky, but 'B' gets eaten as a possible hexadecimal number
-        if (toupper(ptr[-1]) == 'B' && toupper(*ptr) != 'H') {
+        if ((ptr[-1] | 0x20) == 'b' && (*ptr | 0x20) != 'h') {
             ptr--;
-            number_text[i-1] = '\0';
-        }
-        
-        b = base_sfx;
-        while (b->base != 0) {
-            if (toupper(*b->fx) == toupper(*ptr)) {
-                base = b->base;
-                ptr ++;
-                break;
-            }
-            b++;
+            n--;
         }
         
-        // If the number started with '0' and no base was given, then it is octal.
-        if (base==10 && maybe_octal) base=8; 
-        
-        // Since the base may now have changed, check if the digits are all still valid
-        digits[base] = '\0';
-        for (i=0; number_text[i]; i++) {
-            if (! strchr(digits, number_text[i])) return NULL;
+        switch (*ptr | 0x20) {
+            case 'b': base = 2;  ptr++; break;
+            case 'o': base = 8;  ptr++; break;
+            case 'h': base = 16; ptr++; break;
+            // If the number started with '0' and no base was given, then it is octal.
+            default:  base = maybe_octal ? 8 : 10;
         }
     }
     
-    // If we are here, we now have a valid number in base "base"
+    // If we are here, we now have a number in base "base", if all the digits are valid in it
     out_num = 0;
-    for (i=0; number_text[i]; i++) {
-        out_num *= base;
-        out_num += strchr(digits, number_text[i]) - digits;
+    for (i=0; i<n; i++) {
+        if (digits[i] >= base) return NULL;
+        out_num = out_num * base + digits[i];
     }
     
     // Allocate space for the token
     struct token *token = alloc_token();
     
-    // Set token text, type and number value
-    token->text = copy_string_part(begin, ptr);
-    token->value = out_num * sign;
+    // Set token type and number value
+    token->value = (int) out_num * sign;
     token->type = NUMBER;
     
     *out_ptr = ptr;
@@ -411,8 +503,10 @@ struct token *try_number(const char *begin, const char **out_ptr) {
 // get the next valid token in the string, NULL if none, error message generated if not empty.
 // out_ptr points at location after token
 struct token *get_token(const char *ptr, const char **out_ptr, const struct lineinfo *info, char accept_operator, char *error) {
+    const char *begin = ptr;
+    
     // Scan ahead to next nonwhitespace character
-    ptr = scan_ahead(ptr, isspace, FALSE);
+    while (CLASS(*ptr) & CC_SPACE) ptr++;
     
     if (!*ptr) {
         // Line is empty.
@@ -431,14 +525,21 @@ struct token *get_token(const char *ptr, const char **out_ptr, const struct line
         // unary operators are always allowed (they do not need an argument in front of them)
         t = try_unary(ptr, out_ptr);
     }
-    if (t != NULL) return t; 
     
-    t = try_backtick_opcode(ptr, out_ptr); if (t != NULL) return t; 
-    t = try_char_const(ptr, out_ptr); if (t != NULL) return t; 
-    t = try_number(ptr, out_ptr); if (t != NULL) return t; 
-    t = try_keyword(ptr, out_ptr); if (t != NULL) return t; 
-    t = try_name(ptr, out_ptr); if (t != NULL) return t; 
-    t = try_bracket(ptr, out_ptr); if (t != NULL) return t;
+    if (t == NULL) t = try_backtick_opcode(ptr, out_ptr);
+    if (t == NULL) t = try_char_const(ptr, out_ptr);
+    if (t == NULL) t = try_number(ptr, out_ptr);
+    if (t == NULL) t = try_keyword(ptr, out_ptr);
+    if (t == NULL) t = try_function(ptr, out_ptr);
+    if (t == NULL) t = try_name(ptr, out_ptr);
+    if (t == NULL) t = try_bracket(ptr, out_ptr);
+    
+    if (t != NULL) {
+        // Remember where the token was
+        t->offset = ptr - begin;
+        t->length = *out_ptr - ptr;
+        return t;
+    }
       
     // Invalid token
     char *inv = get_word(ptr);
@@ -453,14 +554,15 @@ struct token *tokenize(const char *text, const struct lineinfo *info, char *erro
     
     struct token *t = NULL, *start = NULL, *prev = NULL;
     char accept_operator = FALSE;
-    const char *out_ptr;
+    const char *out_ptr, *source = text;
     
     while (*text) {
-        text = scan_ahead(text, isspace, FALSE);
+        while (CLASS(*text) & CC_SPACE) text++;
         if (!*text) break; // end of line
         
         t = get_token(text, &out_ptr, info, accept_operator, error);
         if (t == NULL) goto err_cleanup; // error
+        t->offset += text - source;
         
         // t now holds a token
         if (start == NULL) start = t; // first token
@@ -531,9 +633,10 @@ struct token_stack_node *execution_order(const struct token *tok, const struct l
                 out_stack = push(out_stack, tok);
                 break;
             
-            /* keywords and left braces go onto the operator stack */
+            /* keywords, functions and left braces go onto the operator stack */
             case LBRACE:
             case KEYWORD:
+            case FUNCTION:
                 op_stack = push(op_stack, tok);
                 break;
                 
@@ -546,6 +649,7 @@ struct token_stack_node *execution_order(const struct token *tok, const struct l
                     while ( op_stack != NULL &&           
                             op_stack->token->type != LBRACE &&                                
                             ( op_stack->token->type == KEYWORD ||
+                              op_stack->token->type == FUNCTION ||
                               operator_info[op_stack->token->value].precedence >= operator_info[tok->value].precedence
                             )) {
                         out_stack = push(out_stack, op_stack->token);
@@ -571,6 +675,20 @@ struct token_stack_node *execution_order(const struct token *tok, const struct l
                 // remove the brace that's still on the stack
                 op_stack = pop(op_stack);
                 break;
+           
+           /* comma: the argument before it is complete, pop all operators until left parenthesis */
+           case COMMA:
+                while (op_stack != NULL && op_stack->token->type != LBRACE) {
+                    out_stack = push(out_stack, op_stack->token);
+                    op_stack = pop(op_stack);
+                }
+                
+                // the bracket must be the one that holds a function's arguments
+                if (op_stack == NULL || op_stack->prev == NULL || op_stack->prev->token->type != FUNCTION) {
+                    fprintf(stderr, "%s: line %d: ',' outside of function arguments.\n", info->filename, info->lineno);
+                    goto err_cleanup;
+                }
+                break;
                 
            default:
                 // you never know
@@ -607,14 +725,117 @@ err_cleanup:
     free_stack(op_stack);
     return NULL;
 }
+
+
+// A value on the folding stack: the node its computation starts at, and its value if it is constant
+struct fold_entry {
+    struct token_stack_node *first;
+    char constant;
+    intptr_t value;
+};
+
+// Collapse every maximal constant subexpression in an RPN queue to one NUMBER token.
+// The new tokens are added to *tokens, so they are freed along with the others.
+// Anything that would give an error or a different result when evaluated later is left alone:
+// missing arguments, division by zero, and results that do not fit in a NUMBER.
+static void fold_constants(struct token_stack_node *start, struct token **tokens) {
+    struct fold_entry stack[EVAL_STACK_SIZE];
+    struct token_stack_node *node, *next, *n;
+    const struct token *t;
+    struct token *folded;
+    intptr_t inputs[2], value = 0;
+    int sp = 0, valence, i, end;
+    char constant;
+    
+    for (node = start; node != NULL; node = next) {
+        next = node->next;
+        t = node->token;
         
+        switch (t->type) {
+            case NUMBER:
+            case NAME:
+                if (sp >= EVAL_STACK_SIZE) return;
+                stack[sp].first = node;
+                stack[sp].constant = t->type == NUMBER;
+                stack[sp].value = t->value;
+                sp++;
+                continue;
+                
+            case KEYWORD: valence = 1; break;
+            case OPERATOR: valence = operator_info[t->value].valence; break;
+            case FUNCTION: valence = function_valence[t->value]; break;
+            default: return;
+        }
+        
+        // Leave malformed expressions for eval_rpn_queue to complain about
+        if (sp < valence) return;
+        sp -= valence;
+        
+        // Functions depend on the assembled code, so they are never constant
+        constant = t->type != FUNCTION;
+        for (i = 0; i < valence && constant; i++) {
+            constant = stack[sp+i].constant;
+            inputs[i] = stack[sp+i].value;
+        }
+        if (constant && t->type == OPERATOR && (t->value == OPR_DIV || t->value == OPR_MOD) && inputs[1] == 0) {
+            constant = FALSE;
+        }
+        
+        if (constant) {
+            value = t->type == KEYWORD ? eval_keyword(t->value, inputs[0]) : eval_operator(t->value, inputs);
+            constant = value == (int) value;
+        }
+        
+        stack[sp].constant = constant;
+        stack[sp].value = value;
+        sp++;
+        if (!constant) continue;
+        
+        // Replace the subexpression by one number, which spans all of its tokens
+        folded = alloc_token();
+        folded->type = NUMBER;
+        folded->value = (int) value;
+        folded->offset = t->offset;
+        end = t->offset + t->length;
+        for (n = stack[sp-1].first; n != node; n = n->next) {
+            if (n->token->offset < folded->offset) folded->offset = n->token->offset;
+            if (n->token->offset + n->token->length > end) end = n->token->offset + n->token->length;
+        }
+        folded->length = end - folded->offset;
+        folded->next_token = *tokens;
+        *tokens = folded;
+        
+        // The first node is kept (so the start of the queue stays the same), the rest is freed
+        n = stack[sp-1].first;
+        node = n->next;
+        n->token = folded;
+        n->next = next;
+        if (next != NULL) next->prev = n;
+        while (node != next) {
+            n = node->next;
+            free(node);
+            node = n;
+        }
+    }
+}
      
+// See if a parsed expression calls any functions.
+char contains_functions(const struct parsed_expr *expr) {
+    const struct token_stack_node *node;
+    for (node = expr->start; node != NULL; node = node->next) {
+        if (node->token->type == FUNCTION) return TRUE;
+    }
+    return FALSE;
+}
+
 // See if a parsed expression contains names not defined in vs.
 char contains_undefined_names(const struct parsed_expr *expr, const struct varspace *vs) {
     intptr_t val;
     const struct token_stack_node *node;
     for (node = expr->start; node != NULL; node = node->next) {
         const struct token *t = node->token;
+        // a function's value is not known until all the code is there
+        if (t->type == FUNCTION && !cycles_available()) return TRUE;
         if (t->type != NAME) continue;  // only look at names
         if (!strcmp("$", t->text)) continue; // "$" refers to the location and therefore always exists
         if (!get_var(vs, t->text, &val)) return TRUE;
@@ -662,6 +883,28 @@ int eval_rpn_queue(const struct token_stack_node *node, const struct varspace *v
                 stackptr -= val - 1;
                 stack[stackptr-1] = eval_operator(t->value, &stack[stackptr-1]);
                 break;
+            
+            case FUNCTION:
+                val = function_valence[t->value];
+                if (stackptr < val) {
+                    fprintf(stderr, "%s: line %d: missing argument for: %s\n", info->filename, info->lineno, t->text);
+                    return 0;
+                }
+                stackptr -= val - 1;
+                switch (t->value) {
+                    case FN_cycles:
+                    case FN_mincycles:
+                        // T-states of the code from the first address up to the second
+                        if (!region_cycles(stack[stackptr-1], stack[stackptr], t->value == FN_cycles, info, &val)) return 0;
+                        stack[stackptr-1] = val;
+                        break;
+                    case FN_stackdepth:
+                        // Stack depth of the routine at the address
+                        if (!routine_stack_depth(stack[stackptr-1], info, &val)) return 0;
+                        stack[stackptr-1] = val;
+                        break;
+                }
+                break;
         
             default:
                 fprintf(stderr, "%s: line %d: internal error: invalid token type %d (%s). (this is a bug)\n",
@@ -715,6 +958,7 @@ struct parsed_expr *parse_expr(const char *text, const struct lineinfo *info) {
         if (p == NULL) FATAL_ERROR("failed to allocate space for parsed_expr");
         p->token_list = t;
         p->start = n;
+        fold_constants(n, &p->token_list);
         
         // Remember which label "." should refer to 
         p->basename = copy_string(info->lastlabel);
@@ -722,6 +966,13 @@ struct parsed_expr *parse_expr(const char *text, const struct lineinfo *info) {
     }
 }
 
+// see if a parsed expression is a constant, and if so, give its value
+int expr_constant(const struct parsed_expr *expr, int *value) {
+    if (expr->start == NULL || expr->start->next != NULL || expr->start->token->type != NUMBER) return FALSE;
+    *value = expr->start->token->value;
+    return TRUE;
+}
+
 // evaluate parsed expression
 int eval_expr(const struct parsed_expr *expr, const struct varspace *vs, const struct lineinfo *info, int location) {
     const struct varspace v = temp_rename(vs, expr->basename);
@@ -747,7 +998,9 @@ struct token *copy_token(const struct token *t) {
     if (copy == NULL) FATAL_ERROR("failed to allocate memory for copy of token");
     
     copy->next_token = NULL;
-    copy->text = copy_string(t->text);
+    copy->text = (t->type == NAME) ? copy_string(t->text) : t->text;
+    copy->offset = t->offset;
+    copy->length = t->length;
     copy->type = t->type;
     copy->value = t->value;
     return copy;
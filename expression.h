@@ -12,6 +12,7 @@
 #include "expr_fns.h"
 #include "varspace.h"
 #include "assembler.h"
+#include "opcode_table.h"
 
 #define MAX_NUM_LEN 10  // maximum length of number token
 #define EVAL_STACK_SIZE 1024
@@ -28,6 +29,12 @@ enum keyword {
     #include "operators.h" 
 };
 
+// functions
+enum function {
+    #define _FN(fn, argsn) FN_##fn,
+    #include "operators.h"
+};
+
 // token stack
 
 struct token_stack_node {
@@ -38,9 +45,10 @@ struct token_stack_node {
 // token 
 struct token {
     struct token *next_token;
-    char *text;
-    enum { NUMBER, NAME, KEYWORD, LBRACE, RBRACE, OPERATOR } type;
-    int value; // set if NUMBER, OPERATOR or KEYWORD.
+    const char *text;   // a copy of the name if NAME, the operator, keyword, function, bracket or comma itself, NULL if NUMBER
+    int offset, length; // where the token was in the tokenized text
+    enum { NUMBER, NAME, KEYWORD, LBRACE, RBRACE, OPERATOR, FUNCTION, COMMA } type;
+    int value; // set if NUMBER, OPERATOR, KEYWORD or FUNCTION.
 };
 
 // parsed expression 
@@ -62,6 +70,10 @@ void free_parsed_expr(struct parsed_expr *);
 // parse an expression
 struct parsed_expr *parse_expr(const char *text, const struct lineinfo *info); 
 
+// see if a parsed expression is a constant (its constant parts are folded when it is parsed).
+// if so, return TRUE and store its value.
+int expr_constant(const struct parsed_expr *expr, int *value);
+
 // evaluate parsed expression
 int eval_expr(const struct parsed_expr *expr, const struct varspace *vs, const struct lineinfo *info, int location);
 
@@ -78,6 +90,9 @@ struct token *get_token(const char *ptr, const char **out_ptr, const struct line
 // evaluate a string
 int evaluate(const char *text, const struct varspace *vs, const struct lineinfo *info, int location);
 
+// See if a parsed expression calls any functions (which depend on the assembled code).
+char contains_functions(const struct parsed_expr *);
+
 // See if a parsed expression contains names not defined in vs.
 char contains_undefined_names(const struct parsed_expr *, const struct varspace *) ;
 
@@ -0,0 +1,118 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "filecache.h"
+#include "parser.h"
+
+struct cached_file {
+    char *path;             // the full path
+    dev_t dev;              // what the file was like when it was parsed
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct line *lines;
+    struct cached_file *next;
+};
+
+static struct cached_file *cache_head = NULL;
+static int miss_fd = -1;
+
+// Has a file changed since it was cached?
+static int changed(const struct cached_file *c, const struct stat *st) {
+    return c->dev != st->st_dev || c->ino != st->st_ino || c->size != st->st_size
+        || c->mtime.tv_sec != st->st_mtim.tv_sec || c->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+static struct cached_file *find(const char *path) {
+    struct cached_file *c;
+    for (c = cache_head; c != NULL; c = c->next) {
+        if (!strcmp(c->path, path)) return c;
+    }
+    return NULL;
+}
+
+// Tell the server about a file it does not have (a path too long to write at once is left out,
+// as another job could write its own paths in between)
+static void report_miss(const char *path) {
+    char buf[PIPE_BUF];
+    int n = snprintf(buf, sizeof(buf), "%s\n", path);
+    if (n < (int) sizeof(buf) && write(miss_fd, buf, n) != n) miss_fd = -1;
+}
+
+struct line *filecache_get(const char *filename) {
+    char path[PATH_MAX];
+    struct cached_file *c;
+    struct line *begin = NULL, *prev = NULL, *copy, *line;
+    struct stat st;
+
+    if (cache_head == NULL && miss_fd < 0) return NULL;
+    if (realpath(filename, path) == NULL || stat(path, &st) == -1) return NULL;
+
+    if ((c = find(path)) == NULL || changed(c, &st)) {
+        if (miss_fd >= 0) report_miss(path);
+        return NULL;
+    }
+
+    for (line = c->lines; line != NULL; line = line->next_line) {
+        copy = copy_line(line);
+        free(copy->info.filename);
+        copy->info.filename = copy_string(filename);
+        if (prev == NULL) begin = copy;
+        else prev->next_line = copy;
+        prev = copy;
+    }
+
+    return begin;
+}
+
+void filecache_load(const char *path) {
+    struct cached_file *c = find(path), **p;
+    struct line *lines = NULL;
+    struct stat st;
+    int found = stat(path, &st) == 0;
+
+    if (found && c != NULL && !changed(c, &st)) return;
+
+    // The file is looked at before it is read, so that a change while it is read shows
+    if (found) lines = read_file_threads(path, 0);
+
+    if (c == NULL && lines != NULL) {
+        if ((c = calloc(1, sizeof(struct cached_file))) == NULL) FATAL_ERROR("could not allocate memory for file cache");
+        c->path = copy_string(path);
+        c->next = cache_head;
+        cache_head = c;
+    } else if (c != NULL) {
+        free_line(c->lines, TRUE);
+    }
+    if (c == NULL) return;
+
+    // A file that is gone, or does not parse, is not kept
+    if (lines == NULL) {
+        for (p = &cache_head; *p != c; p = &(*p)->next);
+        *p = c->next;
+        free(c->path);
+        free(c);
+        return;
+    }
+
+    c->lines = lines;
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->size = st.st_size;
+    c->mtime = st.st_mtim;
+}
+
+void filecache_report_misses(int fd) {
+    miss_fd = fd;
+}
+
+void filecache_free() {
+    struct cached_file *c;
+    while (cache_head != NULL) {
+        c = cache_head;
+        cache_head = c->next;
+        free_line(c->lines, TRUE);
+        free(c->path);
+        free(c);
+    }
+    miss_fd = -1;
+}
@@ -0,0 +1,34 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * filecache.h: keep parsed source files in memory, so that a server (asm8085 --server)
+ * does not have to read them again for every job
+ */
+
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "parser_types.h"
+
+// If a file is in the cache and has not changed since it was parsed, return a copy of its
+// lines (as read_file() would, with the name as given). Otherwise, return NULL.
+struct line *filecache_get(const char *filename);
+
+// Parse a file into the cache, unless it is there already and has not changed.
+// If it cannot be parsed, it is taken out of the cache.
+void filecache_load(const char *path);
+
+// From now on, write the full path of each file that filecache_get() does not have to fd,
+// one per line, so that the server can load it for the next job
+void filecache_report_misses(int fd);
+
+// Forget all files
+void filecache_free();
+
+#endif
@@ -14,6 +14,10 @@
 #define _DIR(x)
 #endif
 
+#ifndef _TIME
+#define _TIME(op, t8080, t8085, m8080, m8085, taken8080, taken8085)
+#endif
+
 /* Directives */
 _DIR(include)
 _DIR(incbin)
@@ -38,6 +42,13 @@ _DIR(repeat)
 _DIR(endr)
 _DIR(end)
 _DIR(cpu)
+_DIR(public)
+_DIR(extern)
+_DIR(section)
+_DIR(endsection)
+_DIR(rstslots)
+_DIR(pooldb)
+_DIR(pool)
 
 /* Opcodes 
    
@@ -147,6 +158,105 @@ _OP(jnk,  FALSE,  ARG_IMM(2, 0xdd            ))
 _OP(lhlx, FALSE,  ARG_NONE(  0xed            ))
 _OP(jk,   FALSE,  ARG_IMM(2, 0xfd            ))
 
+/* T-states
+
+   For each opcode: the T-states on the 8080 and the 8085, then the same with M as the
+   register argument, and then the same when the condition of a conditional jump, call
+   or return holds. A zero in the last four means "the same as the first two".
+   8085-specific opcodes have no 8080 timing.
+*/
+
+_TIME(mov,   5,  4,  7,  7,  0,  0)
+_TIME(mvi,   7,  7, 10, 10,  0,  0)
+_TIME(lxi,  10, 10,  0,  0,  0,  0)
+_TIME(lda,  13, 13,  0,  0,  0,  0)
+_TIME(sta,  13, 13,  0,  0,  0,  0)
+_TIME(lhld, 16, 16,  0,  0,  0,  0)
+_TIME(shld, 16, 16,  0,  0,  0,  0)
+_TIME(ldax,  7,  7,  0,  0,  0,  0)
+_TIME(stax,  7,  7,  0,  0,  0,  0)
+_TIME(xchg,  4,  4,  0,  0,  0,  0)
+_TIME(add,   4,  4,  7,  7,  0,  0)
+_TIME(adi,   7,  7,  0,  0,  0,  0)
+_TIME(adc,   4,  4,  7,  7,  0,  0)
+_TIME(aci,   7,  7,  0,  0,  0,  0)
+_TIME(sub,   4,  4,  7,  7,  0,  0)
+_TIME(sui,   7,  7,  0,  0,  0,  0)
+_TIME(sbb,   4,  4,  7,  7,  0,  0)
+_TIME(sbi,   7,  7,  0,  0,  0,  0)
+_TIME(inr,   5,  4, 10, 10,  0,  0)
+_TIME(dcr,   5,  4, 10, 10,  0,  0)
+_TIME(inx,   5,  6,  0,  0,  0,  0)
+_TIME(dcx,   5,  6,  0,  0,  0,  0)
+_TIME(dad,  10, 10,  0,  0,  0,  0)
+_TIME(daa,   4,  4,  0,  0,  0,  0)
+_TIME(ana,   4,  4,  7,  7,  0,  0)
+_TIME(ani,   7,  7,  0,  0,  0,  0)
+_TIME(ora,   4,  4,  7,  7,  0,  0)
+_TIME(ori,   7,  7,  0,  0,  0,  0)
+_TIME(xra,   4,  4,  7,  7,  0,  0)
+_TIME(xri,   7,  7,  0,  0,  0,  0)
+_TIME(cmp,   4,  4,  7,  7,  0,  0)
+_TIME(cpi,   7,  7,  0,  0,  0,  0)
+_TIME(rlc,   4,  4,  0,  0,  0,  0)
+_TIME(rrc,   4,  4,  0,  0,  0,  0)
+_TIME(ral,   4,  4,  0,  0,  0,  0)
+_TIME(rar,   4,  4,  0,  0,  0,  0)
+_TIME(cma,   4,  4,  0,  0,  0,  0)
+_TIME(cmc,   4,  4,  0,  0,  0,  0)
+_TIME(stc,   4,  4,  0,  0,  0,  0)
+_TIME(jmp,  10, 10,  0,  0,  0,  0)
+_TIME(jnz,  10,  7,  0,  0, 10, 10)
+_TIME(jz,   10,  7,  0,  0, 10, 10)
+_TIME(jnc,  10,  7,  0,  0, 10, 10)
+_TIME(jc,   10,  7,  0,  0, 10, 10)
+_TIME(jpo,  10,  7,  0,  0, 10, 10)
+_TIME(jpe,  10,  7,  0,  0, 10, 10)
+_TIME(jp,   10,  7,  0,  0, 10, 10)
+_TIME(jm,   10,  7,  0,  0, 10, 10)
+_TIME(call, 17, 18,  0,  0,  0,  0)
+_TIME(cnz,  11,  9,  0,  0, 17, 18)
+_TIME(cz,   11,  9,  0,  0, 17, 18)
+_TIME(cnc,  11,  9,  0,  0, 17, 18)
+_TIME(cc,   11,  9,  0,  0, 17, 18)
+_TIME(cpo,  11,  9,  0,  0, 17, 18)
+_TIME(cpe,  11,  9,  0,  0, 17, 18)
+_TIME(cp,   11,  9,  0,  0, 17, 18)
+_TIME(cm,   11,  9,  0,  0, 17, 18)
+_TIME(ret,  10, 10,  0,  0,  0,  0)
+_TIME(rnz,   5,  6,  0,  0, 11, 12)
+_TIME(rz,    5,  6,  0,  0, 11, 12)
+_TIME(rnc,   5,  6,  0,  0, 11, 12)
+_TIME(rc,    5,  6,  0,  0, 11, 12)
+_TIME(rpo,   5,  6,  0,  0, 11, 12)
+_TIME(rpe,   5,  6,  0,  0, 11, 12)
+_TIME(rp,    5,  6,  0,  0, 11, 12)
+_TIME(rm,    5,  6,  0,  0, 11, 12)
+_TIME(rst,  11, 12,  0,  0,  0,  0)
+_TIME(pchl,  5,  6,  0,  0,  0,  0)
+_TIME(push, 11, 12,  0,  0,  0,  0)
+_TIME(pop,  10, 10,  0,  0,  0,  0)
+_TIME(xthl, 18, 16,  0,  0,  0,  0)
+_TIME(sphl,  5,  6,  0,  0,  0,  0)
+_TIME(in,   10, 10,  0,  0,  0,  0)
+_TIME(out,  10, 10,  0,  0,  0,  0)
+_TIME(ei,    4,  4,  0,  0,  0,  0)
+_TIME(di,    4,  4,  0,  0,  0,  0)
+_TIME(hlt,   7,  5,  0,  0,  0,  0)
+_TIME(nop,   4,  4,  0,  0,  0,  0)
+_TIME(dsub,  0, 10,  0,  0,  0,  0)
+_TIME(arhl,  0,  7,  0,  0,  0,  0)
+_TIME(rdel,  0, 10,  0,  0,  0,  0)
+_TIME(rim,   0,  4,  0,  0,  0,  0)
+_TIME(ldhi,  0, 10,  0,  0,  0,  0)
+_TIME(sim,   0,  4,  0,  0,  0,  0)
+_TIME(ldsi,  0, 10,  0,  0,  0,  0)
+_TIME(rstv,  0,  6,  0,  0,  0, 12)
+_TIME(shlx,  0, 10,  0,  0,  0,  0)
+_TIME(jnk,   0,  7,  0,  0,  0, 10)
+_TIME(lhlx,  0, 10,  0,  0,  0,  0)
+_TIME(jk,    0,  7,  0,  0,  0, 10)
 
 #undef _OP
 #undef _DIR
+#undef _TIME
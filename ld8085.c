@@ -0,0 +1,93 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+// ld8085: link objects made by 'asm8085 -c' into a binary
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "object.h"
+
+void help() {
+    printf("usage: ld8085 -h | [-o output] [-b base] object...\n");
+    printf("\t-h       \tShow help\n");
+    printf("\t-o <file>\tSet output file (default: a.bin)\n");
+    printf("\t-b <addr>\tPlace the first module at this address (default: its own origin)\n");
+    printf("\nModules are placed one after another, in the order given.\n");
+
+    exit(0);
+}
+
+int main(int argc, char **argv) {
+    int c, base = -1;
+    char *outp = "a.bin";
+    struct objmodule *modules = NULL, **tail = &modules;
+    unsigned char *mem;
+    size_t outsize = 0;
+    FILE *outf;
+
+    // Handle arguments
+    while ((c = getopt(argc, argv, "ho:b:")) != -1) {
+        switch(c) {
+            case '?':
+                if (optopt == 'o' || optopt == 'b') {
+                    fprintf(stderr, "-%c requires an argument.\n", optopt);
+                } else {
+                    fprintf(stderr, "Unknown option: -%c\n", optopt);
+                }
+
+                exit(1);
+
+            case 'h': help(); break;
+            case 'o': outp = optarg; break;
+            case 'b':
+                base = (int) strtol(optarg, NULL, 0);
+                if (base < 0 || base > 65535) {
+                    fprintf(stderr, "invalid base address: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "ld8085: no object files given\n");
+        exit(1);
+    }
+
+    // Read all the objects
+    for (; optind < argc; optind++) {
+        if ((*tail = read_object(argv[optind])) == NULL) exit(1);
+        tail = &(*tail)->next;
+    }
+
+    if (base == -1) base = modules->origin;
+
+    // Link them
+    if ((mem = malloc(65536)) == NULL) {
+        fprintf(stderr, "memory allocation failure.\n");
+        exit(1);
+    }
+    if (!link_objects(modules, base, mem, &outsize)) exit(2);
+
+    // Write the binary file
+    if (!strcmp(outp, "-")) {
+        outf = stdout;
+    } else if ((outf = fopen(outp, "w")) == NULL) {
+        fprintf(stderr, "cannot open %s for writing: %s\n", outp, strerror(errno));
+        exit(1);
+    }
+
+    if (fwrite(mem, 1, outsize, outf) != outsize) {
+        fprintf(stderr, "write error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (outf != stdout) fclose(outf);
+
+    free(mem);
+    free_objmodules(modules);
+    return 0;
+}
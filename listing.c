@@ -38,8 +38,37 @@ void write_bytes(FILE *f, const struct line *l, int offset, int first) {
     if (!first) fprintf(f, "\n");
 }
 
+// Write T-states, as "taken/not taken" if they differ
+static void write_states(FILE *f, const char *fmt, int states, int taken) {
+    char buf[32];
+    if (states == taken) snprintf(buf, sizeof(buf), "%d", states);
+    else snprintf(buf, sizeof(buf), "%d/%d", taken, states);
+    fprintf(f, fmt, buf);
+}
+
+// Write the T-states of an instruction, and the running total since the last label
+void write_cycles(FILE *f, const struct line *l, struct cycles *total) {
+    // A label starts a new total (unless it is an 'equ', which is not a place in the code)
+    if (l->label != NULL && !(l->instr.type == DIRECTIVE && l->instr.instr == DIR_equ)) {
+        total->states = total->taken = 0;
+    }
+    
+    if (l->instr.type != OPCODE || l->n_bytes == 0) {
+        fprintf(f, "                   ");
+        return;
+    }
+    
+    const struct cycles *c = get_cycles(l->bytes[0], l->cpu);
+    total->states += c->states;
+    total->taken += c->taken;
+    
+    write_states(f, " %-6s", c->states, c->taken);
+    write_states(f, " %-11s", total->states, total->taken);
+}
+
 void write_listing(FILE *f, const struct asmstate *state, const struct line *lines) {
     const struct line *line;
+    struct cycles total = {0, 0};
     int offset;
     intptr_t value = 0;
     
@@ -66,11 +95,16 @@ void write_listing(FILE *f, const struct asmstate *state, const struct line *lin
         // For a binary include, don't print all the bytes
         if (line->instr.type == DIRECTIVE
          && line->instr.instr == DIR_incbin) {
-             fprintf(f, "[.........] %s\n", line->raw_text);
+             fprintf(f, "[.........]");
+             write_cycles(f, line, &total);
+             fprintf(f, " %s\n", line->raw_text);
         } else {
             // Print bytes, if there are any
             offset = 0;
             write_bytes(f, line, offset, TRUE);
+            
+            // Print the T-states of instructions
+            write_cycles(f, line, &total);
         
             // Print rest of line
             fprintf(f, " %s\n", line->raw_text);
@@ -5,6 +5,11 @@
 #include "parser.h"
 #include "assembler.h"
 
+// Write the T-states of an instruction (if the line is one), and the total since the last label
+void write_cycles(FILE *f, const struct line *l, struct cycles *total);
+
+// Write a listing: for each line, its location, bytes, T-states and source text,
+// followed by the symbol table
 void write_listing(FILE *f, const struct asmstate *state, const struct line *lines);
 
 #endif
\ No newline at end of file
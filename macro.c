@@ -6,9 +6,14 @@
 
 // Free data structures
 void free_macro(struct macro *macro) {
+    int i;
     if (macro == NULL) return;
     free_line(macro->header, FALSE);
     free_line(macro->body, TRUE);
+    for (i=0; i<macro->n_lines; i++) free_subst_template(macro->templates[i]);
+    free(macro->templates);
+    free_subst_patterns(macro->params);
+    free(macro->expanded);
     free(macro->name);
     free(macro);
 }
@@ -41,25 +46,13 @@ char *trim_strip_brackets(const char *s) {
         return trim;
     }
 }
-        
-// Argument sorting compare function
-int replacement_compare(const void *a, const void *b) {
-    struct replacement *ra = (struct replacement *)a;
-    struct replacement *rb = (struct replacement *)b;
-    
-    // Sort by length of argument to replace, descending
-    size_t ralen = strlen(ra->old);
-    size_t rblen = strlen(rb->old);
-    
-    return (ralen<rblen) - (ralen>rblen);
-}
 
 
 // Expand a macro, given the invocation on the given line
 struct line *expand_macro(struct line *invocation, struct maclist *macros, struct line **last) {
-    struct replacement replacements[MACRO_ARG_MAX + 1];
+    char *values[MACRO_ARG_MAX + 1];
+    size_t lengths[MACRO_ARG_MAX + 1], size;
     char expansion_id[EXPANSION_ID_MAX_LEN] = {'\0'};
-    char *tmp;
     char *new_line; 
     char error = FALSE, cur_error = FALSE;
     char errstr[128] = {'\0'};
@@ -79,7 +72,6 @@ struct line *expand_macro(struct line *invocation, struct maclist *macros, struc
     }
     
     int i, n_argmts = invocation->n_argmts;
-    const struct argmt *mac_argptr = macro->header->argmts;
     const struct argmt *inv_argptr = invocation->argmts;
     
     // Check arguments 
@@ -89,14 +81,16 @@ struct line *expand_macro(struct line *invocation, struct maclist *macros, struc
     }
     
     // Set up expansion ID
-    replacements[0].old = "@";
-    replacements[0].new = expansion_id;
+    values[0] = expansion_id;
     if (snprintf(expansion_id, EXPANSION_ID_MAX_LEN, EXPANSION_TEMPLATE, macro->name, ++macro->expansions) 
             >= EXPANSION_ID_MAX_LEN) {
         FATAL_ERROR("Maximum length exceeded for unique macro expansion identifier.\n"
                     EXPANSION_TEMPLATE, macro->name, macro->expansions);
     }
     
+    // The expansion ends where assembly continues after the invocation
+    trace_begin_until(invocation->next_line, "macro", macro->name, invocation, "expansion", macro->expansions);
+    
     // Make error string
     strncpy(errstr, invocation->info.filename, 127);
     char *file_ends = strchr(errstr, ':');
@@ -107,32 +101,28 @@ struct line *expand_macro(struct line *invocation, struct maclist *macros, struc
     for (i=1; i<=n_argmts; i++) {
         
         // sanity check
-        if (mac_argptr == NULL) FATAL_ERROR("internal error: mac_argptr == NULL");
         if (inv_argptr == NULL) FATAL_ERROR("internal error: inv_argptr == NULL");
         
-        // "old" = "!" + trim(arg)
-        tmp = trim_string(mac_argptr->raw_text);
-        replacements[i].old = join_strings(MACRO_ARG_PFX, tmp);
-        free(tmp);
-        
-        // "new" = input string, trimmed and with braces removed if there are any
-        replacements[i].new = trim_strip_brackets(inv_argptr->raw_text);
+        // input string, trimmed and with braces removed if there are any
+        values[i] = trim_strip_brackets(inv_argptr->raw_text);
         
-        // advance argument pointers
+        // advance argument pointer
         inv_argptr = inv_argptr->next_argmt;
-        mac_argptr = mac_argptr->next_argmt;
     }
-       
-    // Sort the arguments by length descending (so that e.g. "!foo" isn't replaced before "!foobar"),
-    // but leave '#' in the first position alone.
-    qsort(&replacements[1], n_argmts, sizeof(struct replacement), replacement_compare);
+    for (i=0; i<=n_argmts; i++) lengths[i] = strlen(values[i]);
     
     // Process each line in turn
     line_prev = NULL;
     start_line = NULL;
-    for (line_mac=macro->body; line_mac != NULL; line_mac=line_mac->next_line) {
-        // Macro argument substitution
-        new_line = string_replace(line_mac->raw_text, replacements, n_argmts+1);
+    for (i=0, line_mac=macro->body; line_mac != NULL; i++, line_mac=line_mac->next_line) {
+        // Macro argument substitution, into the macro's buffer
+        size = subst_size(macro->templates[i], lengths);
+        if (size > macro->expanded_size) {
+            macro->expanded_size = size;
+            macro->expanded = realloc(macro->expanded, size);
+            if (macro->expanded == NULL) FATAL_ERROR("failed to allocate memory for macro expansion");
+        }
+        new_line = subst_apply(macro->templates[i], (const char *const *) values, lengths, macro->expanded);
         cur_error = FALSE;
         line_cur = parse_line_part(TRUE, new_line, line_prev, errstr, &cur_error);
         if (line_prev == NULL) line_cur->info.lineno = line_mac->info.lineno;
@@ -141,12 +131,13 @@ struct line *expand_macro(struct line *invocation, struct maclist *macros, struc
             fprintf(stderr, "expanded line: %s\n", new_line);
             error = TRUE;
         }
-        free(new_line);
         if (start_line == NULL) {
             start_line = line_cur;
         }
         line_prev = line_cur;
     }
+    
+    for (i=1; i<=n_argmts; i++) free(values[i]);
       
     if (error) {
         // Free the created lines and return NULL
@@ -219,6 +210,27 @@ struct macro *define_macro(const struct line *definition, const struct line **en
             prev_copy->next_line = copy;
         }
         prev_copy = copy;
+        macro->n_lines++;
+    }
+    
+    /* find where '@' and the arguments ("#" + trimmed name) are used in the body */
+    char *params[MACRO_ARG_MAX + 1], *tmp;
+    const struct argmt *argmt = definition->argmts;
+    int i, n_params = definition->n_argmts + 1;
+    
+    params[0] = "@";
+    for (i=1; i<n_params; i++, argmt=argmt->next_argmt) {
+        tmp = trim_string(argmt->raw_text);
+        params[i] = join_strings(MACRO_ARG_PFX, tmp);
+        free(tmp);
+    }
+    macro->params = make_subst_patterns((const char *const *) params, n_params);
+    for (i=1; i<n_params; i++) free(params[i]);
+    
+    macro->templates = malloc(sizeof(struct subst_template *) * (macro->n_lines + 1));
+    if (macro->templates == NULL) FATAL_ERROR("failed to allocate memory for macro");
+    for (i=0, copy=macro->body; copy != NULL; i++, copy=copy->next_line) {
+        macro->templates[i] = make_subst_template(copy->raw_text, macro->params);
     }
         
     return macro;
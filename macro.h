@@ -23,6 +23,16 @@ struct macro {
     unsigned int expansions;
     struct line *header;
     struct line *body;
+    
+    // The body lines, ready for substitution. Replacement 0 is the expansion ID ('@'),
+    // and the arguments follow in order.
+    struct subst_patterns *params;
+    struct subst_template **templates;
+    int n_lines;
+    
+    // Space for an expanded line
+    char *expanded;
+    size_t expanded_size;
 };
 
 // Keep track of macros
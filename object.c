@@ -0,0 +1,414 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "object.h"
+
+/* Writing objects */
+
+// Does an expression depend on names (or on '$'), so that the linker has to evaluate it again?
+static int needs_fixup(const struct parsed_expr *expr) {
+    const struct token_stack_node *n;
+    for (n = expr->start; n != NULL; n = n->next) {
+        if (n->token->type == NAME) return TRUE;
+    }
+    return FALSE;
+}
+
+// Write the location of an expression, followed by the expression itself
+static void write_expr(FILE *f, const struct line *line, const struct argmt *argmt) {
+    char *text = trim_string(argmt->raw_text);
+    const char *base = argmt->data.expr->basename;
+    fprintf(f, "%s\t%d\t%s\t%d\t%s\n", line->info.filename, line->info.lineno,
+            base == NULL ? "-" : base, line->location, text);
+    free(text);
+}
+
+// Write a fixup record if the expression needs one
+static void write_fixup(FILE *f, const struct line *line, const struct argmt *argmt, int offset, int width) {
+    if (!needs_fixup(argmt->data.expr)) return;
+    fprintf(f, "fixup\t%d\t%d\t", offset, width);
+    write_expr(f, line, argmt);
+}
+
+int write_object(FILE *f, struct asmstate *state, const struct line *lines, const char *module) {
+    const struct line *line;
+    const struct argmt *argmt;
+    const struct variable *v;
+    unsigned char *mem;
+    size_t size, i;
+    int origin = 0, offset = 0, ok = TRUE;
+    intptr_t value;
+    char *name;
+
+    // The code itself
+    if ((mem = malloc(65536)) == NULL) FATAL_ERROR("could not allocate memory for object");
+    size = make_binary(lines, mem);
+    for (line = lines; line != NULL; line = line->next_line) {
+        if (line->n_bytes != 0) { origin = line->location; break; }
+    }
+
+    fprintf(f, OBJ_MAGIC "\n");
+    fprintf(f, "module\t%s\n", module);
+    fprintf(f, "origin\t%d\n", origin);
+    fprintf(f, "size\t%zu\n", size);
+    for (i = 0; i < size; i++) {
+        if (i % OBJ_DATA_PER_LINE == 0) fprintf(f, "%sdata\t%zu\t", i ? "\n" : "", i);
+        fprintf(f, "%02X", mem[i]);
+    }
+    if (size) fprintf(f, "\n");
+    free(mem);
+
+    // Imported and exported names
+    for (v = state->externs->variables; v != NULL; v = v->next) {
+        fprintf(f, "extern\t%s\n", v->name);
+    }
+    for (v = state->publics->variables; v != NULL; v = v->next) {
+        if (!get_var(state->knowns, v->name, &value) && !get_var(state->unknowns, v->name, &value)) {
+            error_on_line((const struct line *) v->value, "public: name is not defined: %s", v->name);
+            ok = FALSE;
+        }
+        fprintf(f, "public\t%s\n", v->name);
+    }
+
+    for (line = lines; line != NULL; offset += line->n_bytes, line = line->next_line) {
+        // Labels are stored relative to the origin, 'equ's as their expressions
+        if (line->label != NULL && line->instr.type != MACRO) {
+            struct varspace vs = temp_rename(state->knowns, line->info.lastlabel);
+            name = add_base(&vs, line->label);
+            if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_equ) {
+                fprintf(f, "equ\t%s\t", name);
+                write_expr(f, line, line->argmts);
+            } else if (get_var(state->knowns, name, &value)) {
+                fprintf(f, "label\t%s\t%d\n", name, (int) value);
+            }
+            free(name);
+        }
+
+        // Expressions that depend on names need to be evaluated again by the linker
+        argmt = line->argmts;
+        if (line->instr.type == OPCODE && line->n_bytes > 1) {
+            // An immediate value is always the last argument
+            while (argmt->next_argmt != NULL) argmt = argmt->next_argmt;
+            write_fixup(f, line, argmt, offset + 1, line->n_bytes - 1);
+        } else if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_db) {
+            for (i = offset; argmt != NULL; argmt = argmt->next_argmt) {
+                if (argmt->type == STRING) {
+                    i += strlen(argmt->data.string);
+                } else {
+                    write_fixup(f, line, argmt, i++, 1);
+                }
+            }
+        } else if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_dw) {
+            for (i = offset; argmt != NULL; argmt = argmt->next_argmt, i += 2) {
+                write_fixup(f, line, argmt, i, 2);
+            }
+        } else if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_assert
+                && !contains_functions(argmt->data.expr)) {
+            // (an assertion about the code itself has already been checked)
+            fprintf(f, "assert\t");
+            write_expr(f, line, argmt);
+            if (argmt->next_argmt != NULL) fprintf(f, "message\t%s\n", argmt->next_argmt->data.string);
+        }
+    }
+
+    fprintf(f, "end\n");
+    return ok;
+}
+
+/* Reading objects */
+
+// Split a line into tab-separated fields. The last field gets the rest of the line.
+static int split_fields(char *s, char **fields, int max) {
+    int n = 0;
+    char *tab;
+
+    s[strcspn(s, "\r\n")] = '\0';
+    while (n < max) {
+        fields[n++] = s;
+        if (n == max || (tab = strchr(s, '\t')) == NULL) break;
+        *tab = '\0';
+        s = tab + 1;
+    }
+    return n;
+}
+
+// Make an expression record from the fields: file, line, basename, location, expression
+static struct objexpr *read_expr(char **fields) {
+    struct objexpr *e = calloc(1, sizeof(struct objexpr));
+    if (e == NULL) FATAL_ERROR("could not allocate memory for object expression");
+
+    e->info.filename = copy_string(fields[0]);
+    e->info.lineno = atoi(fields[1]);
+    e->info.lastlabel = strcmp(fields[2], "-") ? copy_string(fields[2]) : NULL;
+    e->location = atoi(fields[3]);
+    e->expr = parse_expr(fields[4], &e->info);
+    return e;
+}
+
+static void free_objexprs(struct objexpr *e) {
+    struct objexpr *next;
+    for (; e != NULL; e = next) {
+        next = e->next;
+        free(e->name);
+        free(e->message);
+        free(e->info.filename);
+        free(e->info.lastlabel);
+        free_parsed_expr(e->expr);
+        free(e);
+    }
+}
+
+void free_objmodules(struct objmodule *m) {
+    struct objmodule *next;
+    for (; m != NULL; m = next) {
+        next = m->next;
+        free(m->filename);
+        free(m->name);
+        free(m->data);
+        free_varspace(m->labels);
+        free_varspace(m->externs);
+        free_varspace(m->publics);
+        if (m->locals) free_varspace(m->locals);
+        free_objexprs(m->equs);
+        free_objexprs(m->fixups);
+        free_objexprs(m->asserts);
+        free(m);
+    }
+}
+
+#define OBJ_ERROR(msg, ...) do { \
+    fprintf(stderr, "%s: line %d: " msg "\n", filename, lineno, ##__VA_ARGS__); \
+    goto error; \
+} while(0)
+
+struct objmodule *read_object(const char *filename) {
+    char buf[OBJ_LINE_SIZE], *fields[8], *p;
+    struct objexpr *e, **equ_tail, **fixup_tail, **assert_tail, *last_assert = NULL;
+    int lineno = 0, n, offset, done = FALSE;
+    size_t len;
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "%s: cannot open: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    struct objmodule *m = calloc(1, sizeof(struct objmodule));
+    if (m == NULL) FATAL_ERROR("could not allocate memory for module");
+    m->filename = copy_string(filename);
+    m->labels = alloc_varspace();
+    m->externs = alloc_varspace();
+    m->publics = alloc_varspace();
+    equ_tail = &m->equs;
+    fixup_tail = &m->fixups;
+    assert_tail = &m->asserts;
+
+    if (fgets(buf, OBJ_LINE_SIZE, f) == NULL || strncmp(buf, OBJ_MAGIC, strlen(OBJ_MAGIC))) {
+        fprintf(stderr, "%s: not an asm8085 object file\n", filename);
+        goto error;
+    }
+    lineno++;
+
+    while (!done && fgets(buf, OBJ_LINE_SIZE, f) != NULL) {
+        lineno++;
+        n = split_fields(buf, fields, 8);
+        e = NULL;
+
+        if (!strcmp(fields[0], "module") && n == 2) {
+            m->name = copy_string(fields[1]);
+        } else if (!strcmp(fields[0], "origin") && n == 2) {
+            m->origin = atoi(fields[1]);
+        } else if (!strcmp(fields[0], "size") && n == 2) {
+            m->size = atoi(fields[1]);
+            if (m->size < 0 || m->size > 65536) OBJ_ERROR("invalid size: %d", m->size);
+            if ((m->data = calloc(m->size + 1, 1)) == NULL) FATAL_ERROR("could not allocate memory for module");
+        } else if (!strcmp(fields[0], "data") && n == 3) {
+            offset = atoi(fields[1]);
+            len = strlen(fields[2]) / 2;
+            if (m->data == NULL || offset < 0 || offset + len > (size_t) m->size) OBJ_ERROR("data out of range");
+            for (p = fields[2]; len--; p += 2) {
+                if (sscanf(p, "%2hhx", &m->data[offset++]) != 1) OBJ_ERROR("invalid data");
+            }
+        } else if (!strcmp(fields[0], "extern") && n == 2) {
+            set_var(m->externs, fields[1], 0);
+        } else if (!strcmp(fields[0], "public") && n == 2) {
+            set_var(m->publics, fields[1], 0);
+        } else if (!strcmp(fields[0], "label") && n == 3) {
+            set_var(m->labels, fields[1], atoi(fields[2]));
+        } else if (!strcmp(fields[0], "equ") && n == 7) {
+            e = read_expr(fields + 2);
+            e->name = copy_string(fields[1]);
+            *equ_tail = e;
+            equ_tail = &e->next;
+        } else if (!strcmp(fields[0], "fixup") && n == 8) {
+            e = read_expr(fields + 3);
+            e->offset = atoi(fields[1]);
+            e->width = atoi(fields[2]);
+            *fixup_tail = e;
+            fixup_tail = &e->next;
+            if ((e->width != 1 && e->width != 2) || e->offset < 0 || e->offset + e->width > m->size)
+                OBJ_ERROR("fixup out of range");
+        } else if (!strcmp(fields[0], "assert") && n == 6) {
+            e = last_assert = read_expr(fields + 1);
+            e->message = copy_string(fields[5]); // without a message, show the expression
+            *assert_tail = e;
+            assert_tail = &e->next;
+        } else if (!strcmp(fields[0], "message") && n == 2 && last_assert != NULL) {
+            free(last_assert->message);
+            last_assert->message = copy_string(fields[1]);
+        } else if (!strcmp(fields[0], "end") && n == 1) {
+            done = TRUE;
+        } else {
+            OBJ_ERROR("invalid record: %s", fields[0]);
+        }
+
+        if (e != NULL && e->expr == NULL) OBJ_ERROR("invalid expression");
+    }
+
+    if (!done || m->name == NULL || m->data == NULL) OBJ_ERROR("object file is incomplete");
+
+    fclose(f);
+    return m;
+
+error:
+    fclose(f);
+    free_objmodules(m);
+    return NULL;
+}
+
+#undef OBJ_ERROR
+
+/* Linking */
+
+#define LINK_ERROR(e, msg, ...) \
+    fprintf(stderr, "%s: line %d: " msg "\n", (e)->info.filename, (e)->info.lineno, ##__VA_ARGS__)
+
+// Evaluate an expression as seen from within a module
+static int eval_in_module(const struct objmodule *m, const struct objexpr *e, intptr_t *result) {
+    struct varspace vs = temp_rename(m->locals, e->expr->basename);
+    if (contains_undefined_names(e->expr, &vs)) return FALSE;
+    *result = eval_expr(e->expr, m->locals, &e->info, e->location + m->base - m->origin);
+    return TRUE;
+}
+
+int link_objects(struct objmodule *modules, int base, unsigned char *buf, size_t *size) {
+    struct objmodule *m;
+    struct objexpr *e;
+    struct variable *v;
+    struct varspace *globals = alloc_varspace(), *owners = alloc_varspace();
+    intptr_t value, owner;
+    int loc = base, progress, ok = TRUE;
+    unsigned char *pos;
+
+    // Place the modules one after another
+    for (m = modules; m != NULL; m = m->next) {
+        m->base = loc;
+        loc += m->size;
+        if (loc > 65536) {
+            fprintf(stderr, "%s: module does not fit in memory at %04X\n", m->filename, m->base);
+            ok = FALSE;
+            goto done;
+        }
+        memcpy(buf + (m->base - base), m->data, m->size);
+
+        // Every name may only be exported once
+        for (v = m->publics->variables; v != NULL; v = v->next) {
+            if (get_var(owners, v->name, &owner)) {
+                fprintf(stderr, "%s: public name also defined in %s: %s\n",
+                        m->filename, ((struct objmodule *) owner)->filename, v->name);
+                ok = FALSE;
+            }
+            set_var(owners, v->name, (intptr_t) m);
+        }
+
+        // Relocate the labels
+        if (m->locals) free_varspace(m->locals);
+        m->locals = alloc_varspace();
+        for (v = m->labels->variables; v != NULL; v = v->next) {
+            set_var(m->locals, v->name, v->value + m->base - m->origin);
+        }
+        for (e = m->equs; e != NULL; e = e->next) e->resolved = FALSE;
+    }
+    if (!ok) goto done;
+
+    // Resolve the 'equ's and the names passed between modules, until nothing more changes
+    do {
+        progress = FALSE;
+        for (m = modules; m != NULL; m = m->next) {
+            for (v = m->externs->variables; v != NULL; v = v->next) {
+                if (get_var(m->locals, v->name, &value) || !get_var(globals, v->name, &value)) continue;
+                set_var(m->locals, v->name, value);
+                progress = TRUE;
+            }
+            for (e = m->equs; e != NULL; e = e->next) {
+                if (e->resolved || !eval_in_module(m, e, &value)) continue;
+                set_var(m->locals, e->name, value);
+                e->resolved = progress = TRUE;
+            }
+            for (v = m->publics->variables; v != NULL; v = v->next) {
+                if (get_var(globals, v->name, &value) || !get_var(m->locals, v->name, &value)) continue;
+                set_var(globals, v->name, value);
+                progress = TRUE;
+            }
+        }
+    } while (progress);
+
+    // Everything should now be known
+    for (m = modules; m != NULL; m = m->next) {
+        for (v = m->externs->variables; v != NULL; v = v->next) {
+            if (!get_var(m->locals, v->name, &value)) {
+                fprintf(stderr, "%s: undefined external name: %s\n", m->filename, v->name);
+                ok = FALSE;
+            }
+        }
+        for (e = m->equs; e != NULL; e = e->next) {
+            if (!e->resolved) {
+                LINK_ERROR(e, "cannot resolve: %s", e->name);
+                ok = FALSE;
+            }
+        }
+    }
+    if (!ok) goto done;
+
+    // Fill in the fixups
+    for (m = modules; m != NULL; m = m->next) {
+        for (e = m->fixups; e != NULL; e = e->next) {
+            if (!eval_in_module(m, e, &value)) {
+                LINK_ERROR(e, "undefined name in expression");
+                ok = FALSE;
+                continue;
+            }
+
+            pos = buf + (m->base - base) + e->offset;
+            if (e->width == 1) {
+                if (value < -128 || value > 255) {
+                    LINK_ERROR(e, "warning: result does not fit in byte, will be truncated");
+                }
+                *pos = (unsigned char) value;
+            } else {
+                if (value < -32768 || value > 65535) {
+                    LINK_ERROR(e, "warning: result does not fit in word, will be truncated");
+                }
+                *pos++ = (unsigned char) (value & 0xFF);
+                *pos = (unsigned char) (value >> 8);
+            }
+        }
+
+        // Check the assertions, now that all locations are final
+        for (e = m->asserts; e != NULL; e = e->next) {
+            if (!eval_in_module(m, e, &value)) {
+                LINK_ERROR(e, "undefined name in assertion");
+                ok = FALSE;
+            } else if (!value) {
+                LINK_ERROR(e, "assertion failed: %s", e->message);
+                ok = FALSE;
+            }
+        }
+    }
+
+    *size = loc - base;
+
+done:
+    free_varspace(globals);
+    free_varspace(owners);
+    return ok;
+}
@@ -0,0 +1,61 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * object.h: write relocatable object files, and link them together
+ */
+
+#ifndef __OBJECT_H__
+#define __OBJECT_H__
+
+#include <stdio.h>
+
+#include "util.h"
+#include "assembler.h"
+#include "bin_output.h"
+
+#define OBJ_MAGIC "asm8085-object\t1"
+#define OBJ_LINE_SIZE 4096
+#define OBJ_DATA_PER_LINE 32
+
+// An expression that the linker has to evaluate
+struct objexpr {
+    struct objexpr *next;
+    char *name;         // name being defined (for 'equ')
+    char *message;      // message (for 'assert'), or NULL
+    struct lineinfo info;
+    struct parsed_expr *expr;
+    int location;       // value of '$', relative to the module origin
+    int offset, width;  // where to store the result (for fixups)
+    char resolved;
+};
+
+// A module read from an object file
+struct objmodule {
+    struct objmodule *next;
+    char *filename;     // object file
+    char *name;         // module (source file) name
+    int origin, size;   // origin and size of the module's code
+    int base;           // where the linker has placed it
+    unsigned char *data;
+
+    struct varspace *labels;  // labels, relative to the origin
+    struct varspace *externs; // imported names
+    struct varspace *publics; // exported names
+    struct varspace *locals;  // all names as known to the module, once linked
+
+    struct objexpr *equs, *fixups, *asserts;
+};
+
+// Write the assembled lines as an object. Returns FALSE on error.
+int write_object(FILE *f, struct asmstate *state, const struct line *lines, const char *module);
+
+// Read an object file. Returns NULL on error.
+struct objmodule *read_object(const char *filename);
+
+// Free a list of modules
+void free_objmodules(struct objmodule *modules);
+
+// Place the modules one after another starting at base, and resolve all names between them.
+// The result is stored in buf (which must be at least 64K). Returns FALSE on error.
+int link_objects(struct objmodule *modules, int base, unsigned char *buf, size_t *size);
+
+#endif
@@ -0,0 +1,165 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "opcode_table.h"
+
+static struct opcode_info opcode_table[] = {
+    #define _OP(op, is8080, _) { #op, is8080, AK_NONE, 0, {0} },
+    #include "instructions.h"
+};
+
+// T-states for each opcode (see instructions.h)
+struct op_timing {
+    unsigned char t8080, t8085;
+    unsigned char m8080, m8085;
+    unsigned char taken8080, taken8085;
+};
+
+static const struct op_timing timings[] = {
+    #define _TIME(op, t8080, t8085, m8080, m8085, taken8080, taken8085) \
+        [OP_##op] = { t8080, t8085, m8080, m8085, taken8080, taken8085 },
+    #include "instructions.h"
+};
+
+// T-states per opcode byte
+static struct cycles cycles_8080[256], cycles_8085[256];
+
+// Opcode for each opcode byte, or -1 if the CPU does not have it
+static int decode_8080[256], decode_8085[256];
+
+static char table_built = FALSE;
+
+// Each specification is run for all its possible arguments, giving the opcode byte for each.
+#define ARG_NONE(val) { \
+    info->kind = AK_NONE; info->len = 1; \
+    info->enc[0] = (val); \
+}
+
+#define ARG_IMM(n, val) { \
+    info->kind = AK_IMM; info->len = 1 + (n); \
+    info->enc[0] = (val); \
+}
+
+#define ARG_3CONST(val) { \
+    int v; \
+    info->kind = AK_3CONST; info->len = 1; \
+    for (v = 0; v < 8; v++) info->enc[v] = (val); \
+}
+
+#define ARG_R(val) { \
+    int r; \
+    info->kind = AK_R; info->len = 1; \
+    for (r = RB; r <= RA; r++) info->enc[r] = (val); \
+}
+
+#define ARG_RP(val) { \
+    int rp; \
+    info->kind = AK_RP; info->len = 1; \
+    for (rp = RPB; rp <= RPSP; rp++) info->enc[rp] = (val); \
+}
+
+#define ARG_R8(val) { \
+    int r; \
+    info->kind = AK_R8; info->len = 2; \
+    for (r = RB; r <= RA; r++) info->enc[r] = (val); \
+}
+
+#define ARG_RP16(val) { \
+    int rp; \
+    info->kind = AK_RP16; info->len = 3; \
+    for (rp = RPB; rp <= RPSP; rp++) info->enc[rp] = (val); \
+}
+
+#define ARG_DS(val) { \
+    int d, s; \
+    info->kind = AK_DS; info->len = 1; \
+    for (d = RB; d <= RA; d++) for (s = RB; s <= RA; s++) info->enc[d<<3 | s] = (val); \
+}
+
+// Set the T-states for one encoding of an opcode
+static void set_cycles(struct cycles *c, int states, int mem_states, int taken, char mem) {
+    if (mem && mem_states) states = mem_states;
+    c->states = states;
+    c->taken = taken ? taken : states;
+}
+
+int n_encodings(const struct opcode_info *info) {
+    switch (info->kind) {
+        case AK_3CONST: case AK_R: case AK_R8: return 8;
+        case AK_RP: case AK_RP16: return 4;
+        case AK_DS: return 64;
+        default: return 1;
+    }
+}
+
+// Work out which opcode each byte is. The first encoding of an opcode always claims its byte,
+// so that 'hlt' wins from 'mov m,m' and 'lhld' from 'ldax h'; other encodings only claim
+// bytes that are still free.
+static void build_decode() {
+    const struct opcode_info *info;
+    int op, arg, byte;
+    
+    for (byte = 0; byte < 256; byte++) decode_8080[byte] = decode_8085[byte] = -1;
+    
+    for (op = 0; op < (int) (sizeof(opcode_table)/sizeof(*opcode_table)); op++) {
+        info = &opcode_table[op];
+        for (arg = 0; arg < n_encodings(info); arg++) {
+            byte = info->enc[arg];
+            if (info->is8080 && (arg == 0 || decode_8080[byte] < 0)) decode_8080[byte] = op;
+            if (arg == 0 || decode_8085[byte] < 0) decode_8085[byte] = op;
+        }
+    }
+}
+
+// Work out the T-states for every opcode byte, from the encodings
+static void build_cycles() {
+    const struct opcode_info *info;
+    const struct op_timing *t;
+    int op, arg;
+    char mem;
+    
+    for (op = 0; op < (int) (sizeof(timings)/sizeof(*timings)); op++) {
+        info = &opcode_table[op];
+        t = &timings[op];
+        
+        for (arg = 0; arg < n_encodings(info); arg++) {
+            switch (info->kind) {
+                case AK_R: case AK_R8: mem = arg == RM; break;
+                case AK_DS: mem = (arg >> 3) == RM || (arg & 7) == RM; break;
+                default: mem = FALSE;
+            }
+            
+            if (decode_8080[info->enc[arg]] == op) {
+                set_cycles(&cycles_8080[info->enc[arg]], t->t8080, t->m8080, t->taken8080, mem);
+            }
+            if (decode_8085[info->enc[arg]] == op) {
+                set_cycles(&cycles_8085[info->enc[arg]], t->t8085, t->m8085, t->taken8085, mem);
+            }
+        }
+    }
+}
+
+static void build_table() {
+    struct opcode_info *info = opcode_table;
+    
+    #define _OP(op, is8080, spec) spec; info++;
+    #include "instructions.h"
+    
+    build_decode();
+    build_cycles();
+    table_built = TRUE;
+}
+
+const struct opcode_info *get_opcode_info(enum opcode op) {
+    if (!table_built) build_table();
+    return &opcode_table[op];
+}
+
+int decode_opcode(unsigned char byte, int cpu) {
+    if (!table_built) build_table();
+    return cpu == 8080 ? decode_8080[byte] : decode_8085[byte];
+}
+
+const struct cycles *get_cycles(unsigned char byte, int cpu) {
+    if (!table_built) build_table();
+    return cpu == 8080 ? &cycles_8080[byte] : &cycles_8085[byte];
+}
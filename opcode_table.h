@@ -0,0 +1,46 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * opcode_table.h: opcode encodings, worked out from the ARG_* specifications
+ * in instructions.h for every possible register argument, and how many
+ * T-states each opcode takes on the 8080 and the 8085
+ */
+
+#ifndef __OPCODE_TABLE_H__
+#define __OPCODE_TABLE_H__
+
+#include "util.h"
+#include "parser_types.h"
+
+// The kind of arguments an opcode takes (the ARG_* specification it uses)
+enum arg_kind { AK_NONE, AK_IMM, AK_3CONST, AK_R, AK_RP, AK_R8, AK_RP16, AK_DS };
+
+struct opcode_info {
+    const char *name;
+    char is8080;
+    enum arg_kind kind;
+    int len;                // length of the instruction in bytes
+    unsigned char enc[64];  // opcode byte, indexed by the argument (d<<3|s for two registers)
+};
+
+// T-states taken by one instruction. For a conditional jump, call or return, 'states' is
+// the time taken when the condition does not hold, and 'taken' when it does; for anything
+// else they are the same. Both are 0 for an opcode byte the CPU does not have.
+struct cycles {
+    int states;
+    int taken;
+};
+
+// Get the encoding information for an opcode
+const struct opcode_info *get_opcode_info(enum opcode op);
+
+// Get the number of encodings an opcode has (the valid indices into enc[])
+int n_encodings(const struct opcode_info *info);
+
+// Get the opcode an opcode byte stands for on the given CPU (8080 or 8085), or -1 if the
+// CPU does not have it
+int decode_opcode(unsigned char byte, int cpu);
+
+// Get the T-states for an opcode byte on the given CPU (8080 or 8085)
+const struct cycles *get_cycles(unsigned char byte, int cpu);
+
+#endif
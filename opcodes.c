@@ -76,8 +76,8 @@ void alloc_line_bytes(struct line *line, size_t amt) {
     /* Instruction consists of opcode + (byte) argument */ \
     alloc_line_bytes(line, 1 + (len)); \
     line->bytes[0] = (val); \
-    /* The expression needs to be evaluated at the end */ \
-    line->needs_process = TRUE; \
+    /* Unless it is constant, the expression needs to be evaluated at the end */ \
+    line->needs_process = !store_constant(line->argmts, line->bytes + 1, (len)); \
 }
 
 // Opcode, register + immediate 8-bit argument
@@ -95,8 +95,8 @@ void alloc_line_bytes(struct line *line, size_t amt) {
     /* Instruction consists of opcode + 1-byte immediate argument */ \
     alloc_line_bytes(line, 2); \
     line->bytes[0] = (val); \
-    /* The expression needs to be evaluated at the end */ \
-    line->needs_process = TRUE; \
+    /* Unless it is constant, the expression needs to be evaluated at the end */ \
+    line->needs_process = !store_constant(exp_a, line->bytes + 1, 1); \
 }
 
 // Opcode, register pair + immediate 16-bit argument
@@ -114,8 +114,8 @@ void alloc_line_bytes(struct line *line, size_t amt) {
     /* Instruction consists of opcode + 2-byte immediate argument */ \
     alloc_line_bytes(line, 3); \
     line->bytes[0] = (val); \
-    /* The expression needs to be evaluated at the end */ \
-    line->needs_process = TRUE; \
+    /* Unless it is constant, the expression needs to be evaluated at the end */ \
+    line->needs_process = !store_constant(exp_a, line->bytes + 1, 2); \
 }
 
 // Two registers (destination and source, for MOV) 
@@ -15,10 +15,19 @@
 #define _KWD(kwd)
 #endif
 
+#ifndef _FN
+#define _FN(fn, argsn)
+#endif
+
 // keywords
 _KWD(high)
 _KWD(low)
 
+// functions (which take their arguments in brackets, separated by commas), valence
+_FN(cycles,    2)
+_FN(mincycles, 2)
+_FN(stackdepth, 1)
+
 // operator,name,precedence,valence
 _OPR(!=,NE,       4,2)
 _OPR(!, BOOL_NOT, 9,1)
@@ -45,3 +54,4 @@ _OPR(|, OR,       3,2)
 
 #undef _OPR
 #undef _KWD
+#undef _FN
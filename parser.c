@@ -7,6 +7,17 @@
 
 #define PARSE_ERROR "%s: line %d: parse error: "
 
+#define THREADED_READ_SIZE (2*1024*1024) // about 100k lines
+#define MAX_READ_THREADS 8
+
+// A file that is being read in parts
+struct line_reader {
+    FILE *file;
+    char *filename;
+    int part_size;
+    int depth; // how deep in macro, repeat or if blocks the last line was
+};
+
 // Print an error message given line info
 static void parse_error_line(FILE *file, const struct lineinfo *info, const char *message, ...) {
     char buffer[1024];
@@ -22,7 +33,9 @@ void free_argmt(struct argmt *argmt) {
     struct argmt *next;
     while(argmt != NULL) {
         next = argmt->next_argmt;
-        free(argmt->raw_text);
+        if (!argmt->shared_text) free(argmt->raw_text);
+        if (argmt->parsed && argmt->type == EXPRESSION) free_parsed_expr(argmt->data.expr);
+        if (argmt->parsed && argmt->type == STRING) free(argmt->data.string);
         free(argmt);
         argmt = next;
     }
@@ -38,6 +51,28 @@ void free_line_mem(struct line *line) {
     if(line->instr.text) free(line->instr.text);
     if(line->argmts) free_argmt(line->argmts);
     if(line->bytes) free(line->bytes);
+    if(line->reader) {
+        fclose(line->reader->file);
+        free(line->reader->filename);
+        free(line->reader);
+    }
+}
+
+/* Free the text and the arguments of a line */
+void free_line_text(struct line *line) {
+    free(line->raw_text);
+    free(line->label);
+    free(line->info.filename);
+    free(line->info.lastlabel);
+    free(line->instr.text);
+    free_argmt(line->argmts);
+    line->raw_text = NULL;
+    line->label = NULL;
+    line->info.filename = NULL;
+    line->info.lastlabel = NULL;
+    line->instr.text = NULL;
+    line->argmts = NULL;
+    line->n_argmts = 0;
 }
 
 /* Free a line, recursively if needed (i.e. free all the following lines too). 
@@ -48,31 +83,40 @@ struct line *free_line(struct line *line, char recursive) {
     do { 
         next = line->next_line;
         free_line_mem(line);
+        free(line);
         line = next; 
     } while (next != NULL && recursive);
     
     return next;
 }
 
-/* Read a file, parsing the lines as it goes. 
+/* Keep track of how deep in macro, repeat and if blocks a line is */
+static int block_depth(const struct line *line, int depth) {
+    if (line->instr.type != DIRECTIVE) return depth;
+    switch (line->instr.instr) {
+        case DIR_macro: case DIR_repeat: case DIR_if: case DIR_ifdef: case DIR_ifndef: case DIR_section:
+            return depth + 1;
+        case DIR_endm: case DIR_endr: case DIR_endif: case DIR_endsection:
+            return depth - 1;
+        default:
+            return depth;
+    }
+}
+
+/* Read lines from a file, and parse them, after 'prev' (which may be NULL). 
+ * If 'reader' is given, stop at the end of a part. Returns the last line read,
+ * or 'prev' if there were no lines. 
  */
-struct line *read_file(const char *filename) {
-    
-    char error = FALSE;
-    
-    struct line *begin = NULL, *prev = NULL, *cur = NULL;
-    struct line *parse_first = NULL;
-    int idx;
+static struct line *read_lines(FILE *file, const char *filename, struct line_reader *reader,
+                               struct line *prev, struct line **begin, char *error) {
+    struct line *cur = prev, *part;
+    int idx, n_lines = 0;
     char line_buf[LINE_BUF_SIZE];
-    FILE *file = fopen(filename, "r");
-    
-    if (!file) {
-        fprintf(stderr, "%s: cannot open file: %s\n", filename, strerror(errno));
-        return NULL;
-    }
-    
     
     while (!feof(file)) {
+        // Stop at the end of a part
+        if (reader && n_lines >= reader->part_size && reader->depth <= 0) break;
+        
         // Read a line      
         if (fgets(line_buf, LINE_BUF_SIZE, file) == NULL) break; // no more characters left
         idx = strlen(line_buf);
@@ -83,14 +127,194 @@ struct line *read_file(const char *filename) {
         
         // Parse the line
         prev = cur; 
-        cur = parse_line(line_buf, prev, filename, &error, &parse_first);
+        cur = scan_line(line_buf, prev, filename, error, begin);
         if (cur == NULL) {
             FATAL_ERROR("failed to allocate memory for line");
-        } else if (prev == NULL) {
-            begin = parse_first;
+        }
+        n_lines++;
+        
+        if (reader) {
+            for (part = prev ? prev->next_line : *begin; part != NULL; part = part->next_line) {
+                reader->depth = block_depth(part, reader->depth);
+            }
         }
     }
     
+    return cur;
+}
+
+// A piece of a file that is scanned by one thread
+struct read_chunk {
+    const char *start, *end;
+    const char *filename;
+    struct line *begin, *last;
+    int n_lines; // number of lines read, as counted by the line numbers
+    char error;
+};
+
+/* Scan the lines in a chunk. The text is split into lines the same way fgets()
+ * splits it in read_lines(), and the chunk is numbered as if it were a file by itself. */
+static void *scan_chunk(void *arg) {
+    struct read_chunk *chunk = arg;
+    const char *ptr = chunk->start, *newline;
+    char line_buf[LINE_BUF_SIZE];
+    struct line *cur = NULL;
+    size_t length;
+    int idx;
+    
+    while (ptr < chunk->end) {
+        // Take as much as fgets() would
+        length = chunk->end - ptr;
+        if (length > LINE_BUF_SIZE - 1) length = LINE_BUF_SIZE - 1;
+        if ((newline = memchr(ptr, '\n', length)) != NULL) length = newline - ptr + 1;
+        memcpy(line_buf, ptr, length);
+        line_buf[length] = '\0';
+        ptr += length;
+        
+        // remove '(\r)\n' from end
+        idx = strlen(line_buf);
+        if (idx > 0 && line_buf[idx-1] == '\n') line_buf[idx-1] = '\0';
+        if (idx > 1 && line_buf[idx-2] == '\r') line_buf[idx-2] = '\0';
+        
+        cur = scan_line(line_buf, cur, chunk->filename, &chunk->error, &chunk->begin);
+        if (cur == NULL) {
+            FATAL_ERROR("failed to allocate memory for line");
+        }
+        chunk->n_lines++;
+    }
+    
+    chunk->last = cur;
+    return NULL;
+}
+
+/* Link the scanned chunks together. Each chunk's line numbers are moved past the
+ * ones before it, and its lines up to its first top-level label get the last label
+ * of the chunk before. */
+static struct line *join_chunks(struct read_chunk *chunks, int n_chunks) {
+    struct line *begin = NULL, *prev = NULL, *line;
+    int i, base = 0;
+    char own_label;
+    
+    for (i=0; i<n_chunks; i++) {
+        if (chunks[i].begin == NULL) continue;
+        
+        if (prev == NULL) {
+            begin = chunks[i].begin;
+        } else {
+            own_label = FALSE;
+            for (line = chunks[i].begin; line != NULL; line = line->next_line) {
+                line->info.lineno += base;
+                if (!own_label) own_label = line->label != NULL && line->label[0] != '.';
+                if (!own_label) {
+                    free(line->info.lastlabel);
+                    line->info.lastlabel = copy_string(prev->info.lastlabel);
+                }
+            }
+            prev->next_line = chunks[i].begin;
+        }
+        
+        base += chunks[i].n_lines;
+        prev = chunks[i].last;
+    }
+    
+    return begin;
+}
+
+/* Map a file into memory, and scan it in chunks on several threads. If the file
+ * cannot be mapped, it is read line by line instead. */
+static void read_mapped(FILE *file, const char *filename, int n_threads, struct line **begin, char *error) {
+    struct read_chunk chunks[MAX_READ_THREADS];
+    pthread_t threads[MAX_READ_THREADS];
+    char started[MAX_READ_THREADS];
+    const char *data, *end, *split, *newline;
+    struct stat st;
+    int i;
+    
+    if (fstat(fileno(file), &st) == -1 || st.st_size == 0
+     || (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0)) == MAP_FAILED) {
+        read_lines(file, filename, NULL, NULL, begin, error);
+        return;
+    }
+    end = data + st.st_size;
+    
+    // Split the file at line boundaries
+    memset(chunks, 0, sizeof(chunks));
+    for (i=0; i<n_threads; i++) {
+        chunks[i].start = i ? chunks[i-1].end : data;
+        chunks[i].filename = filename;
+        
+        split = data + (size_t) st.st_size * (i+1) / n_threads;
+        if (split < chunks[i].start) split = chunks[i].start;
+        if (split < end && (newline = memchr(split, '\n', end - split)) != NULL) {
+            chunks[i].end = newline + 1;
+        } else {
+            chunks[i].end = end;
+        }
+    }
+    
+    // Scan the first chunk on this thread, and the others (if possible) on their own
+    for (i=1; i<n_threads; i++) {
+        started[i] = !pthread_create(&threads[i], NULL, scan_chunk, &chunks[i]);
+    }
+    scan_chunk(&chunks[0]);
+    for (i=1; i<n_threads; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        else scan_chunk(&chunks[i]);
+    }
+    
+    munmap((void *) data, st.st_size);
+    
+    for (i=0; i<n_threads; i++) *error |= chunks[i].error;
+    *begin = join_chunks(chunks, n_threads);
+}
+
+/* Decide how many threads to read a file with */
+static int read_threads(FILE *file) {
+    struct stat st;
+    long n_cpus;
+    
+    if (fstat(fileno(file), &st) == -1 || st.st_size < THREADED_READ_SIZE) return 1;
+    
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_cpus < 1) return 1;
+    return n_cpus > MAX_READ_THREADS ? MAX_READ_THREADS : n_cpus;
+}
+
+/* Read a file, parsing the lines as it goes. 
+ * A server may already have the file parsed, in which case it is copied.
+ */
+struct line *read_file(const char *filename) {
+    struct line *lines = filecache_get(filename);
+    if (lines == NULL) return read_file_threads(filename, 0);
+    
+    deps_add(filename);
+    return lines;
+}
+
+/* Read a file using the given number of threads */
+struct line *read_file_threads(const char *filename, int n_threads) {
+    
+    char error = FALSE;
+    
+    struct line *begin = NULL;
+    FILE *file = fopen(filename, "r");
+    
+    if (!file) {
+        fprintf(stderr, "%s: cannot open file: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    deps_add(filename);
+    
+    if (n_threads == 0) n_threads = read_threads(file);
+    if (n_threads > MAX_READ_THREADS) n_threads = MAX_READ_THREADS;
+    
+    if (n_threads > 1) {
+        read_mapped(file, filename, n_threads, &begin, &error);
+    } else {
+        read_lines(file, filename, NULL, NULL, &begin, &error);
+    }
+    fclose(file);
+    
     if (error) {
         fprintf(stderr, "%s: there were errors parsing the file.\n", filename);
         free_line(begin, TRUE);
@@ -101,6 +325,83 @@ struct line *read_file(const char *filename) {
 
 }
 
+/* If there is more of the file to read, add the line that will read it after 'last'.
+ * Otherwise, the reader is done with. */
+static void add_reader_line(struct line_reader *reader, struct line *last) {
+    char error = FALSE;
+    struct line *marker;
+    
+    if (feof(reader->file)) {
+        fclose(reader->file);
+        free(reader->filename);
+        free(reader);
+    } else {
+        // The marker continues the numbering of the last line read
+        marker = parse_line_part(FALSE, "", last, reader->filename, &error);
+        marker->reader = reader;
+    }
+}
+
+/* Read a file in parts */
+struct line *read_file_part(const char *filename, int part_size) {
+    char error = FALSE;
+    struct line *begin = NULL, *last;
+    struct line_reader *reader;
+    FILE *file = fopen(filename, "r");
+    
+    if (!file) {
+        fprintf(stderr, "%s: cannot open file: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    deps_add(filename);
+    
+    if ((reader = malloc(sizeof(struct line_reader))) == NULL) {
+        FATAL_ERROR("failed to allocate memory for line reader");
+    }
+    reader->file = file;
+    reader->filename = copy_string(filename);
+    reader->part_size = part_size;
+    reader->depth = 0;
+    
+    last = read_lines(file, filename, reader, NULL, &begin, &error);
+    
+    if (error || begin == NULL) {
+        if (error) fprintf(stderr, "%s: there were errors parsing the file.\n", filename);
+        if (begin) free_line(begin, TRUE);
+        fclose(file);
+        free(reader->filename);
+        free(reader);
+        return NULL;
+    }
+    
+    add_reader_line(reader, last);
+    return begin;
+}
+
+/* Read the next part of a file */
+int read_more(struct line *marker) {
+    char error = FALSE;
+    struct line *begin = NULL, *last, *next = marker->next_line;
+    struct line_reader *reader = marker->reader;
+    
+    marker->reader = NULL;
+    last = read_lines(reader->file, reader->filename, reader, marker, &begin, &error);
+    
+    if (error) {
+        fprintf(stderr, "%s: there were errors parsing the file.\n", reader->filename);
+        marker->reader = reader;
+        return FALSE;
+    }
+    
+    // Put the new lines in between the marker and whatever came after the file
+    add_reader_line(reader, last);
+    if (begin == NULL) return TRUE;
+    while (last->next_line != NULL) last = last->next_line;
+    last->next_line = next;
+    
+    return TRUE;
+}
+
 /* label ends with space or ':' */
 int isLabelEnd(int ch) {
     return ch==':' || isspace(ch);
@@ -165,52 +466,57 @@ const char *parse_instruction(struct line *l, const char *ptr) {
     return ptr;
 }
    
-/* Parse the arguments (split on commas that aren't in brackets or strings) */
+/* Register and register pair names. An argument consisting only of one of these
+ * points into this table instead of getting its own copy. */
+static const char *reg_names[] = {
+    "a", "b", "c", "d", "e", "h", "l", "m", "sp", "psw",
+    "A", "B", "C", "D", "E", "H", "L", "M", "SP", "PSW", NULL
+};
+
+static const char *shared_reg_name(const char *begin, const char *end) {
+    const char **name;
+    size_t length = end - begin;
+    if (length == 0 || length > 3) return NULL;
+    for (name = reg_names; *name; name++) {
+        if (strlen(*name) == length && !strncmp(*name, begin, length)) return *name;
+    }
+    return NULL;
+}
+
+/* Parse the arguments (split on commas that aren't in brackets or strings).
+ * The line is scanned in place; memory is only allocated for arguments that aren't
+ * plain register names. */
+// Characters that can end an argument or change how the rest of it is read
+static const struct charset argmt_stops = { 7, ",()\"'`\\" };
+
 void parse_arguments(struct line *l, const char *ptr, char *error) {
-    char *parse_buf = NULL, strdelim=0;
-    int bracket_depth = 0, length = 0;
+    char strdelim;
+    int bracket_depth;
+    const char *begin, *end, *name;
     struct argmt *prev = NULL, *cur = NULL;
-    int parse_buf_size = LINE_BUF_SIZE;
   
     l->n_argmts = 0;
     l->argmts = NULL;
         
-    if (!*ptr) {
-        // There are no arguments.
-        return;
-    } else {
-        parse_buf = malloc(parse_buf_size);
-        if (parse_buf == NULL) FATAL_ERROR("malloc() failed");
-    }
-    
     while (*ptr) {
         // Scan until nonwhitespace is reached.
         while (*ptr && isspace(*ptr)) ptr++;
         if (!*ptr) break;
         
-        // Copy until ',' or end-of-string is reached, or the buffer is full.
-        length = 0;
+        // Scan until ',' or end-of-string is reached.
+        begin = ptr;
         bracket_depth = 0;
         strdelim = '\0';
         
-        while (*ptr && !(bracket_depth == 0 && strdelim == 0 && *ptr == ',')) {
-            // add more memory if necessary
-            if (length >= parse_buf_size-1) {
-                parse_buf_size *= 2;
-                parse_buf = realloc(parse_buf, parse_buf_size);
-                if (parse_buf == NULL) FATAL_ERROR("realloc() failed");
-            }
-            
-            parse_buf[length++] = *ptr;
-            
+        while (*(ptr = scan_charset(ptr, &argmt_stops)) && !(bracket_depth == 0 && strdelim == 0 && *ptr == ',')) {
             // Check for string begin and end
             if (!strdelim && (*ptr == '"' || *ptr == '\'' || *ptr == '`')) {
                 strdelim = *ptr;
             } else if (strdelim && *ptr == strdelim) {
                 strdelim = 0;
-            } else if (*ptr == '\\') {
+            } else if (*ptr == '\\' && ptr[1]) {
                 // Handle escaped chracter string delimiter
-                parse_buf[length++] = *++ptr;
+                ptr++;
             }
             
             // Handle brackets     
@@ -230,8 +536,6 @@ void parse_arguments(struct line *l, const char *ptr, char *error) {
             parse_error_line(stderr, &l->info, "non-terminated string.");
             *error = 1;
         } else {
-            parse_buf[length] = '\0';
-                        
             // It's OK, so store the current argument.
             prev = cur;
             
@@ -251,7 +555,14 @@ void parse_arguments(struct line *l, const char *ptr, char *error) {
             // There is one more argument than before.
             l->n_argmts++;
 
-            cur->raw_text = copy_string(parse_buf);
+            // Registers share their text, anything else gets a copy
+            for (end = ptr; end > begin && isspace(end[-1]); end--);
+            if ((name = shared_reg_name(begin, end)) != NULL) {
+                cur->raw_text = (char *) name;
+                cur->shared_text = TRUE;
+            } else {
+                cur->raw_text = copy_string_part(begin, ptr);
+            }
             cur->parsed = FALSE;
             cur->next_argmt = NULL; 
         }
@@ -259,15 +570,22 @@ void parse_arguments(struct line *l, const char *ptr, char *error) {
         // Skip over the ',' we might be on.
         if (*ptr == ',') ptr++;
     }
-
-    free(parse_buf);
 }
 
 /* Find the first given character on a line that isn't in a string. 
  * Returns location if one was found. */
 char *find_char(char *ptr, char ch) {
+    // Only the character, quotes and backslashes matter
+    static const struct charset comment_stops = { 4, ";\"'\\" }, split_stops = { 4, "!\"'\\" };
+    struct charset other_stops = { 3, "\"'\\" };
+    const struct charset *stops = &other_stops;
     char strdelim;
-    for (strdelim='\0'; *ptr; ptr++) {  
+    
+    if (ch == ';') stops = &comment_stops;
+    else if (ch == '!') stops = &split_stops;
+    else charset_add(&other_stops, ch);
+    
+    for (strdelim='\0'; *(ptr = (char *) scan_charset(ptr, stops)); ptr++) {  
         if (!strdelim) {
             // Not in string. 
             
@@ -298,19 +616,23 @@ int splitNext(char ch) {
         
 }
                 
-/* Parse a line. */
-struct line *parse_line(const char *text_in, 
-                        struct line *prev, 
-                        const char *filename, 
-                        char *error, 
-                        struct line **begin) {
+static struct line *make_line_part(char lazy, char line_start, const char *text, struct line *prev, 
+                                   const char *filename, char *error);
+
+/* Split a line on '!', and parse or scan each part. */
+static struct line *split_line(char lazy,
+                               const char *text_in, 
+                               struct line *prev, 
+                               const char *filename, 
+                               char *error, 
+                               struct line **begin) {
                             
     char *text = copy_string(text_in);
     // find comment and temporarily terminate the string there
     char *comment = find_char(text, ';');
     if (comment == text || *text == '\0') {
         // line is empty or starts with comment, return empty line
-        struct line *l = parse_line_part(TRUE, text, prev, filename, error);
+        struct line *l = make_line_part(lazy, TRUE, text, prev, filename, error);
         if (*begin == NULL) *begin = l;
         free(text);
         return l;
@@ -334,12 +656,12 @@ struct line *parse_line(const char *text_in,
         if (next == NULL) {
             // include comment in last part
             if (comment != NULL) *comment = ';';
-            prev = parse_line_part(first, cur, prev, filename, error); 
+            prev = make_line_part(lazy, first, cur, prev, filename, error); 
             if (*begin == NULL) *begin = prev;
         } else {
             // temporarily terminate string and extract part
             *next = '\0';
-            prev = parse_line_part(first, cur, prev, filename, error);
+            prev = make_line_part(lazy, first, cur, prev, filename, error);
             if (*begin == NULL) *begin = prev;
             first = FALSE;
             // restore and skip the split character
@@ -351,8 +673,86 @@ struct line *parse_line(const char *text_in,
     free(text);
     return prev;
 }    
+
+/* Parse a line. */
+struct line *parse_line(const char *text, struct line *prev, const char *filename, char *error, struct line **begin) {
+    return split_line(FALSE, text, prev, filename, error, begin);
+}
+
+/* Scan a line, leaving most of the parsing for later */
+struct line *scan_line(const char *text, struct line *prev, const char *filename, char *error, struct line **begin) {
+    return split_line(TRUE, text, prev, filename, error, begin);
+}
+
+/* See if a line's instruction is a directive, without copying it. 
+ * The structure of the file (macros, ifs and repeats) can be found from these alone. */
+static void scan_instruction(struct line *l, const char *ptr) {
+    char word[16];
+    size_t length = 0;
+    
+    while (ptr[length] && !isspace(ptr[length]) && length < sizeof(word)) length++;
+    
+    l->instr.type = NONE;
+    l->instr.instr = -1;
+    l->instr.text = NULL;
+    if (length == sizeof(word)) return; // too long to be a directive
+    
+    memcpy(word, ptr, length);
+    word[length] = '\0';
+    if ((l->instr.instr = dir_from_str(word)) != -1) {
+        l->instr.type = DIRECTIVE;
+    } else if (!strcmp(word, "=")) {
+        l->instr.type = DIRECTIVE;
+        l->instr.instr = DIR_equ;
+    }
+}
+
+/* Finish parsing a scanned line */
+int finish_line(struct line *l) {
+    char error = FALSE;
+    char *comment;
+    const char *parse_ptr;
+    
+    if (!l->pending) return TRUE;
+    l->pending = FALSE;
     
+    comment = find_char(l->raw_text + l->pending_at, ';');
+    if (comment != NULL) *comment = '\0';
+    
+    parse_ptr = parse_instruction(l, l->raw_text + l->pending_at);
+    parse_arguments(l, parse_ptr, &error);
+    
+    if (comment) *comment = ';';
+    return !error;
+}
+
+int replace_instruction(struct line *l, const char *text, const char *note) {
+    char error = FALSE;
+    const char *label = l->label ? l->label : "";
+    size_t size = strlen(label) + strlen(text) + strlen(note) + 4;
+    
+    free(l->instr.text);
+    free_argmt(l->argmts);
+    free(l->raw_text);
+    
+    if ((l->raw_text = malloc(size)) == NULL) FATAL_ERROR("failed to allocate memory for line");
+    snprintf(l->raw_text, size, "%s\t%s\t;%s", label, text, note);
+    
+    // Only the instruction is parsed, so the note is cut off while that is done
+    l->raw_text[strlen(label) + 1 + strlen(text)] = '\0';
+    parse_arguments(l, parse_instruction(l, l->raw_text + strlen(label) + 1), &error);
+    l->raw_text[strlen(label) + 1 + strlen(text)] = '\t';
+    
+    l->pending = FALSE;
+    return !error;
+}
+
 struct line *parse_line_part(char line_start, const char *text, struct line *prev, const char *filename, char *error) {
+    return make_line_part(FALSE, line_start, text, prev, filename, error);
+}
+
+static struct line *make_line_part(char lazy, char line_start, const char *text, struct line *prev, 
+                                   const char *filename, char *error) {
     char *comment;
     const char *parse_ptr;
     struct line *l = calloc(1, sizeof(struct line));
@@ -378,10 +778,17 @@ struct line *parse_line_part(char line_start, const char *text, struct line *pre
     if (comment != NULL) *comment = '\0';
     l->info.filename = copy_string(filename);
     
-    // Parse the three parts of the line
+    // Parse the three parts of the line (or, if lazy, only as much as is needed
+    // to find the structure of the file)
     parse_ptr = parse_label(l);
-    parse_ptr = parse_instruction(l, parse_ptr);
-    parse_arguments(l, parse_ptr, error);
+    if (lazy && *parse_ptr) {
+        scan_instruction(l, parse_ptr);
+        l->pending = TRUE;
+        l->pending_at = parse_ptr - l->raw_text;
+    } else {
+        parse_ptr = parse_instruction(l, parse_ptr);
+        parse_arguments(l, parse_ptr, error);
+    }
     
     //fprintf(stderr, "[%s],[%d],[%d],[%d]<-%s\n", l->label, l->instr.type, l->instr.instr, l->n_argmts, l->raw_text);
     
@@ -411,27 +818,43 @@ enum directive dir_from_str(const char *s) {
 }
 
 
+/* Check if a word (ignoring surrounding whitespace) is the given lowercase name */
+static int is_name(const char *t, const char *name) {
+    while (*t && isspace(*t)) t++;
+    for (; *name; t++, name++) {
+        if (tolower(*t) != *name) return FALSE;
+    }
+    while (*t && isspace(*t)) t++;
+    return *t == '\0';
+}
+
 /* Parse a register */
 enum reg_e parse_reg(const char *t) {
-    if (!strcasecmp("a",t)) return RA; 
-    if (!strcasecmp("b",t)) return RB;
-    if (!strcasecmp("c",t)) return RC;
-    if (!strcasecmp("d",t)) return RD;
-    if (!strcasecmp("e",t)) return RE;
-    if (!strcasecmp("h",t)) return RH;
-    if (!strcasecmp("l",t)) return RL;
-    if (!strcasecmp("m",t)) return RM;
+    while (*t && isspace(*t)) t++;
+    switch (tolower(*t)) {
+        case 'a': return is_name(t, "a") ? RA : R_INV;
+        case 'b': return is_name(t, "b") ? RB : R_INV;
+        case 'c': return is_name(t, "c") ? RC : R_INV;
+        case 'd': return is_name(t, "d") ? RD : R_INV;
+        case 'e': return is_name(t, "e") ? RE : R_INV;
+        case 'h': return is_name(t, "h") ? RH : R_INV;
+        case 'l': return is_name(t, "l") ? RL : R_INV;
+        case 'm': return is_name(t, "m") ? RM : R_INV;
+    }
    
     return R_INV;
 }
 
 /* Parse a register pair */
 enum reg_pair parse_reg_pair(const char *t) {
-    if (!strcasecmp("b",t))   return RPB;
-    if (!strcasecmp("d",t))   return RPD;  
-    if (!strcasecmp("h",t))   return RPH;  
-    if (!strcasecmp("sp",t))  return RPSP; 
-    if (!strcasecmp("psw",t)) return RPSP; // SP and PSW use the same encoding
+    while (*t && isspace(*t)) t++;
+    switch (tolower(*t)) {
+        case 'b': return is_name(t, "b") ? RPB : RP_INV;
+        case 'd': return is_name(t, "d") ? RPD : RP_INV;
+        case 'h': return is_name(t, "h") ? RPH : RP_INV;
+        case 's': return is_name(t, "sp") ? RPSP : RP_INV;
+        case 'p': return is_name(t, "psw") ? RPSP : RP_INV; // SP and PSW use the same encoding
+    }
     
     return RP_INV;
 }
@@ -526,13 +949,15 @@ error:
 
 /* Parse an argument */
 char parse_argmt(enum argmt_type types, struct argmt *argmt, const struct lineinfo *info) {
-    char *s = trim_string(argmt->raw_text);
+    char *s = NULL;
     char success = TRUE;
     
     switch ((int) types) {
+        // Registers are recognized straight from the argument text
         case REGISTER:
-            argmt->data.reg = parse_reg(s);
+            argmt->data.reg = parse_reg(argmt->raw_text);
             if (argmt->data.reg == R_INV) {
+                s = trim_string(argmt->raw_text);
                 parse_error_line(stderr, info, "invalid register: %s; expected a, b, c, d, e, f, h, l, or m.", s); 
                 success = FALSE; 
             } else {
@@ -541,8 +966,9 @@ char parse_argmt(enum argmt_type types, struct argmt *argmt, const struct linein
             break;
             
         case REGPAIR:
-            argmt->data.reg_pair = parse_reg_pair(s);
+            argmt->data.reg_pair = parse_reg_pair(argmt->raw_text);
             if (argmt->data.reg_pair == RP_INV) {
+                s = trim_string(argmt->raw_text);
                 parse_error_line(stderr, info, "invalid register pair: %s; expected b, d, h, sp or psw.", s);
                 success = FALSE;
             } else {
@@ -552,6 +978,7 @@ char parse_argmt(enum argmt_type types, struct argmt *argmt, const struct linein
         
         case STRING:
         case (STRING | EXPRESSION):
+            s = trim_string(argmt->raw_text);
             argmt->data.string = parse_str(s);
             if (argmt->data.string != NULL) {
                 argmt->type = STRING;
@@ -568,6 +995,7 @@ char parse_argmt(enum argmt_type types, struct argmt *argmt, const struct linein
             // below extra comment is needed verbatim to shut up new warning
             // fall through
         case EXPRESSION:
+            if (s == NULL) s = trim_string(argmt->raw_text);
             argmt->data.expr = parse_expr(s, info); // This prints its own error messages if needed
             if (argmt->data.expr != NULL) {
                 argmt->type = EXPRESSION;
@@ -5,10 +5,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "parser_types.h"
 #include "expression.h"
+#include "deps.h"
+#include "filecache.h"
 
 /* Get the opcode number for s. Returns -1 if not a valid operator. */
 enum opcode op_from_str(const char *s);
@@ -16,23 +22,57 @@ enum opcode op_from_str(const char *s);
 /* Get the directive number for s. Returns -1 if not a valid operator. */
 enum directive dir_from_str(const char *s);
 
-/* Read a file, parsing the lines as it goes. 
+/* Read a file, scanning the lines as it goes. Each line must be finished
+ * with finish_line() before it is assembled.
  *
  * Returns NULL if the file cannot be opened or if there was a parse error. 
  */
 struct line *read_file(const char *filename);
 
+/* Read a file like read_file(), scanning it in chunks on up to 'n_threads' threads.
+ * If 'n_threads' is 0, large files (over about 100k lines) use one thread per CPU, 
+ * and smaller files are read on one thread. The lines are the same either way.
+ */
+struct line *read_file_threads(const char *filename, int n_threads);
+
+/* Read a file in parts of at least 'part_size' lines. A part only ends outside of
+ * macro, repeat and if blocks. Unless the whole file has been read, the last line of
+ * the part is an empty line with 'reader' set; read_more() will read the next part. 
+ *
+ * Returns NULL if the file cannot be opened or if there was a parse error. 
+ */
+struct line *read_file_part(const char *filename, int part_size);
+
+/* Read the next part of a file, and insert it after 'marker'. Returns FALSE on error. */
+int read_more(struct line *marker);
+
 /* Free a line, recursively if needed (i.e. free all the following lines too). 
  * When freeing only one line, the next line is returned; otherwise NULL is returned.
  */
 struct line *free_line(struct line *line, char recursive);
 
+/* Free the text and the arguments of a line, keeping only what is needed to output
+ * it (its location and bytes). */
+void free_line_text(struct line *line);
+
 /* Parse a line */
 struct line *parse_line(const char *text, struct line *prev, const char *filename, char *error, struct line **begin);
 
 /* Parse a partial line (without ! marks). */
 struct line *parse_line_part(char line_start, const char *text, struct line *prev, const char *filename, char *error);
 
+/* Scan a line: like parse_line(), but only the labels and directives are parsed.
+ * The rest is left to finish_line(). */
+struct line *scan_line(const char *text, struct line *prev, const char *filename, char *error, struct line **begin);
+
+/* Finish parsing a scanned line. Returns FALSE if there was a parse error. */
+int finish_line(struct line *line);
+
+/* Replace the instruction and arguments of a (finished) line; the label stays. The new text
+ * is what the line shows in a listing, with the note as a comment. Returns FALSE if there
+ * was a parse error. */
+int replace_instruction(struct line *line, const char *text, const char *note);
+
 /* Parse a register */
 enum reg_e parse_reg(const char *text);
 
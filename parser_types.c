@@ -40,7 +40,8 @@ struct argmt *copy_argmt(const struct argmt *argmt) {
     if (copy == NULL) FATAL_ERROR("failed to allocate memory for copy of argmt");
     
     copy->next_argmt = NULL;
-    copy->raw_text = copy_string(argmt->raw_text);
+    copy->shared_text = argmt->shared_text;
+    copy->raw_text = argmt->shared_text ? argmt->raw_text : copy_string(argmt->raw_text);
     copy->parsed = argmt->parsed;
     
     // If the argument has already been parsed, copy over the parsed data
@@ -94,6 +95,7 @@ struct line *copy_line(const struct line *line) {
     copy->info.lineno = line->info.lineno;
     copy->info.filename = copy_string(line->info.filename);
     copy->info.lastlabel = copy_string(line->info.lastlabel);
+    copy->expansion = line->expansion;
     copy->next_line = NULL;
     
     copy->label = line->label == NULL ? NULL : copy_string(line->label);
@@ -108,6 +110,9 @@ struct line *copy_line(const struct line *line) {
     copy->n_argmts = line->n_argmts;
     copy->argmts = copy_argmt_list(line->argmts);
     
+    copy->pending = line->pending;
+    copy->pending_at = line->pending_at;
+    
     return copy;
 }
     
@@ -39,6 +39,7 @@ struct argmt {
     
     char parsed;            /* True if the argument has already been parsed */
     char *raw_text; 
+    char shared_text;       /* True if raw_text points to a static register name */
 
     enum argmt_type type;
     union {
@@ -78,6 +79,14 @@ struct line {
     int needs_process;
     int location;
     int cpu; /* 8080 or 8085 mode */
+    int expansion; /* The macro expansion the line came from (numbered from 1), or 0 */
+    
+    struct line_reader *reader; /* Set on the empty line where the rest of a file is to be read */
+    
+    /* A line that has only been scanned has its label, and its instruction if it is a
+     * directive. finish_line() parses the instruction and arguments starting at raw_text+pending_at. */
+    char pending;
+    int pending_at;
     
 };
 
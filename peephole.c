@@ -0,0 +1,207 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "peephole.h"
+#include "opcode_table.h"
+
+// How many lines ahead to look to see if the flags are still needed
+#define FLAGS_LOOKAHEAD 16
+
+// The documented flags
+#define FL_S  0x01
+#define FL_Z  0x02
+#define FL_AC 0x04
+#define FL_P  0x08
+#define FL_CY 0x10
+#define FL_ALL (FL_S | FL_Z | FL_AC | FL_P | FL_CY)
+
+// How an opcode uses the flags. If 'jumps' is set, the code may go on elsewhere.
+struct flag_use {
+    unsigned char reads, writes, jumps;
+};
+
+static const struct flag_use flag_uses[] = {
+    [OP_add] = {0, FL_ALL, 0}, [OP_adi] = {0, FL_ALL, 0},
+    [OP_sub] = {0, FL_ALL, 0}, [OP_sui] = {0, FL_ALL, 0},
+    [OP_ana] = {0, FL_ALL, 0}, [OP_ani] = {0, FL_ALL, 0},
+    [OP_ora] = {0, FL_ALL, 0}, [OP_ori] = {0, FL_ALL, 0},
+    [OP_xra] = {0, FL_ALL, 0}, [OP_xri] = {0, FL_ALL, 0},
+    [OP_cmp] = {0, FL_ALL, 0}, [OP_cpi] = {0, FL_ALL, 0},
+    [OP_dsub] = {0, FL_ALL, 0},
+    [OP_adc] = {FL_CY, FL_ALL, 0}, [OP_aci] = {FL_CY, FL_ALL, 0},
+    [OP_sbb] = {FL_CY, FL_ALL, 0}, [OP_sbi] = {FL_CY, FL_ALL, 0},
+    [OP_daa] = {FL_CY | FL_AC, FL_ALL, 0},
+    [OP_inr] = {0, FL_S | FL_Z | FL_AC | FL_P, 0}, [OP_dcr] = {0, FL_S | FL_Z | FL_AC | FL_P, 0},
+    [OP_rlc] = {0, FL_CY, 0}, [OP_rrc] = {0, FL_CY, 0}, [OP_stc] = {0, FL_CY, 0},
+    [OP_dad] = {0, FL_CY, 0}, [OP_arhl] = {0, FL_CY, 0},
+    [OP_ral] = {FL_CY, FL_CY, 0}, [OP_rar] = {FL_CY, FL_CY, 0},
+    [OP_cmc] = {FL_CY, FL_CY, 0}, [OP_rdel] = {FL_CY, FL_CY, 0},
+    [OP_jnz] = {FL_Z, 0, 1}, [OP_jz] = {FL_Z, 0, 1}, [OP_jnc] = {FL_CY, 0, 1}, [OP_jc] = {FL_CY, 0, 1},
+    [OP_jpo] = {FL_P, 0, 1}, [OP_jpe] = {FL_P, 0, 1}, [OP_jp] = {FL_S, 0, 1}, [OP_jm] = {FL_S, 0, 1},
+    [OP_cnz] = {FL_Z, 0, 1}, [OP_cz] = {FL_Z, 0, 1}, [OP_cnc] = {FL_CY, 0, 1}, [OP_cc] = {FL_CY, 0, 1},
+    [OP_cpo] = {FL_P, 0, 1}, [OP_cpe] = {FL_P, 0, 1}, [OP_cp] = {FL_S, 0, 1}, [OP_cm] = {FL_S, 0, 1},
+    [OP_rnz] = {FL_Z, 0, 1}, [OP_rz] = {FL_Z, 0, 1}, [OP_rnc] = {FL_CY, 0, 1}, [OP_rc] = {FL_CY, 0, 1},
+    [OP_rpo] = {FL_P, 0, 1}, [OP_rpe] = {FL_P, 0, 1}, [OP_rp] = {FL_S, 0, 1}, [OP_rm] = {FL_S, 0, 1},
+    [OP_jk] = {FL_ALL, 0, 1}, [OP_jnk] = {FL_ALL, 0, 1}, [OP_rstv] = {FL_ALL, 0, 1},
+    [OP_jmp] = {0, 0, 1}, [OP_call] = {0, 0, 1}, [OP_ret] = {0, 0, 1},
+    [OP_pchl] = {0, 0, 1}, [OP_rst] = {0, 0, 1}, [OP_hlt] = {0, 0, 1},
+    // (push and pop only use the flags with psw, see below)
+    [OP_push] = {FL_ALL, 0, 0}, [OP_pop] = {0, FL_ALL, 0},
+};
+
+// Get the next line that has a label or an instruction, finishing it if it is still pending.
+// Returns NULL if there is none (or it has not been read yet), and sets error if the line
+// cannot be parsed.
+static struct line *next_line(struct line *line, int *error) {
+    for (line = line->next_line; line != NULL; line = line->next_line) {
+        if (line->reader != NULL) return NULL; // the rest of the file is only read later
+        if (!finish_line(line)) {
+            *error = TRUE;
+            return NULL;
+        }
+        if (line->label != NULL || line->instr.type != NONE) return line;
+    }
+    return NULL;
+}
+
+// See if an argument is a constant zero (it is not evaluated, as names are not known yet).
+// Returns -1 if it is not a valid expression. The argument is left unparsed, so that
+// the opcode handler can parse it as usual.
+static int is_zero(struct argmt *argmt, const struct lineinfo *info) {
+    int value, zero;
+    
+    if (!parse_argmt(EXPRESSION, argmt, info)) return -1;
+    zero = expr_constant(argmt->data.expr, &value) && value == 0;
+    
+    free_parsed_expr(argmt->data.expr);
+    argmt->parsed = FALSE;
+    return zero;
+}
+
+// See if the flags that are set by a line are no longer needed after it. This is only
+// so if they are all set again before anything looks at them, without passing a label.
+static int flags_dead(struct line *line, int *error) {
+    const struct flag_use *use;
+    int live = FL_ALL, n;
+    
+    for (n = 0; n < FLAGS_LOOKAHEAD && (line = next_line(line, error)) != NULL; n++) {
+        if (line->label != NULL || line->instr.type != OPCODE) return FALSE;
+        
+        use = &flag_uses[line->instr.instr];
+        // push and pop only touch the flags when they are given psw
+        if ((line->instr.instr == OP_push || line->instr.instr == OP_pop)
+         && (line->n_argmts != 1 || parse_reg_pair(line->argmts->raw_text) != RPPSW)) continue;
+        
+        if ((use->reads & live) || use->jumps) return FALSE;
+        live &= ~use->writes;
+        if (!live) return TRUE;
+    }
+    
+    return FALSE;
+}
+
+// T-states for one encoding of an opcode
+static int states(const struct asmstate *state, enum opcode op, int arg) {
+    return get_cycles(get_opcode_info(op)->enc[arg], state->cpu)->states;
+}
+
+// Rewrite a line, and count what it saves
+static int rewrite(struct asmstate *state, struct line *line, const char *text, const char *note, 
+                   int bytes, int saved_states) {
+    if (!replace_instruction(line, text, note)) return -1;
+    state->saved_bytes += bytes;
+    state->saved_states += saved_states;
+    return TRUE;
+}
+
+/* The rules. Each one returns TRUE if it has rewritten the code, FALSE if it does not
+ * apply, or -1 on error. A rule may look at the lines after the one it is given, but
+ * only if they have no labels, so that no other code can get there. */
+
+// mvi a,0 -> xra a (if the flags it changes are not needed)
+static int rule_zero_a(struct asmstate *state, struct line *line) {
+    int error = FALSE, zero;
+    
+    if (line->instr.instr != OP_mvi || line->n_argmts != 2) return FALSE;
+    if (parse_reg(line->argmts->raw_text) != RA) return FALSE;
+    if ((zero = is_zero(line->argmts->next_argmt, &line->info)) != TRUE) return zero;
+    if (!flags_dead(line, &error)) return error ? -1 : FALSE;
+    
+    return rewrite(state, line, "xra\ta", " -O: was mvi a,0", 1, states(state, OP_mvi, RA) - states(state, OP_xra, RA));
+}
+
+// call x / ret -> jmp x
+static int rule_tail_call(struct asmstate *state, struct line *line) {
+    struct line *ret;
+    char *text;
+    int error = FALSE, ok;
+    
+    if (line->instr.instr != OP_call || line->n_argmts != 1) return FALSE;
+    if ((ret = next_line(line, &error)) == NULL) return error ? -1 : FALSE;
+    if (ret->label != NULL || ret->instr.type != OPCODE || ret->instr.instr != OP_ret) return FALSE;
+    
+    text = join_strings("jmp\t", line->argmts->raw_text);
+    ok = rewrite(state, line, text, " -O: was call, ret", 0, 0) == TRUE
+      && rewrite(state, ret, "", " -O: ret (merged into the jmp above)", 1,
+            states(state, OP_call, 0) + states(state, OP_ret, 0) - states(state, OP_jmp, 0)) == TRUE;
+    free(text);
+    return ok ? TRUE : -1;
+}
+
+// jmp x, where x is the next line -> nothing
+static int rule_jump_next(struct asmstate *state, struct line *line) {
+    struct line *next = line;
+    char *target;
+    int error = FALSE, found = FALSE, new_base = FALSE;
+    
+    if (line->instr.instr != OP_jmp || line->n_argmts != 1) return FALSE;
+    target = trim_string(line->argmts->raw_text);
+    
+    // The target can be any of the labels before the next instruction (but a local
+    // label only if it is still in the same scope)
+    while (!found && (next = next_line(next, &error)) != NULL) {
+        if (next->instr.type != NONE && next->instr.type != OPCODE) break;
+        if (next->label != NULL) {
+            if (!strcmp(next->label, target) && (target[0] != '.' || !new_base)) found = TRUE;
+            if (next->label[0] != '.') new_base = TRUE;
+        }
+        if (next->instr.type == OPCODE) break;
+    }
+    
+    free(target);
+    if (error) return -1;
+    if (!found) return FALSE;
+    return rewrite(state, line, "", " -O: jmp to the next line", 3, states(state, OP_jmp, 0));
+}
+
+// mov r,r -> nothing
+static int rule_self_move(struct asmstate *state, struct line *line) {
+    enum reg_e reg;
+    
+    if (line->instr.instr != OP_mov || line->n_argmts != 2) return FALSE;
+    reg = parse_reg(line->argmts->raw_text);
+    if (reg == R_INV || reg == RM || parse_reg(line->argmts->next_argmt->raw_text) != reg) return FALSE;
+    
+    return rewrite(state, line, "", " -O: mov to the same register", 1, states(state, OP_mov, reg << 3 | reg));
+}
+
+static int (*const rules[])(struct asmstate *state, struct line *line) = {
+    rule_zero_a,
+    rule_tail_call,
+    rule_jump_next,
+    rule_self_move,
+};
+
+int peephole(struct asmstate *state, struct line *line) {
+    size_t i;
+    
+    if (line->instr.type != OPCODE) return TRUE;
+    
+    for (i = 0; i < sizeof(rules)/sizeof(*rules); i++) {
+        switch (rules[i](state, line)) {
+            case -1: return FALSE;
+            case TRUE: return TRUE; // the line has changed, so the other rules no longer apply
+        }
+    }
+    
+    return TRUE;
+}
@@ -0,0 +1,17 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * peephole.h: rewrite slow instruction sequences into faster ones (-O)
+ */
+
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include "util.h"
+#include "parser.h"
+#include "assembler.h"
+
+// Apply the peephole rules to a line that is about to be assembled (and the lines after it),
+// adding what is saved to the state. Returns FALSE on error.
+int peephole(struct asmstate *state, struct line *line);
+
+#endif
@@ -0,0 +1,124 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "pool.h"
+
+struct pool *init_pool() {
+    struct pool *p = calloc(1, sizeof(struct pool));
+    if (p == NULL) FATAL_ERROR("could not allocate memory for pool");
+    return p;
+}
+
+void free_pool(struct pool *p) {
+    if (p == NULL) return;
+    pool_clear(p);
+    free(p->list);
+    free(p);
+}
+
+void pool_clear(struct pool *p) {
+    int i;
+    for (i = 0; i < p->n; i++) {
+        free(p->list[i].name);
+        free(p->list[i].bytes);
+    }
+    free(p->filename);
+    p->filename = NULL;
+    p->n = 0;
+}
+
+void pool_add(struct pool *p, char *name, const unsigned char *bytes, int n_bytes,
+              const char *filename, int lineno) {
+    struct pool_entry *e;
+
+    if (p->n == p->size) {
+        p->size = p->size ? p->size * 2 : 64;
+        p->list = realloc(p->list, p->size * sizeof(struct pool_entry));
+        if (p->list == NULL) FATAL_ERROR("could not allocate memory for pool");
+    }
+
+    e = &p->list[p->n++];
+    e->name = name;
+    e->n_bytes = n_bytes;
+    e->offset = 0;
+    if ((e->bytes = malloc(n_bytes + 1)) == NULL) FATAL_ERROR("could not allocate memory for pool");
+    memcpy(e->bytes, bytes, n_bytes);
+
+    if (p->filename == NULL) {
+        p->filename = copy_string(filename);
+        p->lineno = lineno;
+    }
+
+    p->strings++;
+    p->pooled += n_bytes;
+}
+
+// Compare two entries from their last bytes backwards, so that a string that is the end of
+// another one sorts right before it (or before another string it is the end of)
+static int compare_tails(const void *a, const void *b) {
+    const struct pool_entry *ea = *(const struct pool_entry **) a;
+    const struct pool_entry *eb = *(const struct pool_entry **) b;
+    int i;
+
+    for (i = 1; i <= ea->n_bytes && i <= eb->n_bytes; i++) {
+        if (ea->bytes[ea->n_bytes - i] != eb->bytes[eb->n_bytes - i]) {
+            return ea->bytes[ea->n_bytes - i] - eb->bytes[eb->n_bytes - i];
+        }
+    }
+    return ea->n_bytes - eb->n_bytes;
+}
+
+// Is entry a the end of entry b?
+static int is_tail(const struct pool_entry *a, const struct pool_entry *b) {
+    return a->n_bytes <= b->n_bytes && !memcmp(a->bytes, b->bytes + b->n_bytes - a->n_bytes, a->n_bytes);
+}
+
+unsigned char *pool_layout(struct pool *p, int *n_bytes) {
+    struct pool_entry **order = malloc((p->n + 1) * sizeof(struct pool_entry *));
+    int *owner = malloc((p->n + 1) * sizeof(int));
+    int *place = malloc((p->n + 1) * sizeof(int));
+    unsigned char *bytes;
+    int i, k, size = 0;
+
+    if (order == NULL || owner == NULL || place == NULL) FATAL_ERROR("could not allocate memory for pool");
+
+    // After sorting, each entry that is the end of another is the end of the one after it
+    // (and so of everything that one is the end of)
+    for (i = 0; i < p->n; i++) order[i] = &p->list[i];
+    qsort(order, p->n, sizeof(struct pool_entry *), compare_tails);
+    for (k = p->n - 1; k >= 0; k--) {
+        i = order[k] - p->list;
+        if (k + 1 < p->n && is_tail(order[k], order[k+1])) {
+            owner[i] = owner[order[k+1] - p->list];
+        } else {
+            owner[i] = i;
+        }
+    }
+
+    // The strings that are stored go in the order they were first used
+    for (i = 0; i < p->n; i++) place[i] = -1;
+    for (i = 0; i < p->n; i++) {
+        if (place[owner[i]] >= 0) continue;
+        place[owner[i]] = size;
+        size += p->list[owner[i]].n_bytes;
+    }
+
+    if ((bytes = malloc(size + 1)) == NULL) FATAL_ERROR("could not allocate memory for pool");
+    for (i = 0; i < p->n; i++) {
+        if (owner[i] == i) memcpy(bytes + place[i], p->list[i].bytes, p->list[i].n_bytes);
+        p->list[i].offset = place[owner[i]] + p->list[owner[i]].n_bytes - p->list[i].n_bytes;
+    }
+
+    p->stored += size;
+    *n_bytes = size;
+
+    free(order);
+    free(owner);
+    free(place);
+    return bytes;
+}
+
+void report_pool(FILE *f, const struct pool *p) {
+    if (p->strings == 0) return;
+    fprintf(f, "asm8085: pool holds %d strings of %d bytes in %d bytes, saving %d bytes\n",
+        p->strings, p->pooled, p->stored, p->pooled - p->stored);
+}
@@ -0,0 +1,54 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * pool.h: store each distinct 'pooldb' string once, in the next 'pool'
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdio.h>
+
+#include "util.h"
+
+// The bytes of a 'pooldb', and the label that is to point at them
+struct pool_entry {
+    char *name;             // the label, with its base added (NULL if there is none)
+    unsigned char *bytes;
+    int n_bytes;
+    int offset;             // where its bytes are in the pool, once laid out
+};
+
+struct pool {
+    struct pool_entry *list; // the 'pooldb's since the last 'pool'
+    int n, size;
+
+    char *filename;         // where the first of them is, for errors
+    int lineno;
+
+    int strings;            // how many 'pooldb's all pools have taken,
+    int pooled;             // how many bytes they were,
+    int stored;             // and how many bytes the pools hold
+};
+
+// Make an empty pool
+struct pool *init_pool();
+
+// Free it
+void free_pool(struct pool *p);
+
+// Add the bytes of a 'pooldb' (the name is taken over; the bytes are copied)
+void pool_add(struct pool *p, char *name, const unsigned char *bytes, int n_bytes,
+              const char *filename, int lineno);
+
+// Lay out the bytes added since the last 'pool': each distinct string is stored once, and a
+// string that is the end of another one points into it. The offset of each entry is filled
+// in, and the bytes to store are returned (their size in *n_bytes), to be freed by the caller.
+unsigned char *pool_layout(struct pool *p, int *n_bytes);
+
+// Forget the entries, once their labels are defined
+void pool_clear(struct pool *p);
+
+// Write how many bytes the pools have saved to f
+void report_pool(FILE *f, const struct pool *p);
+
+#endif
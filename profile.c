@@ -0,0 +1,184 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "profile.h"
+
+// Time spent in one part of the program
+struct prof_entry {
+    const struct line *line;    // the first line of it
+    const char *label;          // the label that line comes under
+    int order;                  // place of that line in the program
+    uint64_t instructions, states;
+};
+
+// What the entries are added up by
+enum prof_kind { BY_LINE, BY_LABEL, BY_EXPANSION };
+
+// Add up the counts at the addresses of a line's bytes
+static void line_counts(const struct line *line, const struct sim_profile *prof, struct prof_entry *e) {
+    int i;
+    e->instructions = e->states = 0;
+    for (i = 0; i < line->n_bytes; i++) {
+        e->instructions += prof[(line->location + i) & 0xFFFF].instructions;
+        e->states += prof[(line->location + i) & 0xFFFF].states;
+    }
+}
+
+// Compare two strings, either of which may be NULL
+static int compare_names(const char *a, const char *b) {
+    if (a == NULL || b == NULL) return (a != NULL) - (b != NULL);
+    return strcmp(a, b);
+}
+
+static int compare_by_line(const void *a, const void *b) {
+    const struct line *la = ((const struct prof_entry *) a)->line;
+    const struct line *lb = ((const struct prof_entry *) b)->line;
+    int c = compare_names(la->info.filename, lb->info.filename);
+    return c ? c : la->info.lineno - lb->info.lineno;
+}
+
+static int compare_by_label(const void *a, const void *b) {
+    return compare_names(((const struct prof_entry *) a)->label, ((const struct prof_entry *) b)->label);
+}
+
+static int compare_by_expansion(const void *a, const void *b) {
+    return ((const struct prof_entry *) a)->line->expansion - ((const struct prof_entry *) b)->line->expansion;
+}
+
+// The most T-states first, then the most instructions, then in program order
+static int compare_by_time(const void *a, const void *b) {
+    const struct prof_entry *ea = a, *eb = b;
+    if (ea->states != eb->states) return ea->states < eb->states ? 1 : -1;
+    if (ea->instructions != eb->instructions) return ea->instructions < eb->instructions ? 1 : -1;
+    return ea->order - eb->order;
+}
+
+// Add up the entries that have the same key, and sort what is left by time.
+// Returns the amount of entries left.
+static int merge_entries(struct prof_entry *entries, int n, int (*compare)(const void*, const void*)) {
+    int i, merged = 0;
+    
+    if (n == 0) return 0;
+    qsort(entries, n, sizeof(struct prof_entry), compare);
+    
+    for (i = 1; i < n; i++) {
+        if (compare(&entries[merged], &entries[i])) {
+            entries[++merged] = entries[i];
+            continue;
+        }
+        entries[merged].instructions += entries[i].instructions;
+        entries[merged].states += entries[i].states;
+        if (entries[i].order < entries[merged].order) {
+            entries[merged].line = entries[i].line;
+            entries[merged].label = entries[i].label;
+            entries[merged].order = entries[i].order;
+        }
+    }
+    
+    qsort(entries, merged + 1, sizeof(struct prof_entry), compare_by_time);
+    return merged + 1;
+}
+
+// Write one part of the report
+static void write_section(FILE *f, const char *title, enum prof_kind kind, 
+                          struct prof_entry *entries, int n, uint64_t total) {
+    const struct line *l;
+    int i;
+    
+    n = merge_entries(entries, n, kind == BY_LINE ? compare_by_line 
+                                : kind == BY_LABEL ? compare_by_label : compare_by_expansion);
+    
+    fprintf(f, "\n%s\n\n", title);
+    fprintf(f, "    T-states       %%  Instructions  %s\n", kind == BY_LINE ? "Line" : kind == BY_LABEL ? "Label" : "Expansion");
+    fprintf(f, "------------  ------  ------------  ----------------------------------\n");
+    
+    for (i = 0; i < n; i++) {
+        l = entries[i].line;
+        fprintf(f, "%12llu  %5.1f%%  %12llu  ", (unsigned long long) entries[i].states, 
+            total ? 100.0 * entries[i].states / total : 0.0, (unsigned long long) entries[i].instructions);
+        
+        switch (kind) {
+            case BY_LINE:
+                fprintf(f, "%s:%d: %s\n", l->info.filename, l->info.lineno, l->raw_text);
+                break;
+            case BY_LABEL:
+                fprintf(f, "%s\n", entries[i].label ? entries[i].label : "(before the first label)");
+                break;
+            case BY_EXPANSION:
+                fprintf(f, "%s, expansion %d (at %04X)\n", l->info.filename, l->expansion, l->location);
+                break;
+        }
+    }
+}
+
+void write_profile(FILE *f, const struct line *lines, const struct sim *s) {
+    const struct line *line;
+    const char *label = NULL;
+    int in_macro = FALSE;
+    struct prof_entry *entries, e;
+    int n = 0, n_expanded = 0, max = 0, order;
+    
+    if (s->profile == NULL) FATAL_ERROR("write_profile: the simulator was not profiling");
+    
+    fprintf(f, "Profile: %llu instructions, %llu T-states\n", 
+        (unsigned long long) s->instructions, (unsigned long long) s->states);
+    
+    // Gather the lines that have run
+    for (line = lines; line != NULL; line = line->next_line) max++;
+    if ((entries = malloc((max + 1) * sizeof(struct prof_entry))) == NULL) {
+        FATAL_ERROR("could not allocate memory for profile");
+    }
+    for (order = 0, line = lines; line != NULL; order++, line = line->next_line) {
+        // The code comes under the last label before it in the program (but not a local one,
+        // an 'equ', which is not a place in the code, or one in a macro definition)
+        if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_macro) in_macro = TRUE;
+        else if (line->instr.type == DIRECTIVE && line->instr.instr == DIR_endm) in_macro = FALSE;
+        else if (line->label != NULL && line->label[0] != '.' && !in_macro
+              && !(line->instr.type == DIRECTIVE && line->instr.instr == DIR_equ)) {
+            label = line->label;
+        }
+        
+        line_counts(line, s->profile, &e);
+        if (e.instructions == 0) continue;
+        e.line = line;
+        e.label = label;
+        e.order = order;
+        entries[n++] = e;
+    }
+    
+    // Each section sorts the entries its own way, and merges them, so it needs a fresh copy
+    struct prof_entry *work = malloc((n + 1) * sizeof(struct prof_entry));
+    if (work == NULL) FATAL_ERROR("could not allocate memory for profile");
+    
+    memcpy(work, entries, n * sizeof(struct prof_entry));
+    write_section(f, "By source line", BY_LINE, work, n, s->states);
+    
+    memcpy(work, entries, n * sizeof(struct prof_entry));
+    write_section(f, "By label", BY_LABEL, work, n, s->states);
+    
+    for (order = 0; order < n; order++) {
+        if (entries[order].line->expansion) work[n_expanded++] = entries[order];
+    }
+    if (n_expanded) write_section(f, "By macro expansion", BY_EXPANSION, work, n_expanded, s->states);
+    
+    free(work);
+    free(entries);
+    
+    // Then the listing, with the counts for each line
+    fprintf(f, "\nListing\n\n");
+    fprintf(f, "    T-states  Instructions  Addr   Source\n");
+    fprintf(f, "------------  ------------  -----  ----------------------------------\n");
+    for (line = lines; line != NULL; line = line->next_line) {
+        if (line->n_bytes > 0) {
+            line_counts(line, s->profile, &e);
+            if (e.instructions) {
+                fprintf(f, "%12llu  %12llu  ", (unsigned long long) e.states, (unsigned long long) e.instructions);
+            } else {
+                fprintf(f, "%12s  %12s  ", "", "");
+            }
+            fprintf(f, "%04X:  ", line->location);
+        } else {
+            fprintf(f, "%12s  %12s  %5s  ", "", "", "");
+        }
+        fprintf(f, "%s\n", line->raw_text ? line->raw_text : "");
+    }
+}
@@ -0,0 +1,20 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * profile.h: report where a program run in the simulator spent its time
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+
+#include "util.h"
+#include "parser_types.h"
+#include "sim.h"
+
+// Write a profile of a simulator run (which must have been profiling): the instructions
+// and T-states run for each source line, label and macro expansion, the most time first,
+// followed by the listing with the counts for each line.
+void write_profile(FILE *f, const struct line *lines, const struct sim *s);
+
+#endif
@@ -0,0 +1,305 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "rst.h"
+#include "sim.h"
+#include "bin_output.h"
+#include "opcode_table.h"
+
+// A routine that could be given an 'rst'
+struct rst_candidate {
+    char *name;
+    long calls;         // how often it was called
+    int sites;          // how many calls to it there are
+    char *code;         // its code, if it fits in a vector
+    long saved_states;  // the T-states that an 'rst' would save, over all its calls
+};
+
+// Is a text a plain global name?
+static int plain_name(const char *s) {
+    if (!isalpha(*s) && *s != '_') return FALSE;
+    for (s++; *s; s++) {
+        if (!isalnum(*s) && *s != '_') return FALSE;
+    }
+    return TRUE;
+}
+
+// The routine a line calls, if it is a plain 'call name' (the name must be freed), or NULL
+static char *call_target(const struct line *line) {
+    char *name;
+
+    if (line->instr.type != OPCODE || line->instr.instr != OP_call || line->n_argmts != 1) return NULL;
+    name = trim_string(line->argmts->raw_text);
+    if (plain_name(name)) return name;
+
+    free(name);
+    return NULL;
+}
+
+int read_call_counts(const char *filename, struct varspace *counts) {
+    char buf[256], name[128], extra[2], *comment;
+    long n;
+    intptr_t total;
+    int lineno = 0;
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "%s: cannot open: %s\n", filename, strerror(errno));
+        return FALSE;
+    }
+
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        lineno++;
+        if ((comment = strchr(buf, ';')) != NULL) *comment = '\0';
+        if (sscanf(buf, "%1s", extra) != 1) continue; // nothing on the line
+
+        if (sscanf(buf, " %127s %ld %1s", name, &n, extra) != 2 || n < 0 || !plain_name(name)) {
+            fprintf(stderr, "%s: line %d: expected a name and a count\n", filename, lineno);
+            fclose(f);
+            return FALSE;
+        }
+
+        if (!get_var(counts, name, &total)) total = 0;
+        set_var(counts, name, total + n);
+    }
+
+    fclose(f);
+    return TRUE;
+}
+
+// Count the calls by running the code, starting at its first byte, without a console
+static void run_call_counts(const struct line *lines, struct varspace *counts) {
+    const struct line *line;
+    struct sim *s;
+    intptr_t total;
+    char *name;
+
+    for (line = lines; line != NULL && line->n_bytes == 0; line = line->next_line);
+
+    s = init_sim(line != NULL ? line->cpu : 8085);
+    s->console = -1;
+    s->pc = make_image(lines, s->mem);
+    init_profile(s);
+    sim_run(s, RST_PROFILE_MAX);
+
+    for (line = lines; line != NULL; line = line->next_line) {
+        if ((name = call_target(line)) == NULL) continue;
+        if (!get_var(counts, name, &total)) total = 0;
+        set_var(counts, name, total + s->profile[line->location & 0xFFFF].instructions);
+        free(name);
+    }
+
+    free_sim(s);
+}
+
+// The code of a routine, as lines of text, if it fits in a vector: at most 8 bytes of
+// instructions, ending in a 'ret' or a jump, which do not use '$' or local names (as the
+// copy is somewhere else). Otherwise NULL.
+static char *routine_code(const struct line *lines, const char *name) {
+    const struct line *line;
+    const struct argmt *arg;
+    char *code = copy_string(""), *text;
+    int size = 0;
+
+    for (line = lines; line != NULL; line = line->next_line) {
+        if (line->label != NULL && !strcmp(line->label, name)) break;
+    }
+
+    for (; line != NULL; line = line->next_line) {
+        if (line->instr.type == NONE) continue;
+        if (line->instr.type != OPCODE || (size += line->n_bytes) > 8) break;
+
+        text = join_strings(code, "\t");
+        free(code);
+        code = join_strings(text, line->instr.text);
+        free(text);
+        for (arg = line->argmts; arg != NULL; arg = arg->next_argmt) {
+            if (strchr(arg->raw_text, '$') || strchr(arg->raw_text, '.')) goto fail;
+            text = join_strings(code, arg == line->argmts ? "\t" : ", ");
+            free(code);
+            code = join_strings(text, arg->raw_text);
+            free(text);
+        }
+        text = join_strings(code, "\n");
+        free(code);
+        code = text;
+
+        if (line->instr.instr == OP_ret || line->instr.instr == OP_jmp || line->instr.instr == OP_pchl) {
+            return code;
+        }
+    }
+
+fail:
+    free(code);
+    return NULL;
+}
+
+// The routines that save the most time come first. Then those that are not called when the
+// calls are counted, and then those that make the code slower, which only save space; in
+// both cases, those with the most calls to them (and so the most bytes saved) come first.
+static int compare_candidates(const void *a, const void *b) {
+    const struct rst_candidate *ca = a, *cb = b;
+    int ga = ca->saved_states > 0 ? 0 : ca->saved_states == 0 ? 1 : 2;
+    int gb = cb->saved_states > 0 ? 0 : cb->saved_states == 0 ? 1 : 2;
+
+    if (ga != gb) return ga - gb;
+    if (ga == 0 && ca->saved_states != cb->saved_states) return ca->saved_states < cb->saved_states ? 1 : -1;
+    if (ca->sites != cb->sites) return cb->sites - ca->sites;
+    if (ca->saved_states != cb->saved_states) return ca->saved_states < cb->saved_states ? 1 : -1;
+    return strcmp(ca->name, cb->name);
+}
+
+// Give the most called routines the vectors in 'slots' (a bit mask)
+static struct rst_plan *plan_rst(const struct line *lines, const struct varspace *counts, int slots) {
+    struct rst_plan *plan = calloc(1, sizeof(struct rst_plan));
+    struct rst_candidate *cand = NULL;
+    struct varspace *index = alloc_varspace();
+    const struct line *line;
+    int n = 0, i, slot, per_call;
+    intptr_t found;
+    char *name;
+
+    if (plan == NULL) FATAL_ERROR("could not allocate memory for rst plan");
+
+    // Every routine that is called with a plain 'call' is a candidate
+    for (line = lines; line != NULL; line = line->next_line) {
+        if ((name = call_target(line)) == NULL) continue;
+
+        if (get_var(index, name, &found)) {
+            cand[found].sites++;
+            free(name);
+            continue;
+        }
+
+        cand = realloc(cand, (n + 1) * sizeof(struct rst_candidate));
+        if (cand == NULL) FATAL_ERROR("could not allocate memory for rst plan");
+        set_var(index, name, n);
+
+        cand[n].name = name;
+        cand[n].sites = 1;
+        if (!get_var(counts, name, &found)) found = 0;
+        cand[n].calls = found;
+        cand[n].code = routine_code(lines, name);
+
+        // 'rst' is faster than 'call', but a vector that has to jump on is slower
+        per_call = get_cycles(0xcd, line->cpu)->states - get_cycles(0xc7, line->cpu)->states;
+        if (cand[n].code == NULL) per_call -= get_cycles(0xc3, line->cpu)->states;
+        cand[n].saved_states = cand[n].calls * per_call;
+        n++;
+    }
+
+    qsort(cand, n, sizeof(struct rst_candidate), compare_candidates);
+
+    for (i = 0, slot = 0; i < n; i++) {
+        while (slot < 8 && !(slots & (1 << slot))) slot++;
+        if (slot == 8) {
+            free(cand[i].name);
+            free(cand[i].code);
+            continue;
+        }
+
+        plan->target[slot] = cand[i].name;
+        plan->code[slot] = cand[i].code;
+        plan->calls[slot] = cand[i].calls;
+        slot++;
+    }
+
+    free(cand);
+    free_varspace(index);
+    return plan;
+}
+
+struct line *assemble_rst(struct asmstate *state, const char *filename, const struct varspace *counts) {
+    struct asmstate *first = init_asmstate();
+    struct varspace *run_counts = NULL;
+    struct line *lines;
+    int ok;
+
+    // The first pass is only there to count the calls
+    first->optimize = state->optimize;
+    lines = assemble(first, filename);
+    ok = lines != NULL && complete(first, lines);
+
+    if (ok) {
+        if (counts == NULL) {
+            run_counts = alloc_varspace();
+            run_call_counts(lines, run_counts);
+            counts = run_counts;
+        }
+
+        free_rst_plan(state->rst);
+        state->rst = plan_rst(lines, counts, first->rst_slots);
+    }
+
+    if (lines != NULL) free_line(lines, TRUE);
+    if (run_counts != NULL) free_varspace(run_counts);
+    free_asmstate(first);
+
+    return ok ? assemble(state, filename) : NULL;
+}
+
+int rst_call(struct asmstate *state, struct line *line) {
+    char text[16], *name, *note;
+    int n, ok;
+
+    if ((name = call_target(line)) == NULL) return TRUE;
+    for (n = 0; n < 8; n++) {
+        if (state->rst->target[n] != NULL && !strcmp(state->rst->target[n], name)) break;
+    }
+    free(name);
+    if (n == 8) return TRUE;
+
+    snprintf(text, sizeof(text), "rst\t%d", n);
+    note = join_strings(" --rst: was call ", state->rst->target[n]);
+    ok = replace_instruction(line, text, note);
+    free(note);
+
+    state->rst->sites[n]++;
+    return ok;
+}
+
+char *rst_vector_code(const struct rst_plan *plan, int n) {
+    char *code, *text;
+
+    if (plan->target[n] == NULL) return copy_string("\tds\t8\n");
+
+    if (plan->code[n] != NULL) {
+        code = copy_string(plan->code[n]);
+    } else {
+        text = join_strings("\tjmp\t", plan->target[n]);
+        code = join_strings(text, "\n");
+        free(text);
+    }
+
+    text = join_strings(code, "\talign\t8\n");
+    free(code);
+    return text;
+}
+
+void report_rst(FILE *f, const struct rst_plan *plan, int cpu) {
+    int n, per_call, bytes = 0;
+    long states = 0;
+
+    for (n = 0; n < 8; n++) {
+        if (plan->target[n] == NULL) continue;
+
+        per_call = get_cycles(0xcd, cpu)->states - get_cycles(0xc7, cpu)->states;
+        if (plan->code[n] == NULL) per_call -= get_cycles(0xc3, cpu)->states;
+        bytes += 2 * plan->sites[n];
+        states += plan->calls[n] * per_call;
+
+        fprintf(f, "asm8085: rst %d calls %s (%s): %d calls to it, run %ld times\n", n, plan->target[n],
+            plan->code[n] != NULL ? "copied into the vector" : "through a jmp", plan->sites[n], plan->calls[n]);
+    }
+
+    fprintf(f, "asm8085: --rst saved %d bytes and %ld T-states (when the calls were counted)\n", bytes, states);
+}
+
+void free_rst_plan(struct rst_plan *plan) {
+    int n;
+    if (plan == NULL) return;
+    for (n = 0; n < 8; n++) {
+        free(plan->target[n]);
+        free(plan->code[n]);
+    }
+    free(plan);
+}
@@ -0,0 +1,50 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * rst.h: call the most called routines with 'rst' instead of 'call' (--rst)
+ */
+
+#ifndef __RST_H__
+#define __RST_H__
+
+#include <stdio.h>
+
+#include "util.h"
+#include "parser.h"
+#include "varspace.h"
+#include "assembler.h"
+
+// Instructions run when the code is run to count its calls
+#define RST_PROFILE_MAX 100000000
+
+// The routine given to each 'rst' vector
+struct rst_plan {
+    char *target[8];    // the routine that 'rst n' calls, or NULL if the vector is not used
+    char *code[8];      // its code, if that fits in the vector (NULL: the vector jumps to it)
+    long calls[8];      // how often it was called when the calls were counted
+    int sites[8];       // how many calls to it there are
+};
+
+// Read call counts ('name count' on each line; ';' starts a comment) into counts.
+// Returns FALSE, after giving an error, if the file cannot be read.
+int read_call_counts(const char *filename, struct varspace *counts);
+
+// Assemble a file twice: once to count how often each routine is called, and then again with
+// the calls to the most called routines turned into an 'rst'. The calls are read from counts,
+// or, if that is NULL, counted by running the code (for at most RST_PROFILE_MAX instructions).
+// The routines go into the vectors reserved by 'rstslots'. Returns the lines of the second
+// pass, which still have to be completed, or NULL on error.
+struct line *assemble_rst(struct asmstate *state, const char *filename, const struct varspace *counts);
+
+// If a line calls a routine that has been given an 'rst', turn it into that 'rst'
+int rst_call(struct asmstate *state, struct line *line);
+
+// The lines that go into vector n, in the second pass (to be freed by the caller)
+char *rst_vector_code(const struct rst_plan *plan, int n);
+
+// Write which routines were given an 'rst', and what that saved
+void report_rst(FILE *f, const struct rst_plan *plan, int cpu);
+
+// Free a plan
+void free_rst_plan(struct rst_plan *plan);
+
+#endif
@@ -0,0 +1,198 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "sections.h"
+
+struct sections *init_sections() {
+    struct sections *s = calloc(1, sizeof(struct sections));
+    if (s == NULL) FATAL_ERROR("could not allocate memory for sections");
+    s->cur = -1;
+    return s;
+}
+
+static void free_names(struct section_name *names, int n) {
+    int i;
+    for (i = 0; i < n; i++) free(names[i].name);
+}
+
+void free_sections(struct sections *s) {
+    int i;
+    if (s == NULL) return;
+    for (i = 0; i < s->n; i++) free(s->list[i].name);
+    free_names(s->refs, s->n_refs);
+    free_names(s->defs, s->n_defs);
+    free(s->list);
+    free(s->refs);
+    free(s->defs);
+    free(s);
+}
+
+void reset_sections(struct sections *s) {
+    free_names(s->refs, s->n_refs);
+    free_names(s->defs, s->n_defs);
+    s->n_refs = s->n_defs = 0;
+    s->count = 0;
+    s->cur = -1;
+}
+
+int begin_section(struct sections *s, int location) {
+    struct section *sec;
+
+    if (s->count < s->n && s->list[s->count].dropped) {
+        s->count++;
+        return FALSE;
+    }
+    
+    if (s->count == s->n) {
+        if (s->n == s->size) {
+            s->size = s->size ? s->size * 2 : 16;
+            s->list = realloc(s->list, s->size * sizeof(struct section));
+            if (s->list == NULL) FATAL_ERROR("could not allocate memory for sections");
+        }
+        memset(&s->list[s->n++], 0, sizeof(struct section));
+    }
+
+    sec = &s->list[s->count];
+    free(sec->name);
+    sec->name = NULL;
+    sec->start = location;
+    sec->n_bytes = 0;
+
+    s->cur = s->count++;
+    return TRUE;
+}
+
+void end_section(struct sections *s, int location) {
+    if (s->cur < 0) return;
+    s->list[s->cur].n_bytes = location - s->list[s->cur].start;
+    s->cur = -1;
+}
+
+// Add a name (which is taken over) to a list
+static void add_name(struct section_name **names, int *n, int *size, char *name, int section) {
+    if (*n == *size) {
+        *size = *size ? *size * 2 : 256;
+        *names = realloc(*names, *size * sizeof(struct section_name));
+        if (*names == NULL) FATAL_ERROR("could not allocate memory for section names");
+    }
+    (*names)[*n].name = name;
+    (*names)[*n].section = section;
+    (*n)++;
+}
+
+// The full name of a label or a name in an expression, with the base added if it starts
+// with a period (as add_base() does)
+static char *full_name(const char *base, const char *name) {
+    char *full;
+
+    if (name[0] != '.') return copy_string(name);
+    if (base == NULL) return copy_string(name+1);
+
+    if ((full = malloc(strlen(base) + strlen(name) + 1)) == NULL) {
+        FATAL_ERROR("failed to allocate space for name");
+    }
+    strcpy(full, base);
+    strcat(full, name);
+    return full;
+}
+
+void section_line(struct sections *s, const struct line *line) {
+    const struct argmt *arg;
+    const struct token_stack_node *ts;
+
+    // A label inside a section belongs to it
+    if (line->label != NULL && s->cur >= 0) {
+        add_name(&s->defs, &s->n_defs, &s->size_defs, full_name(line->info.lastlabel, line->label), s->cur);
+        if (s->list[s->cur].name == NULL) s->list[s->cur].name = copy_string(line->label);
+    }
+    
+    // So does a macro that is invoked (the definition's label is the macro's name)
+    if (line->instr.type == MACRO) {
+        add_name(&s->refs, &s->n_refs, &s->size_refs, copy_string(line->instr.text), s->cur);
+    }
+
+    // Any name used in an expression on the line keeps its section in the program
+    for (arg = line->argmts; arg != NULL; arg = arg->next_argmt) {
+        if (!arg->parsed || arg->type != EXPRESSION) continue;
+        for (ts = arg->data.expr->start; ts != NULL; ts = ts->next) {
+            if (ts->token->type != NAME || !strcmp(ts->token->text, "$")) continue;
+            add_name(&s->refs, &s->n_refs, &s->size_refs,
+                full_name(arg->data.expr->basename, ts->token->text), s->cur);
+        }
+    }
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const struct section_name *) a)->name, ((const struct section_name *) b)->name);
+}
+
+static int compare_sections(const void *a, const void *b) {
+    return ((const struct section_name *) a)->section - ((const struct section_name *) b)->section;
+}
+
+// A name is used: if it is defined in a section that was not reached yet, it is now
+static void use_name(struct sections *s, const char *name, int *stack, int *n_stack) {
+    struct section_name key, *def;
+
+    key.name = (char *) name;
+    def = bsearch(&key, s->defs, s->n_defs, sizeof(struct section_name), compare_names);
+    if (def == NULL || s->list[def->section].used) return;
+
+    s->list[def->section].used = TRUE;
+    stack[(*n_stack)++] = def->section;
+}
+
+int drop_unused_sections(struct sections *s, const struct varspace *publics) {
+    const struct variable *v;
+    int *first, *stack, n_stack = 0;
+    int i, sec, newly = 0;
+
+    if (s->count == 0) return 0;
+
+    // Look up labels by name, and go through the names used by each section in turn
+    qsort(s->defs, s->n_defs, sizeof(struct section_name), compare_names);
+    qsort(s->refs, s->n_refs, sizeof(struct section_name), compare_sections);
+
+    // The names used outside the sections are at refs[first[0]] up to refs[first[1]-1],
+    // and those used in section i at refs[first[i+1]] up to refs[first[i+2]-1]
+    first = calloc(s->count + 2, sizeof(int));
+    stack = malloc(s->count * sizeof(int));
+    if (first == NULL || stack == NULL) FATAL_ERROR("could not allocate memory for sections");
+    for (i = 0; i < s->n_refs; i++) first[s->refs[i].section + 2]++;
+    for (i = 1; i < s->count + 2; i++) first[i] += first[i-1];
+
+    for (i = 0; i < s->count; i++) s->list[i].used = FALSE;
+
+    // The code outside the sections is always there, and so are the public names
+    for (i = first[0]; i < first[1]; i++) use_name(s, s->refs[i].name, stack, &n_stack);
+    for (v = publics->variables; v != NULL; v = v->next) use_name(s, v->name, stack, &n_stack);
+
+    // And so is anything that can be reached from there
+    while (n_stack > 0) {
+        sec = stack[--n_stack];
+        for (i = first[sec+1]; i < first[sec+2]; i++) use_name(s, s->refs[i].name, stack, &n_stack);
+    }
+
+    for (i = 0; i < s->count; i++) {
+        if (!s->list[i].used && !s->list[i].dropped) {
+            s->list[i].dropped = TRUE;
+            newly++;
+        }
+    }
+
+    free(first);
+    free(stack);
+    return newly;
+}
+
+int report_sections(FILE *f, const struct sections *s) {
+    int i, saved = 0;
+
+    for (i = 0; i < s->n; i++) {
+        if (!s->list[i].dropped) continue;
+        fprintf(f, "asm8085: left out unused section %s (%d bytes)\n",
+            s->list[i].name ? s->list[i].name : "without labels", s->list[i].n_bytes);
+        saved += s->list[i].n_bytes;
+    }
+
+    return saved;
+}
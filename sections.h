@@ -0,0 +1,67 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * sections.h: leave out the parts of the program that nothing uses ('section'/'endsection')
+ */
+
+#ifndef __SECTIONS_H__
+#define __SECTIONS_H__
+
+#include "util.h"
+#include "parser_types.h"
+#include "varspace.h"
+#include "expression.h"
+
+// A 'section' block. Sections are numbered in the order assembly reaches them, which is
+// the same in every pass.
+struct section {
+    char *name;     // the first label in it, for reporting (NULL if there is none)
+    int start;      // its location
+    int n_bytes;    // its size (not counting any 'org' inside it)
+    char used;      // reached from outside the sections
+    char dropped;   // left out of the program
+};
+
+// A name used or defined by a line, and the section the line is in (-1 if none)
+struct section_name {
+    char *name;
+    int section;
+};
+
+struct sections {
+    struct section *list;
+    int n, size;
+
+    int count;      // how many sections have been reached in this pass
+    int cur;        // the section being assembled, or -1
+
+    struct section_name *refs, *defs; // names used, and labels defined inside sections
+    int n_refs, size_refs, n_defs, size_defs;
+};
+
+// Make an empty list of sections
+struct sections *init_sections();
+
+// Free it
+void free_sections(struct sections *s);
+
+// Forget what a pass has seen, but not which sections are to be left out
+void reset_sections(struct sections *s);
+
+// A 'section' has been reached at the given location. Returns FALSE if it is left out.
+int begin_section(struct sections *s, int location);
+
+// The current section ends at the given location
+void end_section(struct sections *s, int location);
+
+// Record the label and the names used by a line that has been assembled, or by a macro
+// definition or invocation before it is cut out or expanded
+void section_line(struct sections *s, const struct line *line);
+
+// Work out which sections can be reached from the code outside them, or from the public
+// names, and mark the others as dropped. Returns how many were newly dropped.
+int drop_unused_sections(struct sections *s, const struct varspace *publics);
+
+// Write the sections that were left out to f. Returns how many bytes that saved.
+int report_sections(FILE *f, const struct sections *s);
+
+#endif
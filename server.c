@@ -0,0 +1,304 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#define _GNU_SOURCE // for struct ucred
+#include "server.h"
+
+// A job is sent as its size, with the client's stdin, stdout and stderr attached, and then
+// the working directory and the arguments, each ending in a zero byte. The server answers
+// with the exit status, once the job is done.
+
+static volatile sig_atomic_t stopping = FALSE;
+
+static void stop(int sig) {
+    (void) sig;
+    stopping = TRUE;
+}
+
+// Make a Unix socket address; FALSE if the path does not fit
+static int socket_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return FALSE;
+    strcpy(addr->sun_path, path);
+    return TRUE;
+}
+
+// Read or write exactly n bytes
+static int read_all(int fd, void *buf, size_t n) {
+    ssize_t r;
+    for (; n > 0; n -= r, buf = (char *) buf + r) {
+        if ((r = read(fd, buf, n)) <= 0) return FALSE;
+    }
+    return TRUE;
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+    ssize_t r;
+    for (; n > 0; n -= r, buf = (const char *) buf + r) {
+        if ((r = send(fd, buf, n, MSG_NOSIGNAL)) <= 0) return FALSE;
+    }
+    return TRUE;
+}
+
+// Is the other end of a connection run by the same user as the server? The socket is only
+// open to that user, but this makes sure of it where the system can tell.
+static int same_user(int conn) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) return FALSE;
+    if (cred.uid != getuid()) {
+        fprintf(stderr, "asm8085: server: refused a job from uid %d\n", (int) cred.uid);
+        return FALSE;
+    }
+#else
+    (void) conn;
+#endif
+    return TRUE;
+}
+
+// Receive a job, run it in a process of its own, and send back its exit status
+static void serve_job(int conn, int report, server_job job) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union { char buf[CMSG_SPACE(3 * sizeof(int))]; struct cmsghdr align; } control;
+    uint32_t size;
+    int fds[3], argc = 0, status, i;
+    char *data, *p, **argv;
+    pid_t pid;
+
+    if (!same_user(conn)) return;
+    
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(conn, &msg, 0) != sizeof(size) || (cmsg = CMSG_FIRSTHDR(&msg)) == NULL
+     || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+     || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) return;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (size == 0 || size > SERVER_MAX_JOB) return;
+
+    // The working directory, then the arguments
+    if ((data = malloc(size + 1)) == NULL) FATAL_ERROR("could not allocate memory for job");
+    if (!read_all(conn, data, size)) return;
+    data[size] = '\0';
+    for (p = data + strlen(data) + 1; p < data + size; p += strlen(p) + 1) argc++;
+    if ((argv = calloc(argc + 1, sizeof(char *))) == NULL) FATAL_ERROR("could not allocate memory for job");
+    for (i = 0, p = data + strlen(data) + 1; i < argc; p += strlen(p) + 1) argv[i++] = p;
+
+    // The job gets the signals the way a command would
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    if ((pid = fork()) == 0) {
+        for (i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        close(conn);
+        if (chdir(data) == -1) {
+            fprintf(stderr, "asm8085: server: cannot change to %s: %s\n", data, strerror(errno));
+            exit(1);
+        }
+
+        filecache_report_misses(report);
+        exit(job(argc, argv));
+    }
+
+    status = 1;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    write_all(conn, &status, sizeof(status));
+}
+
+// Is a server listening on a socket?
+static int listening(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0), ok;
+    if (fd == -1) return TRUE;
+    ok = connect(fd, (const struct sockaddr *) addr, sizeof(struct sockaddr_un)) == 0 || errno != ECONNREFUSED;
+    close(fd);
+    return ok;
+}
+
+// Bind a socket so that only this user can connect to it (whatever the umask is)
+static int bind_private(int fd, const struct sockaddr_un *addr) {
+    mode_t mask = umask(077);
+    int r = bind(fd, (const struct sockaddr *) addr, sizeof(struct sockaddr_un));
+    umask(mask);
+    return r;
+}
+
+// Set up the socket
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!socket_address(path, &addr)) {
+        fprintf(stderr, "asm8085: server: socket path too long: %s\n", path);
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        fprintf(stderr, "asm8085: server: cannot make socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // A socket that nothing listens on any more is left over from a server that stopped
+    if (bind_private(fd, &addr) == -1) {
+        if (errno != EADDRINUSE) goto fail;
+        if (listening(&addr)) {
+            errno = EADDRINUSE;
+            goto fail;
+        }
+        unlink(path);
+        if (bind_private(fd, &addr) == -1) goto fail;
+    }
+    if (listen(fd, 64) == -1) goto fail;
+
+    return fd;
+
+fail:
+    fprintf(stderr, "asm8085: server: cannot listen on %s: %s\n", path,
+        errno == EADDRINUSE ? "another server is running there" : strerror(errno));
+    close(fd);
+    return -1;
+}
+
+// Load the files that the jobs reported, one path per line
+static void load_reported(int fd, char *buf, size_t *used) {
+    char *start, *newline;
+    ssize_t r;
+
+    if ((r = read(fd, buf + *used, PIPE_BUF - *used)) <= 0) return;
+    *used += r;
+
+    for (start = buf; (newline = memchr(start, '\n', buf + *used - start)) != NULL; start = newline + 1) {
+        *newline = '\0';
+        filecache_load(start);
+    }
+
+    // Keep the start of a path that has not been read in full
+    *used -= start - buf;
+    memmove(buf, start, *used);
+    if (*used == PIPE_BUF) *used = 0;
+}
+
+int run_server(const char *path, server_job job) {
+    struct sigaction sa;
+    struct pollfd fds[2];
+    char buf[PIPE_BUF];
+    size_t used = 0;
+    int sock, conn, report[2];
+    pid_t pid;
+
+    if ((sock = listen_on(path)) == -1) return FALSE;
+    if (pipe(report) == -1) FATAL_ERROR("cannot make pipe: %s", strerror(errno));
+
+    // Stop on SIGINT and SIGTERM (waking up from poll()); handlers reap themselves
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = report[0];
+    fds[1].events = POLLIN;
+
+    while (!stopping) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "asm8085: server: poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) load_reported(report[0], buf, &used);
+
+        if ((fds[0].revents & POLLIN) && (conn = accept(sock, NULL, NULL)) != -1) {
+            // Each job is handled by a process of its own, so that jobs can run side by side
+            if ((pid = fork()) == 0) {
+                close(sock);
+                close(report[0]);
+                serve_job(conn, report[1], job);
+                exit(0);
+            }
+            if (pid == -1) fprintf(stderr, "asm8085: server: cannot fork: %s\n", strerror(errno));
+            close(conn);
+        }
+    }
+
+    close(sock);
+    close(report[0]);
+    close(report[1]);
+    unlink(path);
+    filecache_free();
+    return TRUE;
+}
+
+int run_client(const char *path, int argc, char **argv) {
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union { char buf[CMSG_SPACE(3 * sizeof(int))]; struct cmsghdr align; } control;
+    int fds[3] = { 0, 1, 2 }, fd, status, i;
+    char cwd[PATH_MAX];
+    uint32_t size;
+
+    if (!socket_address(path, &addr) || getcwd(cwd, PATH_MAX) == NULL) return -1;
+
+    size = strlen(cwd) + 1;
+    for (i = 0; i < argc; i++) size += strlen(argv[i]) + 1;
+    if (size > SERVER_MAX_JOB) return -1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // The size, with stdin, stdout and stderr
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &size;
+    iov.iov_len = sizeof(size);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(size)) {
+        close(fd);
+        return -1;
+    }
+
+    // Then the job. Once it is sent, the server has it, so losing the server now is an error.
+    if (!write_all(fd, cwd, strlen(cwd) + 1)) goto lost;
+    for (i = 0; i < argc; i++) {
+        if (!write_all(fd, argv[i], strlen(argv[i]) + 1)) goto lost;
+    }
+    if (!read_all(fd, &status, sizeof(status))) goto lost;
+
+    close(fd);
+    return status;
+
+lost:
+    fprintf(stderr, "asm8085: lost the connection to the server on %s\n", path);
+    close(fd);
+    return 2;
+}
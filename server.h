@@ -0,0 +1,40 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * server.h: run assembly jobs in a server that stays up (asm8085 --server), and send
+ * them to it from the command line
+ */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "filecache.h"
+
+#define SERVER_MAX_JOB 65536 // the most bytes of working directory and arguments in a job
+
+// A job: it is given the arguments of the command line, and returns the exit status
+typedef int (*server_job)(int argc, char **argv);
+
+// Listen on a Unix socket, and run each job sent to it (until the server is stopped by
+// SIGINT or SIGTERM). Only the user running the server can use the socket. Each job runs in a process of its own, forked off the server, in the
+// client's working directory and with the client's stdin, stdout and stderr. The source
+// files the jobs read are kept parsed, so the next jobs do not have to read them again.
+// Returns FALSE if the socket cannot be set up.
+int run_server(const char *path, server_job job);
+
+// Send a job to the server on path, with this process's working directory and stdin, stdout
+// and stderr, and wait for it. Returns its exit status, or -1 if there is no server there.
+int run_client(const char *path, int argc, char **argv);
+
+#endif
@@ -0,0 +1,167 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "sim.h"
+
+// S, Z and P flags for every value
+static unsigned char szp[256];
+static char szp_built = FALSE;
+
+static void build_szp() {
+    int v, i, bits;
+    for (v = 0; v < 256; v++) {
+        for (bits = 0, i = 0; i < 8; i++) bits += (v >> i) & 1;
+        szp[v] = (v & F_S) | (v ? 0 : F_Z) | (bits & 1 ? 0 : F_P);
+    }
+    szp_built = TRUE;
+}
+
+// The flag tested by each condition (NZ, Z, NC, C, PO, PE, P, M), and whether it must be set
+static const unsigned char cond_flag[8] = { F_Z, F_Z, F_CY, F_CY, F_P, F_P, F_S, F_S };
+static const unsigned char cond_set[8] = { 0, F_Z, 0, F_CY, 0, F_P, 0, F_S };
+
+struct sim *init_sim(int cpu) {
+    struct sim *s = calloc(1, sizeof(struct sim));
+    if (s == NULL) FATAL_ERROR("could not allocate memory for simulator");
+    if (!szp_built) build_szp();
+
+    s->cpu = cpu;
+    s->f = cpu == 8080 ? F_V : 0; // on the 8080, this bit is always set
+    s->console = SIM_CONSOLE;
+    s->console_in = stdin;
+    s->console_out = stdout;
+    return s;
+}
+
+void free_sim(struct sim *s) {
+    free(s->profile);
+    free(s);
+}
+
+void init_profile(struct sim *s) {
+    if (s->profile == NULL) s->profile = calloc(65536, sizeof(struct sim_profile));
+    if (s->profile == NULL) FATAL_ERROR("could not allocate memory for profile");
+}
+
+void sim_load(struct sim *s, const unsigned char *code, size_t size, int origin) {
+    if (origin + size > sizeof(s->mem)) size = sizeof(s->mem) - origin;
+    memcpy(s->mem + origin, code, size);
+    s->pc = origin;
+    s->halted = FALSE;
+}
+
+// The console
+static int console_read(struct sim *s) {
+    int c = fgetc(s->console_in);
+    return c == EOF ? SIM_EOF : c;
+}
+
+static void console_write(struct sim *s, int c) {
+    fputc(c, s->console_out);
+}
+
+// Memory access; the opcode and its immediate bytes are read straight from memory
+#define RD(addr) ((int) (addr) == con_in ? console_read(s) : mem[(uint16_t) (addr)])
+#define WR(addr, v) do { \
+    uint16_t _a = (addr); \
+    if ((int) _a == con) console_write(s, (v)); \
+    else mem[_a] = (v); \
+} while(0)
+
+#define IMM8 (mem[pc])
+#define IMM16 (mem[pc] | mem[(uint16_t) (pc+1)] << 8)
+
+// Register pairs
+#define BC (r[RB] << 8 | r[RC])
+#define DE (r[RD] << 8 | r[RE])
+#define HL (r[RH] << 8 | r[RL])
+#define SET_PAIR(hi, lo, v) do { unsigned _v = (v); r[hi] = _v >> 8; r[lo] = _v; } while(0)
+
+// Get or set register pair 'rp' (0-2 = BC, DE, HL; 3 = SP)
+#define GET_RP(rp) ((rp) == 3 ? (unsigned) sp : (unsigned) (r[2*(rp)] << 8 | r[2*(rp)+1]))
+#define SET_RP(rp, v) do { \
+    if ((rp) == 3) sp = (v); \
+    else SET_PAIR(2*(rp), 2*(rp)+1, (v)); \
+} while(0)
+
+// Register operand (in bits 0-2 of the opcode): M is the byte at HL
+#define SRC(op) (((op) & 7) == RM ? RD(HL) : r[(op) & 7])
+
+// Stack
+#define PUSH(v) do { unsigned _p = (v); sp--; WR(sp, _p >> 8); sp--; WR(sp, _p & 0xFF); } while(0)
+#define POP(v) do { unsigned _lo = RD(sp); sp++; (v) = _lo | RD(sp) << 8; sp++; } while(0)
+
+// Flags after adding x, v and a carry, giving res (which has the carry out in bit 8).
+// A subtraction is done by adding the complement, and then flipping the carry.
+// On the 8085, V is set on a signed overflow, and K is S xor V.
+#define ARITH_FLAGS(x, v, res) do { \
+    f = szp[(res) & 0xFF] | (((res) >> 8) & F_CY) | (((x) ^ (v) ^ (res)) & F_AC) | base; \
+    if (is8085) { \
+        if (((x) ^ (res)) & ((v) ^ (res)) & 0x80) f |= F_V; \
+        if (!(f & F_S) != !(f & F_V)) f |= F_K; \
+    } \
+} while(0)
+
+#define DO_ADD(val, carry) do { \
+    unsigned _v = (val), _r = r[RA] + _v + (carry); \
+    ARITH_FLAGS(r[RA], _v, _r); \
+    r[RA] = _r; \
+} while(0)
+
+#define DO_SUB(val, borrow, store) do { \
+    unsigned _v = ~(val) & 0xFF, _r = r[RA] + _v + !(borrow); \
+    ARITH_FLAGS(r[RA], _v, _r); \
+    f ^= F_CY; \
+    if (store) r[RA] = _r; \
+} while(0)
+
+#define DO_ANA(val) do { \
+    unsigned _v = (val); \
+    unsigned _ac = is8085 ? F_AC : ((r[RA] | _v) & 0x08) << 1; \
+    r[RA] &= _v; \
+    f = szp[r[RA]] | _ac | base; \
+} while(0)
+
+#define DO_LOGIC(expr) do { r[RA] = (expr); f = szp[r[RA]] | base; } while(0)
+
+// Conditions, in bits 3-5 of the opcode
+#define COND(op) ((f & cond_flag[((op) >> 3) & 7]) == cond_set[((op) >> 3) & 7])
+#define TAKEN states += cyc[op].taken - cyc[op].states
+
+// Count the time taken by the last instruction at its address, when profiling
+#define PROFILE do { \
+    if (PROFILING) { \
+        prof[at].states += states - at_states; \
+        at = pc; \
+        at_states = states; \
+    } \
+} while(0)
+
+// Save the registers into the state (before port I/O, and when stopping)
+#define SAVE do { \
+    memcpy(s->r, r, sizeof(r)); \
+    s->f = f; s->pc = pc; s->sp = sp; \
+    s->instructions = started + n; s->states = states; \
+} while(0)
+
+// Go on to the next instruction
+#define NEXT do { \
+    PROFILE; \
+    if (n == limit) goto stop; \
+    n++; \
+    if (PROFILING) prof[pc].instructions++; \
+    op = mem[pc++]; \
+    states += cyc[op].states; \
+    goto *dispatch[op]; \
+} while(0)
+
+#define SIM_RUN run_fast
+#define PROFILING 0
+#include "sim_core.h"
+
+#define SIM_RUN run_profiled
+#define PROFILING 1
+#include "sim_core.h"
+
+int sim_run(struct sim *s, uint64_t max) {
+    return s->profile != NULL ? run_profiled(s, max) : run_fast(s, max);
+}
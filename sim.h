@@ -0,0 +1,79 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * sim.h: an 8080/8085 simulator, to run an assembled binary
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "parser_types.h"
+#include "opcode_table.h"
+
+// The console is memory-mapped: writing to SIM_CONSOLE prints a character, and reading from
+// SIM_CONSOLE+1 reads one (^Z at the end of the input)
+#define SIM_CONSOLE 0xFF00
+#define SIM_EOF 0x1A
+
+// Flags
+#define F_S  0x80
+#define F_Z  0x40
+#define F_K  0x20   // 8085 only (undocumented)
+#define F_AC 0x10
+#define F_P  0x04
+#define F_V  0x02   // 8085 only (undocumented); always set on the 8080
+#define F_CY 0x01
+
+// Instructions and T-states counted at one address
+struct sim_profile {
+    uint64_t instructions;
+    uint64_t states;
+};
+
+struct sim {
+    unsigned char mem[65536];
+
+    unsigned char r[8];     // registers, indexed like enum reg_e (r[RM] is not used)
+    unsigned char f;        // flags
+    uint16_t pc, sp;
+
+    char ie;                // interrupts enabled
+    unsigned char mask;     // 8085 interrupt mask (set by 'sim')
+    char halted;            // set once 'hlt' has run
+    int cpu;                // 8080 or 8085
+
+    uint64_t instructions;  // instructions run so far
+    uint64_t states;        // T-states taken so far
+
+    // Instructions and T-states run at each address, if profiling (see init_profile)
+    struct sim_profile *profile;
+    
+    int console;            // address of the console, or -1 for none
+    FILE *console_in, *console_out;
+
+    // Port I/O; if NULL, 'in' reads 0xFF and 'out' does nothing
+    int (*in)(struct sim *s, int port);
+    void (*out)(struct sim *s, int port, int value);
+    void *ctx;              // for use by 'in' and 'out'
+};
+
+// Make a new simulator for the given CPU (8080 or 8085), with the console on stdin and stdout
+struct sim *init_sim(int cpu);
+
+// Free a simulator
+void free_sim(struct sim *s);
+
+// Load code into memory at the given address, and start running from there
+void sim_load(struct sim *s, const unsigned char *code, size_t size, int origin);
+
+// Start counting the instructions and T-states run at each address
+void init_profile(struct sim *s);
+
+// Run until 'hlt', or until max instructions have run (if max is not 0).
+// Returns TRUE if the program halted. The exit status of the program is then in A.
+int sim_run(struct sim *s, uint64_t max);
+
+#endif
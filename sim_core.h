@@ -0,0 +1,352 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * sim_core.h: the simulator's main loop. sim.c includes this twice, to make a version
+ * with and without profiling, so that the counting costs nothing when it is not wanted.
+ * SIM_RUN is the name of the function, and PROFILING is 1 or 0.
+ */
+
+static int SIM_RUN(struct sim *s, uint64_t max) {
+    // Every opcode has a label below. The dispatch table for each CPU sends each opcode byte
+    // to the label of the opcode it stands for.
+    static void *const op_labels[] = {
+        #define _OP(name, is8080, _) &&op_##name,
+        #include "instructions.h"
+    };
+    static void *dispatch_table[2][256];
+    static char dispatch_built[2] = { FALSE, FALSE };
+
+    int is8085 = s->cpu != 8080;
+    void *const *dispatch = dispatch_table[is8085];
+
+    if (!dispatch_built[is8085]) {
+        void **d = dispatch_table[is8085];
+        int i, op;
+
+        for (i = 0; i < 256; i++) {
+            op = decode_opcode(i, s->cpu);
+            if (op >= 0) d[i] = op_labels[op];
+            // The 8080 does not have the 8085's extra opcodes; their bytes repeat other instructions
+            else if (i == 0xCB) d[i] = &&alias_jmp;
+            else if (i == 0xD9) d[i] = &&alias_ret;
+            else if ((i & 0xCF) == 0xCD) d[i] = &&alias_call;
+            else d[i] = &&alias_nop;
+        }
+        dispatch_built[is8085] = TRUE;
+    }
+
+    const struct cycles *cyc = get_cycles(0, s->cpu); // (the table for all opcode bytes)
+    unsigned char *mem = s->mem;
+    unsigned char r[8];
+    unsigned f = s->f, op, v, t;
+    unsigned base = is8085 ? 0 : F_V;
+    uint16_t pc = s->pc, sp = s->sp;
+    uint64_t n = 0, limit = max ? max : UINT64_MAX, states = s->states, started = s->instructions;
+    struct sim_profile *prof = PROFILING ? s->profile : NULL;
+    uint16_t at = pc;
+    uint64_t at_states = states;
+    int con = s->console, con_in = con < 0 ? -1 : (con + 1) & 0xFFFF;
+    memcpy(r, s->r, sizeof(r));
+
+    NEXT;
+
+/* Data transfer */
+op_mov:
+    v = SRC(op);
+    if (((op >> 3) & 7) == RM) WR(HL, v);
+    else r[(op >> 3) & 7] = v;
+    NEXT;
+op_mvi:
+    if (((op >> 3) & 7) == RM) WR(HL, IMM8);
+    else r[(op >> 3) & 7] = IMM8;
+    pc++;
+    NEXT;
+op_lxi:
+    SET_RP((op >> 4) & 3, IMM16);
+    pc += 2;
+    NEXT;
+op_lda:
+    r[RA] = RD(IMM16);
+    pc += 2;
+    NEXT;
+op_sta:
+    WR(IMM16, r[RA]);
+    pc += 2;
+    NEXT;
+op_lhld:
+    t = IMM16;
+    pc += 2;
+    r[RL] = RD(t);
+    r[RH] = RD(t+1);
+    NEXT;
+op_shld:
+    t = IMM16;
+    pc += 2;
+    WR(t, r[RL]);
+    WR(t+1, r[RH]);
+    NEXT;
+op_ldax:
+    r[RA] = RD(op & 0x10 ? DE : BC);
+    NEXT;
+op_stax:
+    WR(op & 0x10 ? DE : BC, r[RA]);
+    NEXT;
+op_xchg:
+    v = r[RD]; r[RD] = r[RH]; r[RH] = v;
+    v = r[RE]; r[RE] = r[RL]; r[RL] = v;
+    NEXT;
+
+/* Arithmetic and logic */
+op_add: DO_ADD(SRC(op), 0); NEXT;
+op_adc: DO_ADD(SRC(op), f & F_CY); NEXT;
+op_sub: DO_SUB(SRC(op), 0, TRUE); NEXT;
+op_sbb: DO_SUB(SRC(op), f & F_CY, TRUE); NEXT;
+op_ana: DO_ANA(SRC(op)); NEXT;
+op_xra: DO_LOGIC(r[RA] ^ SRC(op)); NEXT;
+op_ora: DO_LOGIC(r[RA] | SRC(op)); NEXT;
+op_cmp: DO_SUB(SRC(op), 0, FALSE); NEXT;
+op_adi: DO_ADD(IMM8, 0); pc++; NEXT;
+op_aci: DO_ADD(IMM8, f & F_CY); pc++; NEXT;
+op_sui: DO_SUB(IMM8, 0, TRUE); pc++; NEXT;
+op_sbi: DO_SUB(IMM8, f & F_CY, TRUE); pc++; NEXT;
+op_ani: DO_ANA(IMM8); pc++; NEXT;
+op_xri: DO_LOGIC(r[RA] ^ IMM8); pc++; NEXT;
+op_ori: DO_LOGIC(r[RA] | IMM8); pc++; NEXT;
+op_cpi: DO_SUB(IMM8, 0, FALSE); pc++; NEXT;
+
+op_inr:
+op_dcr:
+    t = (op >> 3) & 7;
+    v = t == RM ? RD(HL) : r[t];
+    if ((op & 7) == 4) {
+        v = (v + 1) & 0xFF;
+        f = (f & F_CY) | szp[v] | ((v & 0x0F) ? 0 : F_AC) | base;
+        if (is8085 && v == 0x80) f |= F_V;
+    } else {
+        v = (v - 1) & 0xFF;
+        f = (f & F_CY) | szp[v] | ((v & 0x0F) == 0x0F ? 0 : F_AC) | base;
+        if (is8085 && v == 0x7F) f |= F_V;
+    }
+    if (is8085 && !(f & F_S) != !(f & F_V)) f |= F_K;
+    if (t == RM) WR(HL, v);
+    else r[t] = v;
+    NEXT;
+op_inx:
+    t = (GET_RP((op >> 4) & 3) + 1) & 0xFFFF;
+    SET_RP((op >> 4) & 3, t);
+    if (is8085) f = (f & ~F_K) | (t == 0 ? F_K : 0); // K is set when it wraps around
+    NEXT;
+op_dcx:
+    t = (GET_RP((op >> 4) & 3) - 1) & 0xFFFF;
+    SET_RP((op >> 4) & 3, t);
+    if (is8085) f = (f & ~F_K) | (t == 0xFFFF ? F_K : 0);
+    NEXT;
+op_dad:
+    t = HL + GET_RP((op >> 4) & 3);
+    f = (f & ~F_CY) | (t >> 16);
+    SET_PAIR(RH, RL, t);
+    NEXT;
+op_daa:
+    v = 0;
+    t = f & F_CY;
+    if ((r[RA] & 0x0F) > 9 || (f & F_AC)) v = 0x06;
+    if (r[RA] > 0x99 || t) {
+        v |= 0x60;
+        t = F_CY;
+    }
+    f = szp[(r[RA] + v) & 0xFF] | ((r[RA] ^ v ^ (r[RA] + v)) & F_AC) | t | base;
+    r[RA] += v;
+    NEXT;
+
+/* Rotates and flags */
+op_rlc:
+    r[RA] = r[RA] << 1 | r[RA] >> 7;
+    f = (f & ~F_CY) | (r[RA] & 1);
+    NEXT;
+op_rrc:
+    f = (f & ~F_CY) | (r[RA] & 1);
+    r[RA] = r[RA] >> 1 | r[RA] << 7;
+    NEXT;
+op_ral:
+    t = r[RA] >> 7;
+    r[RA] = r[RA] << 1 | (f & F_CY);
+    f = (f & ~F_CY) | t;
+    NEXT;
+op_rar:
+    t = r[RA] & 1;
+    r[RA] = r[RA] >> 1 | (f & F_CY) << 7;
+    f = (f & ~F_CY) | t;
+    NEXT;
+op_cma: r[RA] = ~r[RA]; NEXT;
+op_cmc: f ^= F_CY; NEXT;
+op_stc: f |= F_CY; NEXT;
+
+/* Jumps, calls and returns */
+op_jmp:
+    pc = IMM16;
+    NEXT;
+op_jnz: op_jz: op_jnc: op_jc: op_jpo: op_jpe: op_jp: op_jm:
+    if (COND(op)) {
+        pc = IMM16;
+        TAKEN;
+    } else pc += 2;
+    NEXT;
+op_call:
+    t = IMM16;
+    PUSH(pc + 2);
+    pc = t;
+    NEXT;
+op_cnz: op_cz: op_cnc: op_cc: op_cpo: op_cpe: op_cp: op_cm:
+    if (COND(op)) {
+        t = IMM16;
+        PUSH(pc + 2);
+        pc = t;
+        TAKEN;
+    } else pc += 2;
+    NEXT;
+op_ret:
+    POP(pc);
+    NEXT;
+op_rnz: op_rz: op_rnc: op_rc: op_rpo: op_rpe: op_rp: op_rm:
+    if (COND(op)) {
+        POP(pc);
+        TAKEN;
+    }
+    NEXT;
+op_rst:
+    PUSH(pc);
+    pc = op & 0x38;
+    NEXT;
+op_pchl:
+    pc = HL;
+    NEXT;
+
+/* Stack */
+op_push:
+    t = (op >> 4) & 3;
+    PUSH(t == 3 ? r[RA] << 8 | f : GET_RP(t));
+    NEXT;
+op_pop:
+    POP(v);
+    t = (op >> 4) & 3;
+    if (t != 3) SET_RP(t, v);
+    else {
+        r[RA] = v >> 8;
+        f = is8085 ? (v & 0xFF) : ((v & 0xD5) | F_V);
+    }
+    NEXT;
+op_xthl:
+    v = RD(sp);
+    WR(sp, r[RL]);
+    r[RL] = v;
+    v = RD(sp + 1);
+    WR(sp + 1, r[RH]);
+    r[RH] = v;
+    NEXT;
+op_sphl:
+    sp = HL;
+    NEXT;
+
+/* Input, output and control */
+op_in:
+    v = IMM8;
+    pc++;
+    SAVE;
+    r[RA] = s->in ? s->in(s, v) : 0xFF;
+    NEXT;
+op_out:
+    v = IMM8;
+    pc++;
+    SAVE;
+    if (s->out) s->out(s, v, r[RA]);
+    NEXT;
+op_ei: s->ie = TRUE; NEXT;
+op_di: s->ie = FALSE; NEXT;
+op_hlt:
+    s->halted = TRUE;
+    PROFILE;
+    SAVE;
+    return TRUE;
+op_nop: NEXT;
+
+/* 8085 */
+op_rim:
+    r[RA] = (s->mask & 7) | (s->ie ? 0x08 : 0);
+    NEXT;
+op_sim:
+    if (r[RA] & 0x08) s->mask = r[RA] & 7;
+    NEXT;
+op_dsub:
+    v = HL;
+    t = BC;
+    {
+        unsigned res = v + (~t & 0xFFFF) + 1;
+        f = (szp[(res >> 8) & 0xFF] & (F_S | F_P)) | ((res & 0xFFFF) ? 0 : F_Z) | (~res >> 16 & F_CY)
+          | ((v ^ ~t ^ res) >> 8 & F_AC);
+        if ((v ^ t) & (v ^ res) & 0x8000) f |= F_V;
+        if (!(f & F_S) != !(f & F_V)) f |= F_K;
+        SET_PAIR(RH, RL, res);
+    }
+    NEXT;
+op_arhl:
+    f = (f & ~F_CY) | (r[RL] & 1);
+    SET_PAIR(RH, RL, (HL >> 1) | (HL & 0x8000));
+    NEXT;
+op_rdel:
+    v = DE;
+    t = (v << 1) | (f & F_CY);
+    f = (f & ~(F_CY | F_V)) | (v >> 15) | (((v ^ (v << 1)) & 0x8000) ? F_V : 0);
+    SET_PAIR(RD, RE, t);
+    NEXT;
+op_ldhi:
+    SET_PAIR(RD, RE, HL + IMM8);
+    pc++;
+    NEXT;
+op_ldsi:
+    SET_PAIR(RD, RE, sp + IMM8);
+    pc++;
+    NEXT;
+op_rstv:
+    if (f & F_V) {
+        PUSH(pc);
+        pc = 0x40;
+        TAKEN;
+    }
+    NEXT;
+op_shlx:
+    WR(DE, r[RL]);
+    WR(DE + 1, r[RH]);
+    NEXT;
+op_lhlx:
+    t = DE;
+    r[RL] = RD(t);
+    r[RH] = RD(t + 1);
+    NEXT;
+op_jnk:
+op_jk:
+    if (!(f & F_K) == (op == 0xDD)) {
+        pc = IMM16;
+        TAKEN;
+    } else pc += 2;
+    NEXT;
+
+/* The 8080's duplicate opcodes (the table has no timing for these) */
+alias_nop:
+    states += 4;
+    NEXT;
+alias_jmp:
+    states += 10;
+    goto op_jmp;
+alias_ret:
+    states += 10;
+    goto op_ret;
+alias_call:
+    states += 17;
+    goto op_call;
+
+stop:
+    SAVE;
+    return FALSE;
+}
+
+#undef SIM_RUN
+#undef PROFILING
@@ -0,0 +1,212 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "stackdepth.h"
+
+// The stack can not get deeper than this
+#define STACK_MAX 0x10000
+
+// What is known about the routine at an address
+enum routine_state { NOT_DONE, IN_PROGRESS, DONE };
+
+// A place the code can get to, and how deep the stack is there
+struct stack_point {
+    int addr, depth;
+};
+
+struct stack_graph {
+    const struct line *at[65536];   // the instruction at each address
+    int depth[65536];               // the stack depth of the routine there, once DONE
+    char state[65536];              // see enum routine_state
+
+    // The deepest stack each address was reached with, while following the routine 'owner'
+    struct { int owner, depth; } seen[65536];
+};
+
+struct stack_graph *init_stack_graph(const struct line *lines) {
+    struct stack_graph *g = calloc(1, sizeof(struct stack_graph));
+    int addr;
+
+    if (g == NULL) FATAL_ERROR("could not allocate memory for stack depth");
+    for (addr = 0; addr < 65536; addr++) g->seen[addr].owner = -1;
+
+    for (; lines != NULL; lines = lines->next_line) {
+        if (lines->instr.type == OPCODE && lines->n_bytes > 0) g->at[lines->location & 0xFFFF] = lines;
+    }
+
+    return g;
+}
+
+void free_stack_graph(struct stack_graph *g) {
+    free(g);
+}
+
+// The places still to be followed
+struct stack_todo {
+    struct stack_point *points;
+    int n, size, max;
+};
+
+static void follow(struct stack_todo *todo, int addr, int depth) {
+    if (todo->n == todo->size) {
+        todo->size = todo->size ? todo->size * 2 : 64;
+        todo->points = realloc(todo->points, todo->size * sizeof(struct stack_point));
+        if (todo->points == NULL) FATAL_ERROR("could not allocate memory for stack depth");
+    }
+    todo->points[todo->n].addr = addr & 0xFFFF;
+    todo->points[todo->n].depth = depth;
+    todo->n++;
+    if (depth > todo->max) todo->max = depth;
+}
+
+// Follow a call from a place at the given depth
+static int call(struct stack_graph *g, struct stack_todo *todo, int from, int addr, int depth, char *msg) {
+    int called;
+
+    if (g->state[addr] == IN_PROGRESS) {
+        snprintf(msg, STACK_MSG_SIZE, "recursive call to %04Xh at %04Xh", addr, from);
+        return FALSE;
+    }
+    if (!stack_depth(g, addr, &called, msg)) return FALSE;
+
+    if (depth + 2 + called > todo->max) todo->max = depth + 2 + called;
+    return TRUE;
+}
+
+int stack_depth(struct stack_graph *g, int entry, int *depth, char *msg) {
+    struct stack_todo todo = { NULL, 0, 0, 0 };
+    struct stack_point p;
+    const struct line *line;
+    int next, target;
+
+    entry &= 0xFFFF;
+    if (g->state[entry] == DONE) {
+        *depth = g->depth[entry];
+        return TRUE;
+    }
+
+    g->state[entry] = IN_PROGRESS;
+    follow(&todo, entry, 0);
+
+    while (todo.n > 0) {
+        p = todo.points[--todo.n];
+
+        // Only go on if this place has not been reached with as deep a stack before
+        if (g->seen[p.addr].owner == entry && g->seen[p.addr].depth >= p.depth) continue;
+        if (p.depth >= STACK_MAX) {
+            snprintf(msg, STACK_MSG_SIZE, "the stack keeps growing in the loop at %04Xh", p.addr);
+            goto fail;
+        }
+        g->seen[p.addr].owner = entry;
+        g->seen[p.addr].depth = p.depth;
+
+        if ((line = g->at[p.addr]) == NULL) {
+            snprintf(msg, STACK_MSG_SIZE, "there is no code at %04Xh", p.addr);
+            goto fail;
+        }
+        next = p.addr + line->n_bytes;
+        target = line->n_bytes == 3 ? line->bytes[1] | line->bytes[2] << 8 : 0;
+
+        switch (line->instr.instr) {
+            case OP_push: follow(&todo, next, p.depth + 2); break;
+            case OP_pop:  follow(&todo, next, p.depth - 2); break;
+
+            // Only 'sp' changes the stack
+            case OP_inx: follow(&todo, next, p.depth - (line->bytes[0] == 0x33)); break;
+            case OP_dcx: follow(&todo, next, p.depth + (line->bytes[0] == 0x3b)); break;
+            case OP_lxi: follow(&todo, next, line->bytes[0] == 0x31 ? 0 : p.depth); break;
+            case OP_sphl: follow(&todo, next, 0); break;
+
+            case OP_call: case OP_cnz: case OP_cz: case OP_cnc: case OP_cc:
+            case OP_cpo: case OP_cpe: case OP_cp: case OP_cm:
+                if (!call(g, &todo, p.addr, target, p.depth, msg)) goto fail;
+                follow(&todo, next, p.depth);
+                break;
+            case OP_rst:
+                if (!call(g, &todo, p.addr, line->bytes[0] & 0x38, p.depth, msg)) goto fail;
+                follow(&todo, next, p.depth);
+                break;
+            case OP_rstv:
+                if (!call(g, &todo, p.addr, 0x40, p.depth, msg)) goto fail;
+                follow(&todo, next, p.depth);
+                break;
+
+            case OP_jmp: follow(&todo, target, p.depth); break;
+            case OP_jnz: case OP_jz: case OP_jnc: case OP_jc:
+            case OP_jpo: case OP_jpe: case OP_jp: case OP_jm: case OP_jk: case OP_jnk:
+                follow(&todo, target, p.depth);
+                follow(&todo, next, p.depth);
+                break;
+
+            case OP_rnz: case OP_rz: case OP_rnc: case OP_rc:
+            case OP_rpo: case OP_rpe: case OP_rp: case OP_rm:
+                follow(&todo, next, p.depth);
+                break;
+            case OP_ret: case OP_hlt: break;
+
+            case OP_pchl:
+                snprintf(msg, STACK_MSG_SIZE, "cannot tell where the pchl at %04Xh goes", p.addr);
+                goto fail;
+
+            default: follow(&todo, next, p.depth);
+        }
+    }
+
+    free(todo.points);
+    g->state[entry] = DONE;
+    g->depth[entry] = *depth = todo.max;
+    return TRUE;
+
+fail:
+    free(todo.points);
+    g->state[entry] = NOT_DONE;
+    return FALSE;
+}
+
+// The 8085 interrupt vectors (the 8080 only has the RSTs)
+static const struct { int addr; const char *name; } vectors[] = {
+    { 0x00, "rst 0" }, { 0x08, "rst 1" }, { 0x10, "rst 2" }, { 0x18, "rst 3" },
+    { 0x20, "rst 4" }, { 0x24, "trap" }, { 0x28, "rst 5" }, { 0x2c, "rst 5.5" },
+    { 0x30, "rst 6" }, { 0x34, "rst 6.5" }, { 0x38, "rst 7" }, { 0x3c, "rst 7.5" },
+};
+
+static void report_entry(FILE *f, struct stack_graph *g, int addr, const char *name, int pushed) {
+    char msg[STACK_MSG_SIZE];
+    int depth;
+
+    if (stack_depth(g, addr, &depth, msg)) {
+        fprintf(f, "asm8085: stack depth from %04Xh (%s): %d bytes\n", addr, name, depth + pushed);
+    } else {
+        fprintf(f, "asm8085: stack depth from %04Xh (%s): unknown, %s\n", addr, name, msg);
+    }
+}
+
+void report_stack(FILE *f, const struct line *lines) {
+    const struct line *line;
+    struct stack_graph *g;
+    int start, cpu, i;
+    char interrupts = FALSE;
+
+    // The code starts at its first byte
+    for (line = lines; line != NULL && line->n_bytes == 0; line = line->next_line);
+    if (line == NULL) return;
+    start = line->location;
+    cpu = line->cpu;
+
+    g = init_stack_graph(lines);
+    report_entry(f, g, start, "start", 0);
+
+    // The interrupt vectors only matter if the code turns on interrupts
+    for (line = lines; line != NULL; line = line->next_line) {
+        if (line->instr.type == OPCODE && (line->instr.instr == OP_ei || line->instr.instr == OP_sim)) {
+            interrupts = TRUE;
+        }
+    }
+
+    for (i = 0; interrupts && i < (int) (sizeof(vectors)/sizeof(*vectors)); i++) {
+        if (vectors[i].addr == start || g->at[vectors[i].addr] == NULL) continue;
+        if (vectors[i].addr % 8 != 0 && cpu == 8080) continue;
+        report_entry(f, g, vectors[i].addr, vectors[i].name, 2);
+    }
+
+    free_stack_graph(g);
+}
@@ -0,0 +1,36 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * stackdepth.h: work out how deep the code can take the stack, by following its calls
+ */
+
+#ifndef __STACKDEPTH_H__
+#define __STACKDEPTH_H__
+
+#include <stdio.h>
+
+#include "util.h"
+#include "parser_types.h"
+
+#define STACK_MSG_SIZE 128
+
+// The code, and what is known about the routines in it so far
+struct stack_graph;
+
+// Index the instructions in lines, which must be complete
+struct stack_graph *init_stack_graph(const struct line *lines);
+
+// Free it
+void free_stack_graph(struct stack_graph *g);
+
+// Work out how many bytes the code at 'entry' pushes at most before it returns, counting the
+// return addresses of the routines it calls, but not its own. Every path is followed: calls
+// and 'rst's into their routines, and jumps and conditional returns both ways. 'lxi sp' and
+// 'sphl' start a new stack. If the depth cannot be worked out (e.g. because of recursion, or
+// a 'pchl'), FALSE is returned and the reason is written to msg (STACK_MSG_SIZE bytes).
+int stack_depth(struct stack_graph *g, int entry, int *depth, char *msg);
+
+// Write the stack depth from the start of the code, and from each interrupt vector
+// that holds code (counting the return address the interrupt pushes)
+void report_stack(FILE *f, const struct line *lines);
+
+#endif
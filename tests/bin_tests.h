@@ -3,8 +3,8 @@
 #define MEMSZ 0x10000
 #define B(x) ((x)%MEMSZ)
 
-#define BIN_FILE_TEST(name) \
-TEST(file_##name \
+#define BIN_FILE_TEST_MODE(testname, name, rel) \
+TEST(testname \
 , /*startup*/ \
     unsigned char *match = NULL; \
     unsigned char *outbin = NULL; \
@@ -33,6 +33,7 @@ TEST(file_##name \
     filesize = fread(match, sizeof(char), MEMSZ, matchfile); \
     /* parse, assemble, etc. the asm input file */ \
     state = init_asmstate(); \
+    state->release = rel; \
     if (!(input = assemble(state, asmfile))) FAIL("assembly failed on %s", asmfile); \
     if (!complete(state, input)) FAIL("complete() failed"); \
     outsize = make_binary(input, outbin); \
@@ -49,6 +50,11 @@ TEST(file_##name \
     } \
 })
 
+#define BIN_FILE_TEST(name) BIN_FILE_TEST_MODE(file_##name, name, FALSE)
+
+// The same, but freeing the lines' text as soon as they are final
+#define RELEASE_FILE_TEST(name) BIN_FILE_TEST_MODE(release_##name, name, TRUE)
+
 BIN_FILE_TEST(bytetest)
 BIN_FILE_TEST(labeltest)
 BIN_FILE_TEST(op8080)
@@ -58,4 +64,157 @@ BIN_FILE_TEST(align)
 BIN_FILE_TEST(pushorg_test)
 BIN_FILE_TEST(nesting)
 BIN_FILE_TEST(repeats)
-BIN_FILE_TEST(splitline)
\ No newline at end of file
+BIN_FILE_TEST(splitline)
+
+RELEASE_FILE_TEST(bytetest)
+RELEASE_FILE_TEST(labeltest)
+RELEASE_FILE_TEST(op8085)
+RELEASE_FILE_TEST(incbin_test)
+RELEASE_FILE_TEST(align)
+RELEASE_FILE_TEST(pushorg_test)
+RELEASE_FILE_TEST(nesting)
+RELEASE_FILE_TEST(repeats)
+RELEASE_FILE_TEST(splitline)
+
+// Test if streaming (assembling twice, without keeping the lines) gives the same binary
+#define STREAM_FILE_TEST(name) \
+TEST(stream_##name \
+, /*startup*/ \
+    unsigned char *match = NULL; \
+    unsigned char *outbin = NULL; \
+    FILE *matchfile = NULL; \
+    FILE *outfile = NULL; \
+    size_t filesize; \
+    size_t outsize; \
+, /*shutdown*/ \
+    free(match); \
+    free(outbin); \
+    if(matchfile) fclose(matchfile); \
+    if(outfile) fclose(outfile); \
+, /*test*/ \
+{ \
+    match = malloc(MEMSZ); \
+    outbin = malloc(MEMSZ); \
+    char *binfile = "test_inputs/" #name ".bin"; \
+    char *asmfile = "test_inputs/" #name ".asm"; \
+    if (!(matchfile = fopen(binfile, "r"))) FAIL("could not open binary input file %s", binfile); \
+    filesize = fread(match, sizeof(char), MEMSZ, matchfile); \
+    if (!(outfile = tmpfile())) FAIL("could not make temporary file"); \
+    if (!assemble_stream(asmfile, outfile, &outsize)) FAIL("streaming assembly failed on %s", asmfile); \
+    if (filesize != outsize) FAIL("size does not match - %zu != %zu", filesize, outsize); \
+    rewind(outfile); \
+    if (fread(outbin, 1, MEMSZ, outfile) != outsize) FAIL("wrong amount of output written"); \
+    if (memcmp(outbin, match, filesize)) FAIL("output does not match %s", binfile); \
+})
+
+STREAM_FILE_TEST(bytetest)
+STREAM_FILE_TEST(labeltest)
+STREAM_FILE_TEST(op8080)
+STREAM_FILE_TEST(op8085)
+STREAM_FILE_TEST(incbin_test)
+STREAM_FILE_TEST(align)
+STREAM_FILE_TEST(pushorg_test)
+STREAM_FILE_TEST(nesting)
+STREAM_FILE_TEST(repeats)
+STREAM_FILE_TEST(splitline)
+
+
+// Test the T-state tables, and the running totals written in the listing
+#define CYCLES(byte, cpu, want_states, want_taken) do { \
+    const struct cycles *c = get_cycles(byte, cpu); \
+    if (c->states != (want_states) || c->taken != (want_taken)) \
+        FAIL("%02X on the %d: %d/%d T-states instead of %d/%d", byte, cpu, \
+             c->taken, c->states, want_taken, want_states); \
+} while(0)
+
+TEST(cycles
+, /*startup*/
+    struct line *input = NULL;
+    struct asmstate *state = NULL;
+    FILE *listf = NULL;
+, /*shutdown*/
+    free_asmstate(state);
+    if(input) free_line(input, TRUE);
+    if(listf) fclose(listf);
+, /*test*/
+{
+    CYCLES(0x78, 8080, 5, 5);   /* mov a,b */
+    CYCLES(0x78, 8085, 4, 4);
+    CYCLES(0x7E, 8085, 7, 7);   /* mov a,m */
+    CYCLES(0x34, 8080, 10, 10); /* inr m */
+    CYCLES(0x76, 8080, 7, 7);   /* hlt, not mov m,m */
+    CYCLES(0x76, 8085, 5, 5);
+    CYCLES(0xC2, 8080, 10, 10); /* jnz */
+    CYCLES(0xC2, 8085, 7, 10);
+    CYCLES(0xC4, 8080, 11, 17); /* cnz */
+    CYCLES(0xC4, 8085, 9, 18);
+    CYCLES(0xC8, 8085, 6, 12);  /* rz */
+    CYCLES(0x08, 8080, 0, 0);   /* dsub */
+    CYCLES(0x08, 8085, 10, 10);
+    CYCLES(0x2A, 8085, 16, 16); /* lhld, not ldax h */
+    CYCLES(0x3A, 8080, 13, 13); /* lda, not ldax sp */
+    CYCLES(0x22, 8085, 16, 16); /* shld, not stax h */
+    CYCLES(0x32, 8080, 13, 13); /* sta, not stax sp */
+    CYCLES(0x0A, 8080, 7, 7);   /* ldax b */
+   
+    /* every instruction has a timing */
+    state = init_asmstate();
+    if (!(input = assemble(state, "test_inputs/op8080.asm"))) FAIL("assembly failed");
+    if (!complete(state, input)) FAIL("complete() failed");
+    struct line *line;
+    int n = 0;
+    for (line = input; line != NULL; line = line->next_line) {
+        if (line->instr.type != OPCODE) continue;
+        if (get_cycles(line->bytes[0], 8080)->states < 4) FAIL("no 8080 T-states for: %s", line->raw_text);
+        if (get_cycles(line->bytes[0], 8085)->states < 4) FAIL("no 8085 T-states for: %s", line->raw_text);
+        n++;
+    }
+    if (n < 200) FAIL("only %d instructions found", n);
+   
+    /* a label starts a new total */
+    struct cycles total;
+    total.states = 100;
+    total.taken = 100;
+    if (!(listf = tmpfile())) FAIL("could not make temporary file");
+    for (line = input; line->instr.type != OPCODE; line = line->next_line);
+    line->label = "foo";
+    write_cycles(listf, line, &total);
+    line->label = NULL;
+    write_cycles(listf, line, &total);
+    if (total.states != 8 || total.taken != 8) FAIL("total is %d/%d instead of 8", total.taken, total.states);
+    char buf[64];
+    rewind(listf);
+    if (!fgets(buf, sizeof(buf), listf) || strcmp(buf, " 4      4          " " 4      8          "))
+        FAIL("listing columns: '%s'", buf);
+})
+// Test the peephole rules: the output should match the binary, and what they save be counted
+TEST(peephole
+, /*startup*/
+    unsigned char *match = malloc(MEMSZ);
+    unsigned char *outbin = malloc(MEMSZ);
+    struct line *input = NULL;
+    struct asmstate *state = init_asmstate();
+    FILE *matchfile = NULL;
+    size_t filesize;
+    size_t outsize;
+, /*shutdown*/
+    free(match);
+    free(outbin);
+    free_asmstate(state);
+    if (input) free_line(input, TRUE);
+    if (matchfile) fclose(matchfile);
+, /*test*/
+{
+    if (!(matchfile = fopen("test_inputs/peephole.bin", "r"))) FAIL("could not open peephole.bin");
+    filesize = fread(match, sizeof(char), MEMSZ, matchfile);
+    
+    state->optimize = TRUE;
+    if (!(input = assemble(state, "test_inputs/peephole.asm"))) FAIL("assembly failed");
+    if (!complete(state, input)) FAIL("complete() failed");
+    outsize = make_binary(input, outbin);
+    
+    if (filesize != outsize) FAIL("size does not match - %zu != %zu", filesize, outsize);
+    if (memcmp(outbin, match, filesize)) FAIL("output does not match peephole.bin");
+    if (state->saved_bytes != 10) FAIL("saved %ld bytes instead of 10", state->saved_bytes);
+    if (state->saved_states != 3 + 4 + 18 + 10 + 10 + 3) FAIL("saved %ld T-states instead of 48", state->saved_states);
+})
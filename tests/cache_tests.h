@@ -0,0 +1,131 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the functions in cache.c
+
+// Macro: write a file in the test directory
+#define WRITE_TEST_FILE(name, text) do { \
+    snprintf(path, PATH_MAX, "%s/%s", dir, name); \
+    if ((f = fopen(path, "w")) == NULL) FAIL("could not write %s", path); \
+    fputs(text, f); \
+    fclose(f); \
+} while(0)
+
+TEST(cache_store_fetch
+,   /*startup*/
+    char dir[] = "/tmp/test_asm8085_XXXXXX";
+    char path[PATH_MAX];
+    char source[PATH_MAX];
+    char out[PATH_MAX];
+    char cachedir[PATH_MAX];
+    char key[CACHE_KEY_SIZE];
+    char cmd[PATH_MAX + 16];
+    unsigned char *outbin = malloc(MEMSZ);
+    struct asmstate *state = NULL;
+    struct line *lines = NULL;
+    size_t outsize = 0;
+    int made = mkdtemp(dir) != NULL;
+    FILE *f;
+,   /*shutdown*/
+    deps_free();
+    free(outbin);
+    if (state) free_asmstate(state);
+    if (lines) free_line(lines, TRUE);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (made && system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+,   /*test*/
+{
+    if (!made) FAIL("could not create temporary directory");
+    snprintf(source, PATH_MAX, "%s/main.asm", dir);
+    snprintf(out, PATH_MAX, "%s/main.bin", dir);
+    snprintf(cachedir, PATH_MAX, "%s/cache", dir);
+    WRITE_TEST_FILE("main.asm", "\tinclude \"inc.asm\"\n\tdb 1\n");
+    WRITE_TEST_FILE("inc.asm", "\tdb 2\n");
+    
+    // Assemble the file and store it
+    deps_start();
+    state = init_asmstate();
+    if ((lines = assemble(state, source)) == NULL) FAIL("assembly failed");
+    if (!complete(state, lines)) FAIL("complete() failed");
+    outsize = make_binary(lines, outbin);
+    if ((f = fopen(out, "w")) == NULL) FAIL("could not write %s", out);
+    fwrite(outbin, 1, outsize, f);
+    fclose(f);
+    
+    if (!cache_key(source, "test", key)) FAIL("cache_key() failed");
+    if (!cache_store(cachedir, key, out, NULL)) FAIL("cache_store() failed");
+    deps_free();
+    
+    // It should come back out
+    unlink(out);
+    if (!cache_fetch(cachedir, key, out, NULL)) FAIL("cached output was not found");
+    if ((f = fopen(out, "r")) == NULL) FAIL("cached output was not copied");
+    outsize = fread(outbin, 1, MEMSZ, f);
+    fclose(f);
+    if (outsize != 2 || outbin[0] != 2 || outbin[1] != 1) FAIL("cached output is wrong");
+    
+    // But not if a listing is wanted, as none was stored
+    snprintf(path, PATH_MAX, "%s/main.lst", dir);
+    if (cache_fetch(cachedir, key, out, path)) FAIL("listing was found in cache");
+    
+    // Nor if an included file changes
+    WRITE_TEST_FILE("inc.asm", "\tdb 3\n");
+    if (cache_fetch(cachedir, key, out, NULL)) FAIL("cache was used after included file changed");
+})
+
+// Identical sources in two directories must not share a cache entry, as what they
+// include differs
+TEST(cache_key_path
+,   /*startup*/
+    char dir[] = "/tmp/test_asm8085_XXXXXX";
+    char path[PATH_MAX];
+    char source_a[PATH_MAX];
+    char source_b[PATH_MAX];
+    char out[PATH_MAX];
+    char cachedir[PATH_MAX];
+    char key_a[CACHE_KEY_SIZE];
+    char key_b[CACHE_KEY_SIZE];
+    char cmd[PATH_MAX + 16];
+    int made = mkdtemp(dir) != NULL;
+    FILE *f;
+,   /*shutdown*/
+    deps_free();
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (made && system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+,   /*test*/
+{
+    if (!made) FAIL("could not create temporary directory");
+    snprintf(path, PATH_MAX, "%s/a", dir);
+    if (mkdir(path, 0777) != 0) FAIL("could not create %s", path);
+    snprintf(path, PATH_MAX, "%s/b", dir);
+    if (mkdir(path, 0777) != 0) FAIL("could not create %s", path);
+    snprintf(source_a, PATH_MAX, "%s/a/main.asm", dir);
+    snprintf(source_b, PATH_MAX, "%s/b/main.asm", dir);
+    snprintf(out, PATH_MAX, "%s/a/main.bin", dir);
+    snprintf(cachedir, PATH_MAX, "%s/cache", dir);
+    WRITE_TEST_FILE("a/main.asm", "\tinclude \"data.inc\"\n");
+    WRITE_TEST_FILE("b/main.asm", "\tinclude \"data.inc\"\n");
+    WRITE_TEST_FILE("a/data.inc", "\tdb 1\n");
+    WRITE_TEST_FILE("b/data.inc", "\tdb 2\n");
+    WRITE_TEST_FILE("a/main.bin", "\x01");
+    
+    if (!cache_key(source_a, "test", key_a)) FAIL("cache_key() failed for a");
+    if (!cache_key(source_b, "test", key_b)) FAIL("cache_key() failed for b");
+    if (!strcmp(key_a, key_b)) FAIL("both directories have key %s", key_a);
+    
+    // The same file reached by another path has the same key
+    snprintf(path, PATH_MAX, "%s/b/../a/main.asm", dir);
+    if (!cache_key(path, "test", key_b)) FAIL("cache_key() failed for %s", path);
+    if (strcmp(key_a, key_b)) FAIL("key changed with the path: %s != %s", key_a, key_b);
+    
+    // What is stored for a is not fetched for b
+    deps_start();
+    snprintf(path, PATH_MAX, "%s/a/data.inc", dir);
+    deps_add(source_a);
+    deps_add(path);
+    if (!cache_store(cachedir, key_a, out, NULL)) FAIL("cache_store() failed");
+    deps_free();
+    if (!cache_key(source_b, "test", key_b)) FAIL("cache_key() failed for b");
+    snprintf(out, PATH_MAX, "%s/b/main.bin", dir);
+    if (cache_fetch(cachedir, key_b, out, NULL)) FAIL("output of a was fetched for b");
+    deps_free();
+})
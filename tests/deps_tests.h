@@ -0,0 +1,54 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the functions in deps.c
+
+// Macro: assemble a file while recording its dependencies, and write them to tempfile
+#define WRITE_DEPS(src) do { \
+    struct asmstate *s = init_asmstate(); \
+    struct line *l; \
+    deps_free(); \
+    deps_start(); \
+    if ((l = assemble(s, src)) == NULL) FAIL("assembly failed on %s", src); \
+    if ((f = fopen(tempfile, "w")) == NULL) FAIL("could not write dependency file"); \
+    if (!deps_write(f, "out.bin", cwd, FALSE)) FAIL("deps_write() failed"); \
+    fclose(f); \
+    free_line(l, TRUE); \
+    free_asmstate(s); \
+    deps_free(); \
+} while(0)
+
+// Macro: check that the dependency file has the expected contents
+#define CHECK_DEPS(expected) do { \
+    if ((f = fopen(tempfile, "r")) == NULL) FAIL("could not read dependency file"); \
+    n = fread(buf, 1, sizeof(buf)-1, f); \
+    buf[n] = '\0'; \
+    fclose(f); \
+    if (strcmp(buf, expected)) FAIL("wrong dependencies:\n%s", buf); \
+} while(0)
+
+TEST(deps_include_incbin
+,   /*startup*/
+    char tempfile[] = "/tmp/test_asm8085_XXXXXX";
+    int fd = mkstemp(tempfile);
+    char cwd[PATH_MAX];
+    char buf[1024];
+    size_t n;
+    FILE *f;
+,   /*shutdown*/
+    deps_free();
+    unlink(tempfile);
+,   /*test*/
+{
+    if (fd == -1) FAIL("could not create temporary file");
+    close(fd);
+    if (getcwd(cwd, PATH_MAX) == NULL) FAIL("could not get working directory");
+    
+    // Nested includes are found through the directory stack
+    WRITE_DEPS("test_inputs/includetest.asm");
+    CHECK_DEPS("out.bin: \\\n test_inputs/includetest.asm \\\n test_inputs/inctest/test1.asm"
+               " \\\n test_inputs/inctest/test2.asm \\\n test_inputs/inctest/test3.asm\n");
+    
+    // incbin'd files are dependencies too
+    WRITE_DEPS("test_inputs/incbin_test.asm");
+    CHECK_DEPS("out.bin: \\\n test_inputs/incbin_test.asm \\\n test_inputs/incbin_test.bin\n");
+})
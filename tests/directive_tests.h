@@ -81,4 +81,126 @@ DIR_TEST(macro, {
     
 })
 
+DIR_TEST(cycles, {
+    lines = assemble(state, "test_inputs/cycles.asm");
+    if (lines == NULL) FAIL("processing failed");
+    
+    // the assertions about the code are checked at the end
+    if (!complete(state, lines)) FAIL("complete() failed");
+    CHECKVAR(looptime, 26);
+    
+    // outside of complete(), the code cannot be counted, and the value is unknown
+    struct line *line;
+    for (line = lines; line->instr.type != DIRECTIVE || line->instr.instr != DIR_assert; line = line->next_line);
+    if (cycles_available()) FAIL("cycles() available after complete()");
+    if (region_cycles(0x100, 0x101, TRUE, &line->info, &val)) FAIL("cycles() counted after complete()");
+    if (!contains_undefined_names(line->argmts->data.expr, state->knowns)) FAIL("cycles() known before complete()");
+})
+
+DIR_TEST(section, {
+    lines = assemble(state, "test_inputs/sections.asm");
+    if (lines == NULL) FAIL("processing failed");
+    if (!complete(state, lines)) FAIL("complete() failed");
+    
+    // the sections that are used are kept, and the others are left out
+    CHECKVAR(used, 0x10A);
+    CHECKVAR(helper, 0x10E);
+    CHECKVAR(helper.loop, 0x110);
+    CHECKVAR(table, 0x115);
+    CHECKVAR(after, 0x117);
+    CHECKVAR(pair, 0x117);
+    CHECKVAR(end, 0x11A);
+    if (get_var(state->knowns, "unused", &val)) FAIL("unused is defined");
+    if (get_var(state->knowns, "unused2", &val)) FAIL("unused2 is defined");
+    if (get_var(state->knowns, "loop", &val)) FAIL("loop is defined");
+    
+    // the ones left out are only counted
+    int i;
+    int dropped = 0;
+    int saved = 0;
+    for (i = 0; i < state->sections->n; i++) {
+        if (state->sections->list[i].dropped) { dropped++; saved += state->sections->list[i].n_bytes; }
+    }
+    if (dropped != 4) FAIL("left out %d sections instead of 4", dropped);
+    if (saved != 7 + 1 + 1 + 3) FAIL("saved %d bytes instead of 12", saved);
+})
+
+DIR_TEST(stackdepth, {
+    lines = assemble(state, "test_inputs/stackdepth.asm");
+    if (lines == NULL) FAIL("processing failed");
+    
+    // the assertions check the depths
+    if (!complete(state, lines)) FAIL("complete() failed");
+    CHECKVAR(maindepth, 10);
+    struct line *line;
+    for (line = lines; line != NULL && (line->label == NULL || strcmp(line->label, "depth")); line = line->next_line);
+    if (line == NULL || line->n_bytes != 2) FAIL("depth line not found");
+    if (line->bytes[0] != 10 || line->bytes[1] != 10) FAIL("depths are %d and %d, not 10", line->bytes[0], line->bytes[1]);
+    
+    // a recursive routine has no bound
+    struct stack_graph *g = init_stack_graph(lines);
+    char msg[STACK_MSG_SIZE];
+    int depth;
+    if (!get_var(state->knowns, "fact", &val)) FAIL("fact not defined");
+    int ok = stack_depth(g, val, &depth, msg);
+    free_stack_graph(g);
+    if (ok) FAIL("recursive routine has a depth of %d", depth);
+    if (!strstr(msg, "recursive call")) FAIL("wrong message: %s", msg);
+})
 
+DIR_TEST(pool, {
+    lines = assemble(state, "test_inputs/pool.asm");
+    if (lines == NULL) FAIL("processing failed");
+    
+    // the assertions check where the labels point
+    if (!complete(state, lines)) FAIL("complete() failed");
+    CHECKVAR(first.msg, 0x22);
+    
+    struct pool *p = state->pool;
+    if (p->strings != 6) FAIL("%d strings pooled instead of 6", p->strings);
+    if (p->pooled != 54 || p->stored != 31) FAIL("%d bytes stored in %d instead of 54 in 31", p->pooled, p->stored);
+})
+
+DIR_TEST(rst, {
+    // counted by running the code: bump and twice save the most, never is only called
+    lines = assemble_rst(state, "test_inputs/rst.asm", NULL);
+    if (lines == NULL) FAIL("processing failed");
+    if (!complete(state, lines)) FAIL("complete() failed");
+    
+    struct rst_plan *plan = state->rst;
+    if (plan->target[0] != NULL) FAIL("rst 0 is not reserved but calls %s", plan->target[0]);
+    if (!plan->target[1] || strcmp(plan->target[1], "bump")) FAIL("rst 1 does not call bump");
+    if (!plan->target[2] || strcmp(plan->target[2], "twice")) FAIL("rst 2 does not call twice");
+    if (!plan->target[3] || strcmp(plan->target[3], "never")) FAIL("rst 3 does not call never");
+    if (plan->calls[1] != 200 || plan->sites[1] != 2) FAIL("bump: %ld calls at %d sites", plan->calls[1], plan->sites[1]);
+    if (plan->code[1] == NULL) FAIL("bump is not copied into its vector");
+    CHECKVAR(bump, 0x39); // 'rst' is one byte shorter than 'call'
+    
+    // the code still does the same
+    struct sim *s = init_sim(8085);
+    s->console = -1;
+    s->pc = make_image(lines, s->mem);
+    int halted = sim_run(s, 100000);
+    int a = s->r[RA];
+    int rst1 = s->mem[0x08];
+    free_sim(s);
+    if (!halted || a != 252) FAIL("the code gives %d instead of 252", a);
+    if (rst1 != 0x23) FAIL("rst 1 starts with %02X instead of inx h", rst1);
+    
+    // read from a file: twice is called the most; long would be slower through a jmp
+    free_line(lines, TRUE);
+    free_asmstate(state);
+    state = init_asmstate();
+    struct varspace *counts = alloc_varspace();
+    int read = read_call_counts("test_inputs/rst.counts", counts);
+    if (read) lines = assemble_rst(state, "test_inputs/rst.asm", counts);
+    free_varspace(counts);
+    if (!read) FAIL("could not read counts");
+    if (lines == NULL) FAIL("processing failed");
+    
+    plan = state->rst;
+    if (!plan->target[1] || strcmp(plan->target[1], "twice")) FAIL("rst 1 does not call twice");
+    if (plan->calls[1] != 4000) FAIL("twice: %ld calls", plan->calls[1]);
+    if (!plan->target[2] || strcmp(plan->target[2], "bump")) FAIL("rst 2 does not call bump");
+    if (!plan->target[3] || strcmp(plan->target[3], "never")) FAIL("rst 3 does not call never");
+})
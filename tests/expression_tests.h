@@ -104,6 +104,10 @@ EX_TEST(single_tokens, {
     TOKNUM("`nop`",       0);
     TOKNUM("`mov a,b`", 0x78);
     TOKNUM("`mvi a,_`", 0x3E);
+    TOKNUM("`MOV  A , M`", 0x7E);
+    TOKNUM("`rst 3+4`", 0xFF);
+    TOKNUM("`push psw`", 0xF5);
+    TOKNUM("`lxi sp,(x+1)*2`", 0x31);
     // Test names
     TOKNAME("hello");
     TOKNAME("a.bc.def");
@@ -169,6 +173,40 @@ EX_TEST(token_string, {
     SUCCEED;
 })
 
+// Tokens should point back at their place in the text
+#define TOKPOS(tok, off, len) do { \
+    if ((tok)->offset != (off) || (tok)->length != (len)) { \
+        FAILC("token at %d (length %d) instead of %d (length %d)", free_tokens(t), (tok)->offset, (tok)->length, off, len); \
+    } \
+    tok = tok->next_token; \
+} while(0);
+
+EX_TEST(token_positions, {
+    struct token *t;
+    struct token *r;
+    char error = 0;
+    
+    t = tokenize("  foo + 0x1F*(high 'a')", &info, &error);
+    if (t == NULL || error) FAIL("tokenize failed");
+    r = t;
+    
+    TOKPOS(r, 2, 3);   // foo
+    TOKPOS(r, 6, 1);   // +
+    TOKPOS(r, 8, 4);   // 0x1F
+    TOKPOS(r, 12, 1);  // *
+    TOKPOS(r, 13, 1);  // (
+    TOKPOS(r, 14, 4);  // high
+    TOKPOS(r, 19, 3);  // 'a'
+    TOKPOS(r, 22, 1);  // )
+    
+    // only the name has its own text
+    if (t->text == NULL || strcmp(t->text, "foo")) FAILC("name text is wrong", free_tokens(t));
+    if (t->next_token->next_token->text != NULL) FAILC("number has text", free_tokens(t));
+    
+    free_tokens(t);
+    SUCCEED;
+})
+
 
 /** Test the evaluator **/
 
@@ -305,3 +343,73 @@ EX_TEST(escaped_chars, {
     EVAL("'\\v'", '\v');
 })
 
+// Constant parts of an expression are folded when it is parsed
+#define FOLD(what, want_const, want_val, want_nodes) do { \
+    struct parsed_expr *p = parse_expr(what, &info); \
+    if (!p) FAIL("parse_expr returned NULL on %s", what); \
+    int n_nodes = 0; \
+    const struct token_stack_node *n; \
+    for (n = p->start; n != NULL; n = n->next) n_nodes++; \
+    int value = -1; \
+    int is_const = expr_constant(p, &value); \
+    int rslt = eval_expr(p, vs, &info, LOC); \
+    free_parsed_expr(p); \
+    if (is_const != (want_const)) FAIL("%s: expr_constant returned %d", what, is_const); \
+    if (is_const && value != (want_val)) FAIL("%s: folded to %d instead of %d", what, value, want_val); \
+    if (rslt != (want_val)) FAIL("%s: evaluated to %d instead of %d", what, rslt, want_val); \
+    if (n_nodes != (want_nodes)) FAIL("%s: %d nodes left instead of %d", what, n_nodes, want_nodes); \
+} while(0);
+
+EX_TEST(constant_folding, {
+    int rslt;
+    set_var(vs, "x", 5);
+    
+    FOLD("(4*1024)+16", TRUE, 4112, 1);
+    FOLD("high 0x1234", TRUE, 0x12, 1);
+    FOLD("low (0x1234 + 1)", TRUE, 0x35, 1);
+    FOLD("-5--6-7--8", TRUE, 2, 1);
+    
+    // only the constant subexpressions are folded
+    FOLD("x + 2*3", FALSE, 11, 3);
+    FOLD("2*3 + x*(1+1)", FALSE, 16, 5);
+    FOLD("$ + 1", FALSE, LOC + 1, 3);
+    
+    // values that do not fit are left for evaluation
+    FOLD("(1<<40)>>40", FALSE, 1, 5);
+    FOLD("((1<<20)*(1<<20))/(1<<30)", FALSE, 1024, 5);
+    
+    // and so is division by zero, so that it happens (or not) at the same time as before
+    struct parsed_expr *p = parse_expr("x + 1/0", &info);
+    if (!p) FAIL("parse_expr returned NULL on x + 1/0");
+    int is_const = expr_constant(p, &rslt);
+    int n_nodes = 0;
+    const struct token_stack_node *n;
+    for (n = p->start; n != NULL; n = n->next) n_nodes++;
+    free_parsed_expr(p);
+    if (is_const || n_nodes != 5) FAIL("x + 1/0 was folded");
+})
+
+// Functions take their arguments in brackets, separated by commas
+EX_TEST(function_arguments, {
+    struct parsed_expr *p = parse_expr("cycles(a, b+(1,2)) + 1", &info);
+    if (p) FAILC("comma in plain brackets was accepted", free_parsed_expr(p));
+    
+    p = parse_expr("1, 2", &info);
+    if (p) FAILC("comma outside of any brackets was accepted", free_parsed_expr(p));
+    
+    p = parse_expr("high cycles(a, b+1) + 1", &info);
+    if (!p) FAIL("parse_expr returned NULL");
+    if (!contains_functions(p)) FAILC("function not found", free_parsed_expr(p));
+    
+    // the arguments come first, then the function, then what is applied to its result
+    const char *order = "a b 1 + cycles high 1 + ";
+    char buf[64];
+    buf[0] = 0;
+    const struct token_stack_node *n;
+    for (n = p->start; n != NULL; n = n->next) {
+        if (n->token->type == NUMBER) snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%d ", n->token->value);
+        else snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%s ", n->token->text);
+    }
+    free_parsed_expr(p);
+    if (strcmp(buf, order)) FAIL("order is '%s' instead of '%s'", buf, order);
+})
@@ -0,0 +1,60 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the functions in object.c
+
+// Macro: assemble a source file as an object, and write it to a file
+#define ASSEMBLE_OBJECT(src, objfile) do { \
+    struct asmstate *s = init_asmstate(); \
+    struct line *l; \
+    FILE *f; \
+    s->object = TRUE; \
+    if ((l = assemble(s, src)) == NULL) FAIL("assembly failed on %s", src); \
+    if (!complete(s, l)) FAIL("complete() failed on %s", src); \
+    if ((f = fopen(objfile, "w")) == NULL) FAIL("could not write %s", objfile); \
+    if (!write_object(f, s, l, src)) FAIL("write_object() failed on %s", src); \
+    fclose(f); \
+    free_line(l, TRUE); \
+    free_asmstate(s); \
+} while(0)
+
+TEST(object_link
+,   /*startup*/
+    struct objmodule *modules = NULL;
+    unsigned char *outbin = malloc(MEMSZ);
+    unsigned char *match = malloc(MEMSZ);
+    char mainobj[] = "/tmp/test_asm8085_XXXXXX";
+    char libobj[] = "/tmp/test_asm8085_XXXXXX";
+    int fd1 = mkstemp(mainobj);
+    int fd2 = mkstemp(libobj);
+    FILE *matchfile = NULL;
+    size_t filesize = 0;
+    size_t outsize = 0;
+,   /*shutdown*/
+    free_objmodules(modules);
+    free(outbin);
+    free(match);
+    if (matchfile) fclose(matchfile);
+    unlink(mainobj);
+    unlink(libobj);
+,   /*test*/
+{
+    if (fd1 == -1 || fd2 == -1) FAIL("could not create temporary files");
+    close(fd1);
+    close(fd2);
+    
+    ASSEMBLE_OBJECT("test_inputs/object_main.asm", mainobj);
+    ASSEMBLE_OBJECT("test_inputs/object_lib.asm", libobj);
+    
+    // The main module on its own refers to names that are not defined
+    if ((modules = read_object(mainobj)) == NULL) FAIL("could not read %s", mainobj);
+    if (link_objects(modules, 0x100, outbin, &outsize)) FAIL("linking with undefined names succeeded");
+    
+    // Together, they should link
+    if ((modules->next = read_object(libobj)) == NULL) FAIL("could not read %s", libobj);
+    if (!link_objects(modules, 0x100, outbin, &outsize)) FAIL("linking failed");
+    
+    if (!(matchfile = fopen("test_inputs/object_link.bin", "r"))) FAIL("could not open object_link.bin");
+    filesize = fread(match, 1, MEMSZ, matchfile);
+    if (filesize != outsize) FAIL("size does not match - %zu != %zu", filesize, outsize);
+    if (memcmp(match, outbin, outsize)) FAIL("linked output does not match");
+})
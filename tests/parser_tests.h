@@ -183,6 +183,30 @@ TEST(parse_register, (void)0, (void)0, {
     TEST_RP(H);
     TEST_RP(SP);
     TEST_RP(PSW);
+    
+    // surrounding whitespace is allowed, anything else isn't
+    if (parse_reg(" a\t") != RA) FAIL("register with whitespace not recognized");
+    if (parse_reg_pair("  Psw ") != RPPSW) FAIL("register pair with whitespace not recognized");
+    if (parse_reg("ab") != R_INV) FAIL("'ab' recognized as a register");
+    if (parse_reg("a b") != R_INV) FAIL("'a b' recognized as a register");
+    if (parse_reg_pair("s") != RP_INV) FAIL("'s' recognized as a register pair");
+    if (parse_reg_pair("pswx") != RP_INV) FAIL("'pswx' recognized as a register pair");
+})
+
+// Register arguments should not get their own copy of the text
+TEST(parse_register_argmts, struct line *line = NULL, if(line != NULL) free_line(line, FALSE), {
+    char error = FALSE;
+    line = parse_line_part(FALSE, "  mov A , b ; comment", NULL, "test", &error);
+    if (error) FAIL("parsing line gave error");
+    TEST_N_ARGMTS(2);
+    if (!line->argmts->shared_text || strcmp(line->argmts->raw_text, "A")) FAIL("first argument not shared: '%s'", line->argmts->raw_text);
+    if (!line->argmts->next_argmt->shared_text) FAIL("second argument not shared");
+    free_line(line, FALSE);
+    
+    line = parse_line_part(FALSE, "  mvi a, b+1", NULL, "test", &error);
+    if (error) FAIL("parsing line gave error");
+    if (line->argmts->next_argmt->shared_text) FAIL("expression shares its text");
+    if (strcmp(line->argmts->next_argmt->raw_text, "b+1")) FAIL("expected 'b+1', got '%s'", line->argmts->next_argmt->raw_text);
 })
 
 // Parse a string
@@ -203,9 +227,10 @@ TEST(parse_string, char *s = NULL, if(s!=NULL) free(s), {
     TEST_STRING("\xD\xE\xA\xD\xBE\xEF");
 }) 
 
-// See if we can read a file
+// See if we can read a file (the lines are only scanned, so finish them first)
 #define TEST_F_LINE(code) do { \
     if (line == NULL) FAIL("line was NULL"); \
+    if (!finish_line(line)) FAIL("could not finish line: %s", line->raw_text); \
     code; \
     line = line->next_line; \
 } while(0)
@@ -246,6 +271,95 @@ TEST(parse_file,
     if (line != NULL) FAIL("spurious extra line: '%s'", line->raw_text);
 })
 
+// Reading a file should only find the directives; arguments are parsed when the line is finished
+TEST(scan_file, 
+    /* startup */
+    struct line *start = NULL;
+    struct line *line = NULL;
+    char tempfile[] = "/tmp/test_asm8085_XXXXXX";
+    /* shutdown */
+,   if (start != NULL) free_line(start, TRUE);
+    unlink(tempfile); 
+    /* test */
+, {
+    int fd = mkstemp(tempfile);
+    if (fd == -1) FAIL("could not create temporary file");
+    FILE *f = fdopen(fd, "w");
+    fputs("       if     0         \n",f);
+    fputs("label  mov    a,(b      \n",f);
+    fputs("       endif  ; comment \n",f);
+    fclose(f);
+    
+    // the unbalanced bracket is not seen yet
+    if ((start = read_file(tempfile)) == NULL) FAIL("error reading file");
+    line = start;
+    
+    if (!line->pending || line->instr.type != DIRECTIVE || line->instr.instr != DIR_if) FAIL("'if' not scanned");
+    line = line->next_line;
+    if (!line->pending || line->instr.type != NONE || line->n_argmts != 0) FAIL("'mov' was parsed");
+    TEST_LABEL("label");
+    line = line->next_line;
+    if (!line->pending || line->instr.type != DIRECTIVE || line->instr.instr != DIR_endif) FAIL("'endif' not scanned");
+    
+    // finishing the lines should parse them
+    if (!finish_line(start) || start->n_argmts != 1) FAIL("'if' not finished");
+    if (finish_line(start->next_line)) FAIL("unbalanced bracket not found");
+    if (!finish_line(line) || line->n_argmts != 0 || line->pending) FAIL("'endif' not finished");
+})
+
+// Reading a file on several threads should give the same lines as reading it on one
+TEST(read_file_threads, 
+    /* startup */
+    struct line *single = NULL;
+    struct line *threaded = NULL;
+    struct line *a = NULL;
+    struct line *b = NULL;
+    char tempfile[] = "/tmp/test_asm8085_XXXXXX";
+    /* shutdown */
+,   if (single != NULL) free_line(single, TRUE);
+    if (threaded != NULL) free_line(threaded, TRUE);
+    unlink(tempfile); 
+    /* test */
+, {
+    int i;
+    int j;
+    int n;
+    int fd = mkstemp(tempfile);
+    if (fd == -1) FAIL("could not create temporary file");
+    FILE *f = fdopen(fd, "w");
+    for (i=0; i<200; i++) {
+        if (i%10 == 0) fprintf(f, "top%d:\r\n", i);
+        fprintf(f, ".loc%d  mvi a,%d ! inr a ; comment\n", i, i);
+        if (i%7 == 0) fputs("\n", f);
+        if (i%50 == 0) {
+            // longer than the line buffer
+            fputs("       db 1", f);
+            for (j=0; j<300; j++) fputs(",1", f);
+            fputs("\n", f);
+        }
+    }
+    fputs("last   nop", f);
+    fclose(f);
+    
+    if ((single = read_file_threads(tempfile, 1)) == NULL) FAIL("error reading file");
+    for (n=2; n<=8; n++) {
+        if ((threaded = read_file_threads(tempfile, n)) == NULL) FAIL("error reading file on %d threads", n);
+        for (a = single, b = threaded, i = 1; a != NULL && b != NULL; a = a->next_line, b = b->next_line, i++) {
+            if (strcmp(a->raw_text, b->raw_text)
+             || a->info.lineno != b->info.lineno
+             || strcmp(a->info.lastlabel ? a->info.lastlabel : "-", b->info.lastlabel ? b->info.lastlabel : "-")
+             || strcmp(a->label ? a->label : "-", b->label ? b->label : "-")
+             || a->instr.type != b->instr.type || a->pending != b->pending || a->pending_at != b->pending_at) {
+                FAIL("%d threads: line %d differs: '%s' (%d) vs '%s' (%d)", n, i, 
+                     a->raw_text, a->info.lineno, b->raw_text, b->info.lineno);
+            }
+        }
+        if (a != NULL || b != NULL) FAIL("%d threads: different number of lines", n);
+        free_line(threaded, TRUE);
+        threaded = NULL;
+    }
+})
+
 // Test argument parser
 #define TEST_PARSE_ARGMT_CHOICE(typein, typeout) do { \
     if (! parse_argmt(typein, argmt, &l)) { \
@@ -0,0 +1,118 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the file cache in filecache.c and the server in server.c
+
+// (this file is included more than once, but the job must only be defined once)
+#ifndef __SERVER_TESTS_H__
+#define __SERVER_TESTS_H__
+
+// A job: return the number in argv[1], if it runs in the directory in argv[2]
+static int test_job(int argc, char **argv) {
+    char cwd[PATH_MAX];
+    if (argc != 3 || getcwd(cwd, PATH_MAX) == NULL || strcmp(cwd, argv[2])) return 100;
+    return atoi(argv[1]);
+}
+
+#endif
+
+// Macro: count the lines in a list
+#define COUNT_LINES(l, n) do { \
+    const struct line *_l; \
+    for (n = 0, _l = (l); _l != NULL; _l = _l->next_line) n++; \
+} while(0)
+
+TEST(filecache
+,   /*startup*/
+    char dir[] = "/tmp/test_asm8085_XXXXXX";
+    char path[PATH_MAX];
+    char cmd[PATH_MAX + 16];
+    struct line *lines = NULL;
+    int made = mkdtemp(dir) != NULL;
+    int n;
+    FILE *f;
+,   /*shutdown*/
+    filecache_free();
+    if (lines) free_line(lines, TRUE);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (made && system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+,   /*test*/
+{
+    if (!made) FAIL("could not create temporary directory");
+    WRITE_TEST_FILE("lib.asm", "\tdb 1\n\tdb 2\n");
+    
+    // Nothing is cached until it is loaded
+    if ((lines = filecache_get(path)) != NULL) FAIL("file was cached before it was loaded");
+    filecache_load(path);
+    
+    // read_file() now gets a copy
+    if ((lines = read_file(path)) == NULL) FAIL("read_file() failed");
+    COUNT_LINES(lines, n);
+    if (n != 2) FAIL("%d lines instead of 2", n);
+    if (strcmp(lines->info.filename, path)) FAIL("wrong file name: %s", lines->info.filename);
+    free_line(lines, TRUE);
+    if ((lines = filecache_get(path)) == NULL) FAIL("file is not cached");
+    free_line(lines, TRUE);
+    
+    // Once the file changes, it has to be read again
+    WRITE_TEST_FILE("lib.asm", "\tdb 1\n\tdb 2\n\tdb 3\n");
+    if ((lines = filecache_get(path)) != NULL) FAIL("changed file was still cached");
+    filecache_load(path);
+    if ((lines = filecache_get(path)) == NULL) FAIL("changed file was not cached again");
+    COUNT_LINES(lines, n);
+    if (n != 3) FAIL("%d lines instead of 3", n);
+})
+
+TEST(server_job
+,   /*startup*/
+    char dir[] = "/tmp/test_asm8085_XXXXXX";
+    char path[PATH_MAX];
+    char cwd[PATH_MAX];
+    char *argv[4];
+    int made = mkdtemp(dir) != NULL;
+    int status = -1;
+    int tries;
+    struct stat st;
+    mode_t mask;
+    pid_t pid = -1;
+,   /*shutdown*/
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    if (made) rmdir(dir);
+,   /*test*/
+{
+    if (!made) FAIL("could not create temporary directory");
+    if (getcwd(cwd, PATH_MAX) == NULL) FAIL("could not get working directory");
+    snprintf(path, PATH_MAX, "%s/sock", dir);
+    argv[0] = "asm8085";
+    argv[1] = "42";
+    argv[2] = cwd;
+    argv[3] = NULL;
+    
+    // There is no server yet
+    if (run_client(path, 3, argv) != -1) FAIL("client found a server that is not there");
+    
+    // (with a umask that would let anyone use the socket)
+    mask = umask(0);
+    if ((pid = fork()) == 0) exit(run_server(path, test_job) ? 0 : 1);
+    umask(mask);
+    if (pid == -1) FAIL("could not fork");
+    
+    // The job runs in the client's directory, and its exit status comes back
+    for (tries = 0; tries < 200 && (status = run_client(path, 3, argv)) == -1; tries++) usleep(10000);
+    if (status != 42) FAIL("job returned %d instead of 42", status);
+    
+    // Only this user can use the socket
+    if (stat(path, &st) != 0) FAIL("could not stat socket");
+    if (st.st_mode & 077) FAIL("socket mode is %o", (unsigned) (st.st_mode & 0777));
+    
+    argv[1] = "7";
+    if ((status = run_client(path, 3, argv)) != 7) FAIL("second job returned %d instead of 7", status);
+    
+    // Once the server stops, the socket is gone
+    kill(pid, SIGTERM);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) FAIL("server did not stop cleanly");
+    pid = -1;
+    if (access(path, F_OK) == 0) FAIL("socket was left behind");
+})
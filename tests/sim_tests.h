@@ -0,0 +1,129 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the simulator in sim.c
+
+// (this file is included more than once, but the port functions must only be defined once)
+#ifndef __SIM_TESTS_H__
+#define __SIM_TESTS_H__
+
+// Port input: read the port number plus one
+static int test_port_in(struct sim *s, int port) {
+    (void) s;
+    return port + 1;
+}
+
+// Port output: remember the port and the value in ctx
+static void test_port_out(struct sim *s, int port, int value) {
+    int *last = s->ctx;
+    last[0] = port;
+    last[1] = value;
+}
+
+#endif
+
+// Macro: assemble a test input, and load it into the simulator
+#define SIM_LOAD(name) do { \
+    if ((lines = assemble(state, "test_inputs/" name)) == NULL) FAIL("assembly failed on %s", name); \
+    if (!complete(state, lines)) FAIL("complete() failed on %s", name); \
+    s->pc = make_image(lines, s->mem); \
+} while(0)
+
+TEST(sim_8085
+,   /*startup*/
+    struct asmstate *state = init_asmstate();
+    struct line *lines = NULL;
+    struct sim *s = init_sim(8085);
+    char output[16];
+    int last_out[2];
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+,   /*shutdown*/
+    free_sim(s);
+    free_asmstate(state);
+    if (lines) free_line(lines, TRUE);
+    if (in) fclose(in);
+    if (out) fclose(out);
+,   /*test*/
+{
+    if (in == NULL || out == NULL) FAIL("could not open temporary files");
+    SIM_LOAD("simtest.asm");
+    
+    // Stop after the first three instructions
+    if (sim_run(s, 3)) FAIL("halted within three instructions");
+    if (s->instructions != 3) FAIL("ran %llu instructions instead of 3", (unsigned long long) s->instructions);
+    if (s->states != 10+10+7) FAIL("took %llu T-states instead of 27", (unsigned long long) s->states);
+    if (s->pc != 0x48) FAIL("stopped at %04x instead of 0048", s->pc);
+    
+    // Then run the rest, with the console and ports connected
+    fputs("x", in);
+    rewind(in);
+    s->console_in = in;
+    s->console_out = out;
+    s->in = test_port_in;
+    s->out = test_port_out;
+    s->ctx = last_out;
+    
+    if (!sim_run(s, 0)) FAIL("did not halt");
+    if (s->r[RA] != 0) FAIL("test %d failed", s->r[RA]);
+    if (last_out[0] != 0x10 || last_out[1] != 0x99) FAIL("wrong output to port: %x, %x", last_out[0], last_out[1]);
+    
+    rewind(out);
+    if (fgets(output, sizeof(output), out) == NULL) output[0] = '\0';
+    if (strcmp(output, "okx\n")) FAIL("wrong console output: '%s'", output);
+})
+
+TEST(sim_8080
+,   /*startup*/
+    struct asmstate *state = init_asmstate();
+    struct line *lines = NULL;
+    struct sim *s = init_sim(8080);
+,   /*shutdown*/
+    free_sim(s);
+    free_asmstate(state);
+    if (lines) free_line(lines, TRUE);
+,   /*test*/
+{
+    SIM_LOAD("simtest8080.asm");
+    if (!sim_run(s, 1000)) FAIL("did not halt");
+    if (s->r[RA] != 0) FAIL("test %d failed", s->r[RA]);
+})
+
+TEST(sim_profile
+,   /*startup*/
+    struct asmstate *state = init_asmstate();
+    struct line *lines = NULL;
+    struct sim *s = init_sim(8085);
+    char *report = calloc(1, 8192);
+    FILE *out = tmpfile();
+,   /*shutdown*/
+    free_sim(s);
+    free(report);
+    free_asmstate(state);
+    if (lines) free_line(lines, TRUE);
+    if (out) fclose(out);
+,   /*test*/
+{
+    if (out == NULL) FAIL("could not open temporary file");
+    SIM_LOAD("simprofile.asm");
+    init_profile(s);
+    if (!sim_run(s, 0)) FAIL("did not halt");
+    
+    // 'jnz loop' runs ten times, and is taken nine times
+    if (s->profile[0x0F].instructions != 10) FAIL("wrong count: %llu", (unsigned long long) s->profile[0x0F].instructions);
+    if (s->profile[0x0F].states != 9*10 + 7) FAIL("wrong T-states: %llu", (unsigned long long) s->profile[0x0F].states);
+    
+    write_profile(out, lines, s);
+    rewind(out);
+    if (fread(report, 1, 8191, out) == 0) FAIL("no report was written");
+    
+    if (!strstr(report, "Profile: 564 instructions, 4023 T-states\n")) FAIL("wrong totals");
+    if (!strstr(report, "        2440   60.7%           250  simprofile.asm: [delay]:6: \tjnz\t_delay_1_again\n")) {
+        FAIL("wrong time for a line");
+    }
+    if (!strstr(report, "         770   19.1%           110  _delay_2_again\n")) FAIL("wrong time for a label");
+    if (!strstr(report, "          70    1.7%            10  work\n")) FAIL("wrong time for a label");
+    if (!strstr(report, "         740   18.4%           110  simprofile.asm: [delay], expansion 2 (at 0014)\n")) {
+        FAIL("wrong time for a macro expansion");
+    }
+    if (!strstr(report, "          97            10  000F:  \tjnz\tloop\n")) FAIL("wrong listing");
+})
@@ -0,0 +1,36 @@
+	;; This file tests cycles() and mincycles()
+	
+	org	100h
+	
+isr	push	psw
+	push	h
+	lxi	h,count
+	inr	m
+	pop	h
+	pop	psw
+	ei
+	ret
+isr_end
+	assert	cycles(isr, isr_end) == 12+12+10+10+10+10+4+10, "wrong time for isr"
+	assert	mincycles(isr, isr_end) == cycles(isr, isr_end)
+	assert	cycles(isr, isr) == 0
+
+	;; conditional instructions count as taken in cycles(), and not taken in mincycles()
+loop	dcr	c
+	jnz	loop
+	rz
+done	hlt
+	assert	cycles(loop, done) == 4+10+12
+	assert	mincycles(loop, done) == 4+7+6
+	
+	;; an 'equ' that uses cycles() is resolved once all the code is there
+looptime equ	cycles(loop, done)
+	assert	looptime == 26
+	db	looptime
+
+	cpu	8080
+slow	mov	a,b
+	cz	slow
+slow_end
+	assert	cycles(slow, slow_end) + mincycles(slow, slow_end) == 5+17 + 5+11
+count	db	0
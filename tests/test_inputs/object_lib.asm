@@ -0,0 +1,12 @@
+; Library module for the object and linker test
+	extern	start
+	public	print, msglen
+msglen	equ	2
+print:	mov	a,m
+	out	1
+	inx	h
+	dcr	b
+	jnz	print
+	ret
+back	equ	start + 3
+	dw	back
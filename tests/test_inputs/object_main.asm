@@ -0,0 +1,9 @@
+; Main module for the object and linker test
+	extern	print, msglen
+	public	start
+start:	lxi	h,message
+	mvi	b,msglen
+	call	print
+	jmp	start
+message:	db	"Hi"
+	assert	msglen == $ - message, "message length"
@@ -0,0 +1,23 @@
+	;; This file tests the peephole rules (-O). See peephole.bin for what it should become.
+
+	lxi	sp,0
+start	mvi	a,0
+	mov	b,a
+	ora	a		; flags set again: mvi a,0 can become xra a
+	mvi	a,00h
+	jz	start		; Z is needed: must stay
+	mov	a,a
+	call	sub1
+	ret
+sub1	jmp	sub2
+sub2	call	sub3
+lbl	ret			; has a label: must stay
+sub3	mvi	a,0
+	hlt
+	jmp	.loc
+.loc	mvi	c,0
+	jmp	other
+x	nop
+other	nop
+	mvi	a,1-1	; a constant zero too
+	ora	a
@@ -0,0 +1,27 @@
+; pooldb: each distinct string is stored once, in the next pool
+x	equ	hello + 1	; before hello is known
+	lxi	h, hello
+	lxi	d, world
+	lxi	b, again
+	jmp	done
+hello:	pooldb	"Hello, world!", 0
+world:	pooldb	"world!", 0	; the end of hello
+again:	pooldb	"Hello, world!", 0	; the same as hello
+other:	pooldb	1, 2, 3
+	pooldb	2, 3	; no label, and the end of other
+table:	dw	hello, other
+pool1:	pool
+done:	hlt
+
+; a second pool only has what came after the first
+first:
+.msg:	pooldb	"Hello, world!", 0
+pool2:	pool
+
+	assert	hello == pool1
+	assert	x == hello + 1
+	assert	again == hello
+	assert	world == hello + 7
+	assert	other == pool1 + 14
+	assert	first.msg == pool2
+	assert	done == pool1 + 17
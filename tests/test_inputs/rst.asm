@@ -0,0 +1,36 @@
+; --rst: the most called routines get the vectors from 08h up to 1Fh
+	jmp	start
+	ds	5
+	rstslots	3
+start:	lxi	sp, 0
+	lxi	h, 0
+	mvi	b, 100
+	call	rare
+loop:	call	bump
+	call	bump
+	call	twice
+	call	long
+	dcr	b
+	jnz	loop
+	mov	a, l
+	hlt
+	call	never
+	call	never
+
+bump:	inx	h
+	ret
+twice:	dad	h
+	ret
+long:	mov	a, h
+	ani	0
+	mov	h, a
+	mov	a, l
+	ora	a
+	nop
+	nop
+	ret
+rare:	lxi	d, 0
+	lxi	d, 0
+	lxi	d, 0
+	ret
+never:	ret
@@ -0,0 +1,57 @@
+; Sections that nothing outside them uses are left out
+
+        org 100h
+start:  lxi sp,0
+        call used
+        lxi h,table
+        hlt
+
+        section
+used:   call helper     ; 10Ah
+        ret
+        endsection
+
+; only used by a section that is left out itself
+        section
+unused: call helper
+        call unused2
+        ret
+        endsection
+
+helper: section         ; 10Eh
+        mvi a,3
+.loop:  dcr a
+        jnz .loop
+        ret
+        endsection
+
+        section
+unused2:
+        ret
+        endsection
+
+; a local name on its own keeps nothing else in the program
+        section
+loop:   ret
+        endsection
+
+        section
+table:  dw used         ; 115h
+        endsection
+
+; a section without labels cannot be used
+        section
+        db 1,2,3
+        endsection
+
+after:  equ $           ; 117h
+
+; a macro used outside the section it is defined in keeps that section
+        section
+twice   macro x
+        db #x,#x
+        endm
+pair:   db 0            ; 117h
+        endsection
+        twice 9         ; 118h
+end:    equ $           ; 11Ah
@@ -0,0 +1,36 @@
+	;; Check A and the flags after a test in the simulator. Use as:
+	;;	call	check
+	;;	db	test, a, flags, mask
+	;; If they are wrong, the program stops with the test number in A.
+	;; DE is used, everything else is kept.
+
+check	shld	savehl
+	pop	h
+	push	psw
+	pop	d		; D = A, E = flags
+	mov	a,m
+	sta	testno
+	inx	h
+	mov	a,d
+	cmp	m
+	jnz	failed
+	inx	h
+	mov	a,e
+	inx	h
+	ana	m		; only the flags under the mask
+	dcx	h
+	cmp	m
+	jnz	failed
+	inx	h
+	inx	h
+	push	h		; return past the data
+	push	d
+	pop	psw		; give back A and the flags
+	lhld	savehl
+	ret
+
+failed	lda	testno
+	hlt
+
+savehl	dw	0
+testno	db	0
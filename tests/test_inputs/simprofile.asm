@@ -0,0 +1,21 @@
+	;; This file is run in the simulator to test the profile
+
+delay	macro	n
+	mvi	c,#n
+@again	dcr	c
+	jnz	@again
+	endm
+
+	lxi	sp,0
+main	mvi	b,10
+loop
+	delay	20
+	call	work
+	dcr	b
+	jnz	loop
+	xra	a
+	hlt
+
+work
+	delay	5
+	ret
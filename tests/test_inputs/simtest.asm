@@ -0,0 +1,192 @@
+	;; This file tests the simulator (on an 8085). It stops with A = 0 if all is well,
+	;; or with the number of the test that failed.
+
+CONSOLE	equ	0FF00h
+
+	org	0
+	jmp	start
+
+	org	40h		; 'rstv' goes here
+	mvi	a,55h
+	ret
+
+start	lxi	sp,0
+
+	;; add, with signed overflow
+	mvi	a,7Fh
+	adi	1
+	call	check
+	db	1, 80h, 92h, 0FFh
+
+	;; subtract, with borrow
+	mvi	a,0
+	sui	1
+	call	check
+	db	2, 0FFh, 0A5h, 0EFh
+
+	;; decimal adjust
+	mvi	a,9Bh
+	ora	a
+	daa
+	call	check
+	db	3, 01h, 11h, 0D5h
+
+	;; and (always sets AC on the 8085)
+	mvi	a,0F0h
+	ani	3Ch
+	call	check
+	db	4, 30h, 14h, 0D5h
+
+	;; rotate
+	mvi	a,81h
+	rlc
+	call	check
+	db	5, 03h, 01h, 01h
+	ral
+	call	check
+	db	5, 07h, 00h, 01h
+
+	;; 16-bit add
+	lxi	h,0FFFFh
+	lxi	b,2
+	dad	b
+	mov	a,l
+	call	check
+	db	6, 01h, 01h, 01h
+
+	;; 16-bit subtract
+	lxi	h,1000h
+	lxi	b,1001h
+	dsub
+	mov	a,h
+	call	check
+	db	7, 0FFh, 01h, 01h
+
+	;; arithmetic shift right of HL
+	lxi	h,8001h
+	arhl
+	mov	a,h
+	call	check
+	db	8, 0C0h, 01h, 01h
+
+	;; rotate DE left through carry
+	lxi	d,8001h
+	ora	a
+	rdel
+	mov	a,e
+	call	check
+	db	9, 02h, 01h, 01h
+
+	;; DE = HL + byte, DE = SP + byte
+	lxi	h,1234h
+	ldhi	10h
+	mov	a,e
+	call	check
+	db	10, 44h, 00h, 00h
+	ldsi	2
+	mov	a,e
+	call	check
+	db	10, 02h, 00h, 00h
+
+	;; store and load HL at DE
+	lxi	d,buf
+	lxi	h,5678h
+	shlx
+	lxi	h,0
+	lxi	d,buf
+	lhlx
+	mov	a,h
+	call	check
+	db	11, 56h, 00h, 00h
+	lda	buf
+	call	check
+	db	11, 78h, 00h, 00h
+
+	;; K is set when a register pair wraps around
+	lxi	b,0
+	dcx	b
+	jk	ok12
+	mvi	a,12
+	hlt
+ok12	inx	b
+	jnk	fail12
+	inx	b
+	jk	fail12
+	jmp	ok12b
+fail12	mvi	a,12
+	hlt
+ok12b
+
+	;; restart on overflow
+	mvi	a,7Fh
+	adi	1
+	rstv
+	call	check
+	db	13, 55h, 00h, 00h
+
+	;; stack
+	lxi	h,1234h
+	push	h
+	lxi	h,0
+	xthl
+	pop	d
+	mov	a,d
+	ora	e
+	call	check
+	db	14, 00h, 00h, 00h
+	mov	a,l
+	call	check
+	db	14, 34h, 00h, 00h
+
+	;; compare
+	mvi	a,5
+	cpi	5
+	call	check
+	db	15, 05h, 40h, 41h
+	cpi	6
+	call	check
+	db	15, 05h, 81h, 0C1h
+
+	;; increment memory
+	lxi	h,buf
+	mvi	m,0FFh
+	stc
+	inr	m
+	mov	a,m
+	call	check
+	db	16, 00h, 55h, 0D5h
+
+	;; conditional calls and returns
+	xra	a
+	cnz	sub17
+	cz	sub17
+	call	check
+	db	17, 01h, 00h, 00h
+
+	;; port I/O
+	mvi	a,99h
+	out	10h
+	in	20h
+	call	check
+	db	18, 21h, 00h, 00h
+
+	;; console: write "ok", the character read, and a newline
+	mvi	a,'o'
+	sta	CONSOLE
+	mvi	a,'k'
+	sta	CONSOLE
+	lda	CONSOLE+1
+	sta	CONSOLE
+	mvi	a,10
+	sta	CONSOLE
+
+	xra	a
+	hlt
+
+sub17	rnz
+	inr	a
+	ret
+
+	include	"simcheck.asm"
+
+buf	dw	0
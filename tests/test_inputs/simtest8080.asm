@@ -0,0 +1,40 @@
+	;; This file tests the simulator on an 8080. It stops with A = 0 if all is well,
+	;; or with the number of the test that failed.
+
+	cpu	8080
+	lxi	sp,0
+
+	;; and sets AC from bit 3 of the operands, and bit 1 of the flags is always set
+	mvi	a,08h
+	ani	0
+	call	check
+	db	1, 00h, 56h, 0D7h
+	mvi	a,0F0h
+	ani	3Ch
+	call	check
+	db	1, 30h, 16h, 0D7h
+
+	;; overflow does not set any flag
+	mvi	a,7Fh
+	adi	1
+	call	check
+	db	2, 80h, 92h, 0F7h
+
+	;; the 8085's extra opcodes are copies of jmp, call, ret and nop
+	db	0CBh
+	dw	ok3
+	mvi	a,3
+	hlt
+ok3	db	0DDh
+	dw	sub4
+	db	10h
+	call	check
+	db	4, 44h, 00h, 00h
+
+	xra	a
+	hlt
+
+sub4	mvi	a,44h
+	db	0D9h
+
+	include	"simcheck.asm"
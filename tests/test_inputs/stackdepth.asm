@@ -0,0 +1,57 @@
+; stackdepth() follows the calls of a routine, and counts what it pushes
+
+        org 0
+reset:  jmp start
+
+        org 38h         ; rst 7
+isr:    push psw
+        push h
+        call leaf
+        pop h
+        pop psw
+        ei
+        ret
+
+; the depths can be used ahead of the code, and in an 'equ'
+depth:  db stackdepth(main), maindepth
+maindepth equ stackdepth(main)
+
+        org 100h
+start:  lxi sp,stack
+        ei
+        call main
+        hlt
+
+main:   push b
+        call middle
+        pop b
+        rst 7
+        ret
+
+middle: push d
+        push h
+        cz leaf
+.loop:  dcr a
+        jnz .loop
+        pop h
+        pop d
+        ret
+
+leaf:   xthl
+        ret
+
+; recursion has no bound
+fact:   dcr a
+        rz
+        call fact
+        ret
+
+        ds 32
+stack:
+
+        assert stackdepth(leaf) == 0
+        assert stackdepth(middle) == 2 + 2 + 2
+        assert stackdepth(isr) == 2 + 2 + 2
+        assert stackdepth(main) == 2 + 2 + stackdepth(middle)
+        assert stackdepth(start) == 2 + stackdepth(main)
+        assert stackdepth(reset) == stackdepth(start)
@@ -9,12 +9,21 @@
 // Include all the headers
 #include "../assembler.h"
 #include "../bin_output.h"
+#include "../cache.h"
+#include "../deps.h"
 #include "../dirstack.h"
 #include "../expr_fns.h"
 #include "../expression.h"
+#include "../filecache.h"
+#include "../listing.h"
 #include "../macro.h"
+#include "../object.h"
 #include "../parser.h"
 #include "../parser_types.h"
+#include "../profile.h"
+#include "../server.h"
+#include "../sim.h"
+#include "../trace.h"
 #include "../util.h"
 #include "../varspace.h"
 
@@ -10,4 +10,10 @@
 #include "dirstack_tests.h"
 #include "directive_tests.h"
 #include "bin_tests.h"
+#include "trace_tests.h"
+#include "object_tests.h"
+#include "deps_tests.h"
+#include "cache_tests.h"
+#include "sim_tests.h"
+#include "server_tests.h"
 
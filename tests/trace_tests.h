@@ -0,0 +1,54 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+// This file contains tests for the functions in trace.c
+
+// Macro: count the occurrences of a string in the trace file
+#define COUNT_IN_TRACE(needle, n) do { \
+    char buf[1024], *p; \
+    FILE *f = fopen(tempfile, "r"); \
+    if (f == NULL) FAIL("could not read trace file"); \
+    for (n = 0; fgets(buf, 1024, f) != NULL; ) \
+        for (p = buf; (p = strstr(p, needle)) != NULL; p++) n++; \
+    fclose(f); \
+} while(0)
+
+TEST(trace_spans
+,   /*startup*/
+    struct asmstate *state = NULL;
+    struct line *lines = NULL;
+    char tempfile[] = "/tmp/test_asm8085_XXXXXX";
+    int fd = mkstemp(tempfile);
+    int b = 0;
+    int e = 0;
+    int n = 0;
+,   /*shutdown*/
+    trace_close();
+    if(state) free_asmstate(state);
+    if(lines) free_line(lines, TRUE);
+    unlink(tempfile);
+,   /*test*/
+{
+    if (fd == -1) FAIL("could not create temporary file");
+    close(fd);
+    if (!trace_open(tempfile)) FAIL("could not open trace file");
+    
+    state = init_asmstate();
+    lines = assemble(state, "test_inputs/repeats.asm");
+    if (lines == NULL) FAIL("assembly failed");
+    if (!complete(state, lines)) FAIL("complete() failed");
+    trace_close();
+    
+    // Every span that was begun must have been ended
+    COUNT_IN_TRACE("\"ph\":\"B\"", b);
+    COUNT_IN_TRACE("\"ph\":\"E\"", e);
+    if (b <= 0) FAIL("no spans were written");
+    if (b != e) FAIL("%d spans begun, but %d ended", b, e);
+    
+    // 'rep' is expanded 10 times; the outer repeat runs once, and its inner repeat 5 times
+    COUNT_IN_TRACE("\"cat\":\"macro\"", n);
+    if (n != 10) FAIL("expected 10 macro spans, got %d", n);
+    COUNT_IN_TRACE("\"cat\":\"repeat\"", n);
+    if (n != 16) FAIL("expected 16 repeat spans, got %d", n);
+    COUNT_IN_TRACE("\"name\":\"complete\"", n);
+    if (n != 1) FAIL("expected one span for complete(), got %d", n);
+})
@@ -99,7 +99,64 @@ UTIL_TEST(string_replace, {
     
     // Test: string constants are left alone
     TEST_RPLC("meow 'meow' meow \"meow\"", "woof 'meow' woof \"meow\"");
+    TEST_RPLC("'it\\'s meow' meow", "'it\\'s meow' woof");
     
+    // Test: long strings (more than one block at a time)
+    TEST_RPLC("a long line with plenty of text before any of it is replaced: dog", 
+              "a long line with plenty of text before any of it is replaced: hippopotamus");
     
     
+    
+})
+
+// Patterns with the same first character should be tried longest first, and a template
+// should give exactly as many characters as it says
+UTIL_TEST(subst_template, {
+    const char *old[4];
+    const char *new[4];
+    size_t lengths[4];
+    int i;
+    struct subst_patterns *p;
+    struct subst_template *t;
+    
+    old[0] = "@";   new[0] = "_m_1_";
+    old[1] = "#a";  new[1] = "A";
+    old[2] = "#abc"; new[2] = "";
+    old[3] = "#ab"; new[3] = "ABABAB";
+    p = make_subst_patterns(old, 4);
+    t = make_subst_template("#abc#ab#a#x @x '#a\\'#a' #ab", p);
+    
+    for (i=0; i<4; i++) lengths[i] = strlen(new[i]);
+    if (t->n_pieces != 6) FAIL("template has %d pieces instead of 6", t->n_pieces);
+    
+    s = malloc(subst_size(t, lengths));
+    subst_apply(t, new, lengths, s);
+    if (strcmp(s, "ABABABA#x _m_1_x '#a\\'#a' ABABAB")) FAIL("template gave \"%s\"", s);
+    if (strlen(s) + 1 != subst_size(t, lengths)) FAIL("size %zu for a string of length %zu", subst_size(t, lengths), strlen(s));
+    
+    free_subst_template(t);
+    free_subst_patterns(p);
+})
+
+// Every position of the character, from every position in a block, should be found
+UTIL_TEST(scan_charset, {
+    char buf[160];
+    int start;
+    int pos;
+    struct charset set;
+    
+    set.n = 0;
+    if (!charset_add(&set, ';') || !charset_add(&set, '!') || !charset_add(&set, ';')) FAIL("cannot add to set");
+    if (set.n != 2) FAIL("set has %d characters instead of 2", set.n);
+    
+    for (start=0; start<64; start++) {
+        for (pos=start; pos<128; pos++) {
+            memset(buf, 'x', sizeof(buf));
+            buf[pos] = (pos & 1) ? ';' : '!';
+            buf[140] = '\0';
+            if (scan_charset(buf+start, &set) != buf+pos) FAIL("character at %d not found from %d", pos, start);
+        }
+        buf[pos-1] = 'x';
+        if (scan_charset(buf+start, &set) != buf+140) FAIL("terminator not found from %d", start);
+    }
 })
\ No newline at end of file
@@ -0,0 +1,133 @@
+/* asm8085 (C) 2021 Marinus Oosters */
+
+#include "trace.h"
+
+// A span that has been opened but not yet closed
+struct trace_span {
+    struct trace_span *prev;
+    const struct line *end; // line at which the span ends (if until is set)
+    char until;             // set if the span ends when a line is reached
+};
+
+static FILE *trace_file = NULL;
+static struct trace_span *span_top = NULL;
+static struct timespec trace_start;
+static char first_event = TRUE;
+
+// Microseconds since the trace was opened
+static double trace_time() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - trace_start.tv_sec) * 1e6 + (now.tv_nsec - trace_start.tv_nsec) / 1e3;
+}
+
+// Write a string as a JSON string literal
+static void write_json_string(const char *s) {
+    fputc('"', trace_file);
+    for (; s != NULL && *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(trace_file, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20) fprintf(trace_file, "\\u%04x", (unsigned char) *s);
+        else fputc(*s, trace_file);
+    }
+    fputc('"', trace_file);
+}
+
+// Start a new event record
+static void write_event_start(char phase) {
+    fprintf(trace_file, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":1,\"ts\":%.3f",
+            first_event ? "\n" : ",\n", phase, trace_time());
+    first_event = FALSE;
+}
+
+int trace_open(const char *filename) {
+    if ((trace_file = fopen(filename, "w")) == NULL) return FALSE;
+
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    first_event = TRUE;
+
+    fprintf(trace_file, "[");
+    write_event_start('M');
+    fprintf(trace_file, ",\"name\":\"process_name\",\"args\":{\"name\":\"asm8085\"}}");
+    return TRUE;
+}
+
+int trace_enabled() {
+    return trace_file != NULL;
+}
+
+void trace_close() {
+    if (trace_file == NULL) return;
+
+    // End all spans that are still open (e.g. because assembly stopped with an error)
+    while (span_top != NULL) trace_end();
+
+    fprintf(trace_file, "\n]\n");
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+// Push a span and write its begin event
+static void begin_span(const struct line *end, char until, const char *cat, const char *name,
+                       const struct line *at, const char *arg, int value) {
+    struct trace_span *s = malloc(sizeof(struct trace_span));
+    if (s == NULL) FATAL_ERROR("failed to allocate memory for trace span");
+    s->end = end;
+    s->until = until;
+    s->prev = span_top;
+    span_top = s;
+
+    write_event_start('B');
+    fprintf(trace_file, ",\"cat\":");
+    write_json_string(cat);
+    fprintf(trace_file, ",\"name\":");
+    write_json_string(name);
+    fprintf(trace_file, ",\"args\":{");
+    if (at != NULL) {
+        fprintf(trace_file, "\"file\":");
+        write_json_string(at->info.filename);
+        fprintf(trace_file, ",\"line\":%d", at->info.lineno);
+    }
+    if (arg != NULL) {
+        if (at != NULL) fputc(',', trace_file);
+        write_json_string(arg);
+        fprintf(trace_file, ":%d", value);
+    }
+    fprintf(trace_file, "}}");
+}
+
+void trace_begin(const char *cat, const char *name, const struct line *at, const char *arg, int value) {
+    if (trace_file == NULL) return;
+    begin_span(NULL, FALSE, cat, name, at, arg, value);
+}
+
+void trace_begin_until(const struct line *end, const char *cat, const char *name,
+                       const struct line *at, const char *arg, int value) {
+    if (trace_file == NULL) return;
+    begin_span(end, TRUE, cat, name, at, arg, value);
+}
+
+void trace_end() {
+    if (trace_file == NULL || span_top == NULL) return;
+
+    struct trace_span *s = span_top;
+    span_top = s->prev;
+    free(s);
+
+    write_event_start('E');
+    fprintf(trace_file, "}");
+}
+
+void trace_reached(const struct line *line) {
+    if (trace_file == NULL) return;
+
+    // Find the outermost span that ends here. If the end line of an inner span
+    // was never reached (e.g. it was removed by an 'if'), it is ended as well.
+    struct trace_span *s, *found = NULL;
+    for (s = span_top; s != NULL; s = s->prev) {
+        if (s->until && s->end == line) found = s;
+    }
+    if (found == NULL) return;
+
+    while (span_top != found) trace_end();
+    trace_end();
+}
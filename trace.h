@@ -0,0 +1,40 @@
+/* asm8085 (C) 2021 Marinus Oosters
+ *
+ * trace.h: write a trace-event (chrome://tracing, Perfetto) file
+ * showing where assembly time is spent
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <time.h>
+
+#include "util.h"
+#include "parser_types.h"
+
+// Start writing a trace to the given file. Returns FALSE if it cannot be opened.
+int trace_open(const char *filename);
+
+// End all open spans and finish the trace file
+void trace_close();
+
+// Is a trace being written?
+int trace_enabled();
+
+// Begin a span. 'at' (may be NULL) gives the file and line, and 'arg' (may be NULL)
+// names an extra numeric argument.
+void trace_begin(const char *cat, const char *name, const struct line *at, const char *arg, int value);
+
+// End the innermost span
+void trace_end();
+
+// Begin a span that ends once assembly reaches the line 'end'
+// (or once assembly is finished, if end is NULL).
+void trace_begin_until(const struct line *end, const char *cat, const char *name,
+                       const struct line *at, const char *arg, int value);
+
+// Tell the tracer that assembly has reached the given line (NULL = end of assembly).
+void trace_reached(const struct line *line);
+
+#endif
@@ -2,37 +2,160 @@
 
 #include "util.h"
 
-#define RPL_BLK_SZ 1024
+// Add a character to a set, if it is not in it yet
+int charset_add(struct charset *set, char ch) {
+    if (memchr(set->chars, ch, set->n) != NULL) return TRUE;
+    if (set->n == CHARSET_MAX) return FALSE;
+    set->chars[set->n++] = ch;
+    return TRUE;
+}
 
-// Replace substrings in string, except within "..." or '...'
-char *string_replace(const char *str, const struct replacement *rpls, int n_replacements) {
-    char *out = malloc(sizeof(char) * RPL_BLK_SZ);
-    int *olens = malloc(sizeof(int) * n_replacements);
-    int *nlens = malloc(sizeof(int) * n_replacements);
-    int i, sidx, size;
-    char replaced = FALSE;
-    char strdelim = '\0';
-    char escaped = FALSE;
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#ifdef __AVX2__
+#define VEC __m256i
+#define VEC_SIZE 32
+#define VEC_LOAD(p) _mm256_load_si256(p)
+#define VEC_SPLAT(c) _mm256_set1_epi8(c)
+#define VEC_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define VEC_OR(a, b) _mm256_or_si256(a, b)
+#define VEC_MASK(v) ((uint32_t) _mm256_movemask_epi8(v))
+#else
+#define VEC __m128i
+#define VEC_SIZE 16
+#define VEC_LOAD(p) _mm_load_si128(p)
+#define VEC_SPLAT(c) _mm_set1_epi8(c)
+#define VEC_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define VEC_OR(a, b) _mm_or_si128(a, b)
+#define VEC_MASK(v) ((uint32_t) _mm_movemask_epi8(v))
+#endif
+
+// Find the first character in a string that is in the set. The loads are aligned, so they
+// never cross into a page the string is not in, but they can read past the terminator.
+__attribute__((no_sanitize_address))
+const char *scan_charset(const char *str, const struct charset *set) {
+    const VEC *block = (const VEC *) ((uintptr_t) str & ~(uintptr_t) (VEC_SIZE-1));
+    uint32_t mask = ~(uint32_t) 0 << (str - (const char *) block); // ignore the bytes before str
+    VEC bytes, found, chars[CHARSET_MAX];
+    int i;
     
-    if (out == NULL || olens == NULL || nlens == NULL) {
-        if(out) free(out);
-        if(olens) free(olens);
-        if(nlens) free(nlens);
-        FATAL_ERROR("failed to allocate memory during string replacement");
+    for (i=0; i<set->n; i++) chars[i] = VEC_SPLAT(set->chars[i]);
+    
+    for (;;) {
+        bytes = VEC_LOAD(block);
+        found = VEC_EQ(bytes, VEC_SPLAT(0));
+        for (i=0; i<set->n; i++) found = VEC_OR(found, VEC_EQ(bytes, chars[i]));
+        
+        mask &= VEC_MASK(found);
+        if (mask) return (const char *) block + __builtin_ctz(mask);
+        
+        block++;
+        mask = ~(uint32_t) 0;
+    }
+}
+
+#else
+
+// Find the first character in a string that is in the set
+const char *scan_charset(const char *str, const struct charset *set) {
+    while (*str && memchr(set->chars, *str, set->n) == NULL) str++;
+    return str;
+}
+
+#endif
+
+// Make a set of patterns to replace
+struct subst_patterns *make_subst_patterns(const char *const *old, int n) {
+    struct subst_patterns *p = calloc(1, sizeof(struct subst_patterns));
+    int i, j, k, c, count[256] = {0};
+    
+    if (p == NULL
+     || (p->old = malloc(sizeof(char *) * n)) == NULL
+     || (p->lengths = malloc(sizeof(int) * n)) == NULL
+     || (p->order = malloc(sizeof(int) * n)) == NULL) {
+        FATAL_ERROR("failed to allocate memory for replacement patterns");
     }
     
-    // Precalculate lengths of search and replacement strings
-    for (i=0; i<n_replacements; i++) {
-        olens[i] = strlen(rpls[i].old);
-        nlens[i] = strlen(rpls[i].new);
+    p->n = n;
+    p->stops.n = 0;
+    p->skip = charset_add(&p->stops, '"') && charset_add(&p->stops, '\'') && charset_add(&p->stops, '\\');
+    
+    for (i=0; i<n; i++) {
+        p->old[i] = copy_string(old[i]);
+        p->lengths[i] = strlen(old[i]);
+        
+        // An empty pattern never matches
+        if (!p->lengths[i]) continue;
+        count[(unsigned char) old[i][0]]++;
+        
+        // Nothing happens at characters that are not quotes, backslashes or the start of
+        // a pattern, so those can be skipped in one go (if they fit in a set).
+        if (!charset_add(&p->stops, old[i][0])) p->skip = FALSE;
+    }
+    
+    // Group the patterns by first character, longest first
+    for (c=0; c<256; c++) p->first[c+1] = p->first[c] + count[c];
+    memset(count, 0, sizeof(count));
+    for (i=0; i<n; i++) {
+        if (!p->lengths[i]) continue;
+        c = (unsigned char) old[i][0];
+        k = p->first[c] + count[c]++;
+        for (j = k; j > p->first[c] && p->lengths[p->order[j-1]] < p->lengths[i]; j--) {
+            p->order[j] = p->order[j-1];
+        }
+        p->order[j] = i;
+    }
+    
+    return p;
+}
+
+// Free a set of patterns
+void free_subst_patterns(struct subst_patterns *p) {
+    int i;
+    if (p == NULL) return;
+    for (i=0; i<p->n; i++) free(p->old[i]);
+    free(p->old);
+    free(p->lengths);
+    free(p->order);
+    free(p);
+}
+
+// Find the longest pattern the string starts with, or -1 if none
+static int match_pattern(const struct subst_patterns *p, const char *str) {
+    int k, c = (unsigned char) *str;
+    for (k = p->first[c]; k < p->first[c+1]; k++) {
+        if (!strncmp(p->old[p->order[k]], str, p->lengths[p->order[k]])) return p->order[k];
+    }
+    return -1;
+}
+
+// Find where the patterns occur in a string, except within "..." or '...'
+struct subst_template *make_subst_template(const char *str, const struct subst_patterns *p) {
+    struct subst_template *t = calloc(1, sizeof(struct subst_template));
+    size_t size = strlen(str);
+    int i, run, length = 0;
+    char strdelim = '\0';
+    char escaped = FALSE;
+    
+    // There is at most one piece per character, and one at the end
+    if (t == NULL
+     || (t->text = malloc(size + 1)) == NULL
+     || (t->pieces = malloc(sizeof(struct subst_piece) * (size + 1))) == NULL) {
+        FATAL_ERROR("failed to allocate memory for replacement template");
     }
     
-    sidx = 0;
-    size = RPL_BLK_SZ;
     while (*str) {
-        replaced = FALSE;
+        if (p->skip && !escaped) {
+            run = scan_charset(str, &p->stops) - str;
+            memcpy(t->text + t->length, str, run);
+            t->length += run;
+            length += run;
+            str += run;
+            if (!*str) break;
+        }
         
         // Do not apply replacements within string literals
+        i = -1;
         if (escaped) {
             // Next character is not escaped, but this one is copied verbatim
             escaped = FALSE;
@@ -46,48 +169,106 @@ char *string_replace(const char *str, const struct replacement *rpls, int n_repl
             // End of string
             strdelim = '\0';
         } else if (!strdelim) {
-            // Not in a string, so attempt to apply replacement
-            
-            for (i=0; i<n_replacements; i++) {
-                // String starts with replacement?
-                if (! strncmp(rpls[i].old, str, olens[i])) {
-                    // Allocate more memory if necessary
-                    if (sidx + nlens[i] >= size) {
-                        size += RPL_BLK_SZ;
-                        out = realloc(out, sizeof(char) * size);
-                        if (out == NULL) FATAL_ERROR("failed to allocate memory during string replacement");
-                    }
-                    // Write replacement
-                    memcpy(out+sidx, rpls[i].new, nlens[i]);
-                    sidx += nlens[i];
-                    str += olens[i];
-                    replaced = TRUE;
-                    break;
-                }
-            }
+            // Not in a string, so see if a pattern starts here
+            i = match_pattern(p, str);
         }
         
-        if (!replaced) {
-            // Write current character unchanged
-            if (sidx >= size) {
-                // Allocate more memory if necessary
-                size += RPL_BLK_SZ;
-                out = realloc(out, sizeof(char) * size);
-            }
-            out[sidx++] = *str;
-            str++;
+        if (i != -1) {
+            // End the piece with the replacement
+            t->pieces[t->n_pieces].length = length;
+            t->pieces[t->n_pieces++].pattern = i;
+            length = 0;
+            str += p->lengths[i];
+        } else {
+            // Copy the current character unchanged
+            t->text[t->length++] = *str++;
+            length++;
         }
     }
     
-    // zero-terminate the string
-    out[sidx++] = '\0';
+    t->text[t->length] = '\0';
+    t->pieces[t->n_pieces].length = length;
+    t->pieces[t->n_pieces++].pattern = -1;
+    
+    // free any unused memory
+    t->pieces = realloc(t->pieces, sizeof(struct subst_piece) * t->n_pieces);
+    if (t->pieces == NULL) FATAL_ERROR("failed to allocate memory for replacement template");
     
-    // free any unused memory 
-    out = realloc(out, sizeof(char) * sidx);
-    if (out == NULL) FATAL_ERROR("failed to allocate memory during string replacement");
+    return t;
+}
+
+// Free a template
+void free_subst_template(struct subst_template *t) {
+    if (t == NULL) return;
+    free(t->text);
+    free(t->pieces);
+    free(t);
+}
+
+// Size of the string a template gives, including the terminator
+size_t subst_size(const struct subst_template *t, const size_t *lengths) {
+    size_t size = t->length + 1;
+    int i;
+    for (i=0; i<t->n_pieces; i++) {
+        if (t->pieces[i].pattern != -1) size += lengths[t->pieces[i].pattern];
+    }
+    return size;
+}
+
+// Write the string a template gives into 'out', which must be big enough
+char *subst_apply(const struct subst_template *t, const char *const *new, const size_t *lengths, char *out) {
+    const char *text = t->text;
+    char *ptr = out;
+    int i, pattern;
+    
+    for (i=0; i<t->n_pieces; i++) {
+        memcpy(ptr, text, t->pieces[i].length);
+        ptr += t->pieces[i].length;
+        text += t->pieces[i].length;
+        
+        if ((pattern = t->pieces[i].pattern) != -1) {
+            memcpy(ptr, new[pattern], lengths[pattern]);
+            ptr += lengths[pattern];
+        }
+    }
+    
+    *ptr = '\0';
+    return out;
+}
+
+// Replace substrings in string, except within "..." or '...'
+char *string_replace(const char *str, const struct replacement *rpls, int n_replacements) {
+    const char **old = malloc(sizeof(char *) * n_replacements);
+    const char **new = malloc(sizeof(char *) * n_replacements);
+    size_t *lengths = malloc(sizeof(size_t) * n_replacements);
+    struct subst_patterns *patterns;
+    struct subst_template *template;
+    char *out;
+    int i;
+    
+    if (old == NULL || new == NULL || lengths == NULL) {
+        FATAL_ERROR("failed to allocate memory during string replacement");
+    }
+    
+    for (i=0; i<n_replacements; i++) {
+        old[i] = rpls[i].old;
+        new[i] = rpls[i].new;
+        lengths[i] = strlen(rpls[i].new);
+    }
+    
+    patterns = make_subst_patterns(old, n_replacements);
+    template = make_subst_template(str, patterns);
+    
+    if ((out = malloc(subst_size(template, lengths))) == NULL) {
+        FATAL_ERROR("failed to allocate memory during string replacement");
+    }
+    subst_apply(template, new, lengths, out);
     
-    free(olens);
-    free(nlens);
+    free_subst_template(template);
+    free_subst_patterns(patterns);
+    free(old);
+    free(new);
+    free(lengths);
     return out; 
 }
 
@@ -11,6 +11,12 @@
 #include <stdint.h>
 #include <errno.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define FALSE 0
 #define TRUE (!FALSE)
 
@@ -27,7 +33,61 @@ struct replacement {
     char *new;
 };
 
-// Replace substrings in string, except within "..." or '...'
+// A small set of characters to scan for
+#define CHARSET_MAX 16
+struct charset {
+    int n;
+    char chars[CHARSET_MAX];
+};
+
+// Add a character to a set, if it is not in it yet. Returns FALSE if the set is full.
+int charset_add(struct charset *set, char ch);
+
+// Find the first character in a string that is in the set, or the terminator if there is none.
+// This checks 16 or 32 characters at a time where SSE2 or AVX2 is available.
+const char *scan_charset(const char *str, const struct charset *set);
+
+// Patterns to replace. Patterns that start with the same character are tried longest first.
+struct subst_patterns {
+    int n;
+    char **old;
+    int *lengths;
+    int *order;           // pattern numbers, grouped by first character
+    int first[257];       // the patterns starting with c are order[first[c]] up to order[first[c+1]-1]
+    struct charset stops; // quotes, backslashes and the first characters of the patterns
+    char skip;            // all of those fit in 'stops'
+};
+
+// Where the patterns occur in a string. The text between them is stored one piece after another;
+// each piece of text is followed by the replacement for a pattern (-1 for the last piece).
+struct subst_piece {
+    int length;
+    int pattern;
+};
+
+struct subst_template {
+    char *text;
+    int length;
+    int n_pieces;
+    struct subst_piece *pieces;
+};
+
+// Make a set of patterns to replace (the strings are copied)
+struct subst_patterns *make_subst_patterns(const char *const *old, int n);
+void free_subst_patterns(struct subst_patterns *);
+
+// Find where the patterns occur in a string, except within "..." or '...'
+struct subst_template *make_subst_template(const char *str, const struct subst_patterns *);
+void free_subst_template(struct subst_template *);
+
+// Size of the string a template gives (including the terminator), given the lengths of the replacements
+size_t subst_size(const struct subst_template *, const size_t *lengths);
+
+// Write the string a template gives, with the given replacements, into 'out', which must be big enough.
+// Returns 'out'.
+char *subst_apply(const struct subst_template *, const char *const *new, const size_t *lengths, char *out);
+
+// Replace substrings in string, except within "..." or '...'. Where several match, the longest wins.
 char *string_replace(const char *str, const struct replacement *rpls, int n_replacements);
 
 // Join two strings